@@ -0,0 +1,97 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <cmath>
+#include <vector>
+
+// Camera conventions shared by the renderer and the offline tools: x right,
+// y down, z forward (looking down the positive z axis).
+
+namespace viewer::camera {
+
+struct CameraIntrinsics {
+    float fx;
+    float fy;
+    float width;
+    float height;
+};
+
+constexpr float Z_NEAR = 0.2f;
+constexpr float Z_FAR = 200.f;
+
+// Pinhole intrinsics with the given horizontal field of view
+inline CameraIntrinsics from_fov(float fov_deg, float width, float height) {
+    const float fxy = 0.5f * width / std::tan(0.5f * fov_deg * M_PI / 180.f);
+    return {.fx = fxy, .fy = fxy, .width = width, .height = height};
+}
+
+// The same camera rendered at a different resolution
+inline CameraIntrinsics resized(const CameraIntrinsics& c, float width, float height) {
+    return {
+        .fx = c.fx * width / c.width,
+        .fy = c.fy * height / c.height,
+        .width = width,
+        .height = height,
+    };
+}
+
+inline Eigen::Matrix4f projection_matrix(const CameraIntrinsics& c) {
+    constexpr float dz = Z_FAR - Z_NEAR;
+    Eigen::Matrix4f P;
+    // clang-format off
+    P <<
+        2.f * c.fx / c.width,  0.f,                   0.f,         0.f,
+        0.f,                  -2.f * c.fy / c.height, 0.f,         0.f,
+        0.f,                   0.f,                   Z_FAR / dz, -Z_FAR * Z_NEAR / dz,
+        0.f,                   0.f,                   1.f,         0.f;
+    // clang-format on
+    return P;
+}
+
+// View matrix of a camera at `eye` looking at `target`
+inline Eigen::Matrix4f look_at(const Eigen::Vector3f& eye,
+                               const Eigen::Vector3f& target,
+                               const Eigen::Vector3f& up) {
+    const Eigen::Vector3f z = (target - eye).normalized();
+    const Eigen::Vector3f x = (-up).cross(z).normalized();
+    const Eigen::Vector3f y = z.cross(x);
+
+    Eigen::Matrix4f V = Eigen::Matrix4f::Identity();
+    V.block<1, 3>(0, 0) = x.transpose();
+    V.block<1, 3>(1, 0) = y.transpose();
+    V.block<1, 3>(2, 0) = z.transpose();
+    V.block<3, 1>(0, 3) = -V.block<3, 3>(0, 0) * eye;
+    return V;
+}
+
+// Continues the camera motion from `v0` to `v1` by `s` times the same step
+// (rotation and camera center, rigid views only)
+inline Eigen::Matrix4f extrapolate_view(const Eigen::Matrix4f& v0,
+                                        const Eigen::Matrix4f& v1,
+                                        float s) {
+    const Eigen::Matrix3f R0 = v0.block<3, 3>(0, 0);
+    const Eigen::Matrix3f R1 = v1.block<3, 3>(0, 0);
+    const Eigen::Vector3f c0 = -R0.transpose() * v0.block<3, 1>(0, 3);
+    const Eigen::Vector3f c1 = -R1.transpose() * v1.block<3, 1>(0, 3);
+
+    Eigen::AngleAxisf step(Eigen::Matrix3f(R1 * R0.transpose()));
+    step.angle() *= s;
+    const Eigen::Matrix3f R = step.toRotationMatrix() * R1;
+    const Eigen::Vector3f c = c1 + s * (c1 - c0);
+
+    Eigen::Matrix4f V = Eigen::Matrix4f::Identity();
+    V.block<3, 3>(0, 0) = R;
+    V.block<3, 1>(0, 3) = -R * c;
+    return V;
+}
+
+// Mean pose of nearby views, by interpolating towards each view in turn.
+// Exact for the positions, close to the mean rotation for small angles.
+inline Eigen::Matrix4f mean_view(const std::vector<Eigen::Matrix4f>& views) {
+    Eigen::Matrix4f mean = views.front();
+    for (size_t k = 1; k < views.size(); ++k)
+        mean = extrapolate_view(mean, views[k], 1.f / (k + 1) - 1.f);
+    return mean;
+}
+
+}
@@ -0,0 +1,242 @@
+#include "cpu_render.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace viewer::cpu_render {
+
+namespace {
+
+constexpr float SH_C0 = 0.28209479177387814f;
+constexpr float SH_C1 = 0.4886025119029199f;
+constexpr float SH_C2[5] = {
+    1.0925484305920792f,
+    -1.0925484305920792f,
+    0.31539156525252005f,
+    -1.0925484305920792f,
+    0.5462742152960396f,
+};
+constexpr float SH_C3[7] = {
+    -0.5900435899266435f,
+    2.890611442640554f,
+    -0.4570457994644658f,
+    0.3731763325901154f,
+    -0.4570457994644658f,
+    1.445305721320277f,
+    -0.5900435899266435f,
+};
+
+// See `cutoff_radius` in shaders/common.glsl
+constexpr float MIN_ALPHA = 1.f / 255.f;
+
+float cutoff_radius(float alpha) {
+    return std::sqrt(std::clamp(std::log(alpha / MIN_ALPHA), 0.f, 4.f));
+}
+
+// See `oit_weight` in shaders/oit_accumulate.fs
+float oit_weight(float alpha, float depth) {
+    const float z = std::abs(depth);
+    return alpha * std::clamp(
+        10.f / (1e-5f + std::pow(z / 5.f, 2.f) + std::pow(z / 200.f, 6.f)), 1e-2f, 3e3f);
+}
+
+Eigen::Vector3f sh(const dataset::Splat& s, size_t i) {
+    return Eigen::Vector3f(s.sh[i][0], s.sh[i][1], s.sh[i][2]);
+}
+
+Eigen::Vector3f get_rgb(const dataset::Splat& s, const Eigen::Vector3f& d, int sh_degree) {
+    Eigen::Vector3f rgb = Eigen::Vector3f::Constant(0.5f);
+
+    rgb += SH_C0 * sh(s, 0);
+
+    if (sh_degree >= 1) {
+        rgb +=
+            - SH_C1 * d.y() * sh(s, 1)
+            + SH_C1 * d.z() * sh(s, 2)
+            - SH_C1 * d.x() * sh(s, 3);
+    }
+
+    if (sh_degree >= 2) {
+        const float xx = d.x() * d.x();
+        const float yy = d.y() * d.y();
+        const float zz = d.z() * d.z();
+        const float xy = d.x() * d.y();
+        const float yz = d.y() * d.z();
+        const float xz = d.x() * d.z();
+        rgb +=
+            SH_C2[0] * xy * sh(s, 4) +
+            SH_C2[1] * yz * sh(s, 5) +
+            SH_C2[2] * (2.f * zz - xx - yy) * sh(s, 6) +
+            SH_C2[3] * xz * sh(s, 7) +
+            SH_C2[4] * (xx - yy) * sh(s, 8);
+
+        if (sh_degree >= 3) {
+            rgb +=
+                SH_C3[0] * d.y() * (3.f * xx - yy) * sh(s, 9) +
+                SH_C3[1] * d.z() * xy * sh(s, 10) +
+                SH_C3[2] * d.y() * (4.f * zz - xx - yy) * sh(s, 11) +
+                SH_C3[3] * d.z() * (2.f * zz - 3.f * xx - 3.f * yy) * sh(s, 12) +
+                SH_C3[4] * d.x() * (4.f * zz - xx - yy) * sh(s, 13) +
+                SH_C3[5] * d.z() * (xx - yy) * sh(s, 14) +
+                SH_C3[6] * d.x() * (xx - 3.f * yy) * sh(s, 15);
+        }
+    }
+
+    return rgb.cwiseMax(0.f).cwiseMin(1.f);
+}
+
+}
+
+Image render(const dataset::SplatBuffer& splats,
+             const std::vector<uint32_t>& order,
+             const Eigen::Matrix4f& view,
+             const camera::CameraIntrinsics& c,
+             int sh_degree,
+             Compositing compositing) {
+    Image img{
+        .width = static_cast<int>(c.width),
+        .height = static_cast<int>(c.height),
+        .pixels = {},
+    };
+    img.pixels.assign(img.width * img.height, Eigen::Vector4f::Zero());
+    // Weighted blended OIT: `pixels` holds the weighted sums until resolved
+    std::vector<float> revealage;
+    if (compositing == Compositing::WeightedOit)
+        revealage.assign(img.pixels.size(), 1.f);
+
+    const Eigen::Matrix4f projection = camera::projection_matrix(c);
+    const Eigen::Matrix3f R = view.block<3, 3>(0, 0);
+    const Eigen::Vector3f cam_pos = view.inverse().block<3, 1>(0, 3);
+    const Eigen::Vector2f viewport(c.width, c.height);
+
+    for (const uint32_t idx : order) {
+        const dataset::Splat& s = splats[idx];
+        const float cutoff = cutoff_radius(s.alpha);
+        if (cutoff == 0.f)
+            continue;
+        const Eigen::Vector3f center(s.center[0], s.center[1], s.center[2]);
+        const Eigen::Vector4f camspace = view * center.homogeneous();
+        const Eigen::Vector4f pos2d = projection * camspace;
+
+        const float bounds = 1.2f * pos2d.w();
+        if (pos2d.z() < -pos2d.w()
+            || pos2d.x() < -bounds
+            || pos2d.x() > bounds
+            || pos2d.y() < -bounds
+            || pos2d.y() > bounds)
+            continue;
+
+        Eigen::Matrix3f Vrk;
+        // clang-format off
+        Vrk <<
+            s.covA[0], s.covA[1], s.covA[2],
+            s.covA[1], s.covB[0], s.covB[1],
+            s.covA[2], s.covB[1], s.covB[2];
+        // clang-format on
+
+        const float z = camspace.z();
+        Eigen::Matrix<float, 2, 3> J;
+        // clang-format off
+        J <<
+            c.fx / z, 0.f,       -(c.fx * camspace.x()) / (z * z),
+            0.f,      -c.fy / z,  (c.fy * camspace.y()) / (z * z);
+        // clang-format on
+        const Eigen::Matrix<float, 2, 3> T = J * R;
+        const Eigen::Matrix2f cov = T * Vrk * T.transpose();
+
+        const float diagonal1 = cov(0, 0) + 0.3f;
+        const float off_diagonal = cov(0, 1);
+        const float diagonal2 = cov(1, 1) + 0.3f;
+
+        const float mid = 0.5f * (diagonal1 + diagonal2);
+        const float radius =
+            Eigen::Vector2f((diagonal1 - diagonal2) / 2.f, off_diagonal).norm();
+        const float lambda1 = mid + radius;
+        const float lambda2 = std::max(mid - radius, 0.1f);
+        const Eigen::Vector2f diagonal_vector =
+            Eigen::Vector2f(off_diagonal, lambda1 - diagonal1).normalized();
+        const Eigen::Vector2f v1 =
+            std::min(std::sqrt(2.f * lambda1), 1024.f) * diagonal_vector;
+        const Eigen::Vector2f v2 =
+            std::min(std::sqrt(2.f * lambda2), 1024.f)
+            * Eigen::Vector2f(diagonal_vector.y(), -diagonal_vector.x());
+        if (!v1.allFinite() || !v2.allFinite())
+            continue;
+
+        // Center and quad extents in pixels
+        const Eigen::Vector2f ndc = pos2d.head<2>() / pos2d.w();
+        const Eigen::Vector2f px_center =
+            (ndc + Eigen::Vector2f::Ones()).cwiseProduct(0.5f * viewport);
+        const Eigen::Vector2f extent = cutoff * (v1.cwiseAbs() + v2.cwiseAbs());
+        const int x0 = std::max(0, static_cast<int>(std::floor(px_center.x() - extent.x())));
+        const int x1 = std::min(img.width - 1, static_cast<int>(std::ceil(px_center.x() + extent.x())));
+        const int y0 = std::max(0, static_cast<int>(std::floor(px_center.y() - extent.y())));
+        const int y1 = std::min(img.height - 1, static_cast<int>(std::ceil(px_center.y() + extent.y())));
+        if (x0 > x1 || y0 > y1)
+            continue;
+
+        const Eigen::Vector3f rgb =
+            get_rgb(s, (center - cam_pos).normalized(), sh_degree);
+        const Eigen::Vector2f v1_inv = v1 / v1.squaredNorm();
+        const Eigen::Vector2f v2_inv = v2 / v2.squaredNorm();
+
+        for (int y = y0; y <= y1; ++y) {
+            for (int x = x0; x <= x1; ++x) {
+                const Eigen::Vector2f offset =
+                    Eigen::Vector2f(x + 0.5f, y + 0.5f) - px_center;
+                // Position within the quad, see `vPosition` in the shaders
+                const Eigen::Vector2f position(offset.dot(v1_inv), offset.dot(v2_inv));
+                if (position.cwiseAbs().maxCoeff() > cutoff)
+                    continue;
+                const float A = -position.squaredNorm();
+                if (A < -4.f)
+                    continue;
+                const float B = std::exp(A) * s.alpha;
+                if (B < MIN_ALPHA)
+                    continue;
+
+                Eigen::Vector4f& dst = img.pixels[y * img.width + x];
+                if (compositing == Compositing::WeightedOit) {
+                    const float w = oit_weight(B, pos2d.w());
+                    dst.head<3>() += w * B * rgb;
+                    dst.w() += w * B;
+                    revealage[y * img.width + x] *= 1.f - B;
+                    continue;
+                }
+                const float T_dst = 1.f - dst.w();
+                dst.head<3>() += T_dst * B * rgb;
+                dst.w() += T_dst * B;
+            }
+        }
+    }
+
+    // See `shaders/oit_composite.fs`
+    for (size_t i = 0; i < revealage.size(); ++i) {
+        Eigen::Vector4f& p = img.pixels[i];
+        const float alpha = 1.f - revealage[i];
+        p.head<3>() *= alpha / std::max(p.w(), 1e-5f);
+        p.w() = alpha;
+    }
+    return img;
+}
+
+ImageDiff compare(const Image& a, const Image& b) {
+    ImageDiff diff{.mean_abs_error = 0.0, .max_abs_error = 0.f, .affected_pixels = 0.0};
+    const size_t n = std::min(a.pixels.size(), b.pixels.size());
+    if (n == 0) return diff;
+
+    size_t affected = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const float err =
+            (a.pixels[i].head<3>() - b.pixels[i].head<3>()).cwiseAbs().maxCoeff();
+        diff.mean_abs_error += err;
+        diff.max_abs_error = std::max(diff.max_abs_error, err);
+        if (err > 1.f / 255.f)
+            ++affected;
+    }
+    diff.mean_abs_error /= n;
+    diff.affected_pixels = static_cast<double>(affected) / n;
+    return diff;
+}
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "camera.h"
+#include "dataset.h"
+
+#include <vector>
+#include <Eigen/Dense>
+
+// Reference CPU rasterizer mirroring `shaders/shader.vs` and
+// `shaders/shader.fs` (or `shaders/oit_accumulate.fs`). Slow, intended for offline analysis at low resolutions.
+
+namespace viewer::cpu_render {
+
+struct Image {
+    int width;
+    int height;
+    // Premultiplied rgb and accumulated alpha per pixel, row-major
+    std::vector<Eigen::Vector4f> pixels;
+};
+
+enum class Compositing {
+    // Front to back in the given order
+    Ordered,
+    // Weighted blended order-independent transparency, see
+    // `shaders/oit_accumulate.fs`. The order does not matter.
+    WeightedOit,
+};
+
+// Composites the splats in the order given by `order`
+Image render(const dataset::SplatBuffer& splats,
+             const std::vector<uint32_t>& order,
+             const Eigen::Matrix4f& view,
+             const camera::CameraIntrinsics& c,
+             int sh_degree = 3,
+             Compositing compositing = Compositing::Ordered);
+
+struct ImageDiff {
+    double mean_abs_error;
+    float max_abs_error;
+    // Fraction of pixels with a visible (> 1/255) difference in any channel
+    double affected_pixels;
+};
+
+ImageDiff compare(const Image& a, const Image& b);
+
+}
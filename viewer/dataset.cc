@@ -1,67 +1,343 @@
 #include "dataset.h"
+#include "camera.h"
 #include "logging.h"
+#include "parallel.h"
 #include "ply.h"
 #include "tracing.h"
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
 
 namespace viewer::dataset {
 
 namespace {
 
-void sort_fast(const SplatBuffer& buf, const Eigen::Matrix4f& P, SortResult* out) {
-    // From https://github.com/antimatter15/splat
-    const size_t N = buf.size();
-    float min_d = std::numeric_limits<float>::infinity();
-    float max_d = -std::numeric_limits<float>::infinity();
+// Maps a float to an unsigned integer with the same ordering
+uint32_t float_to_key(float f) {
+    const uint32_t u = std::bit_cast<uint32_t>(f);
+    return u ^ ((u >> 31) ? 0xffffffffu : 0x80000000u);
+}
+
+// Integer hash with good avalanche behaviour (lowbias32 by Chris Wellons)
+uint32_t hash(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Bits per axis of the space-filling curve keys, 3 * 10 fit a radix sort key
+constexpr int CURVE_BITS = 10;
+
+// Inserts two zero bits above each of the lower `CURVE_BITS` bits
+uint32_t spread_bits(uint32_t v) {
+    v &= (1u << CURVE_BITS) - 1;
+    v = (v | (v << 16)) & 0x030000ffu;
+    v = (v | (v << 8)) & 0x0300f00fu;
+    v = (v | (v << 4)) & 0x030c30c3u;
+    v = (v | (v << 2)) & 0x09249249u;
+    return v;
+}
+
+uint32_t morton_key(std::array<uint32_t, 3> p) {
+    return (spread_bits(p[0]) << 2) | (spread_bits(p[1]) << 1) | spread_bits(p[2]);
+}
+
+// Hilbert index of a grid cell, by transposing the coordinates into the
+// index bits (Skilling, "Programming the Hilbert curve", 2004)
+uint32_t hilbert_key(std::array<uint32_t, 3> p) {
+    constexpr uint32_t M = 1u << (CURVE_BITS - 1);
+    for (uint32_t q = M; q > 1; q >>= 1) {
+        const uint32_t mask = q - 1;
+        for (int i = 0; i < 3; ++i) {
+            // Inverts the low bits of p[0] if bit q of p[i] is set, exchanges
+            // them with those of p[i] otherwise. Branchless, the bits are
+            // random.
+            const uint32_t set = 0u - ((p[i] & q) != 0);
+            const uint32_t t = (p[0] ^ p[i]) & mask & ~set;
+            p[0] ^= (mask & set) | t;
+            p[i] ^= t;
+        }
+    }
+    // Gray encode
+    p[1] ^= p[0];
+    p[2] ^= p[1];
+    uint32_t t = 0;
+    for (uint32_t q = M; q > 1; q >>= 1) {
+        if (p[2] & q)
+            t ^= q - 1;
+    }
+    for (uint32_t& c : p)
+        c ^= t;
+    return morton_key(p);
+}
+
+// Covariance of a Gaussian with the given log scales and rotation
+// quaternion, its upper triangle row by row
+void covariance(const Eigen::Vector3f& log_scale, const Eigen::Quaternionf& rotation,
+                float covA[3], float covB[3]) {
+    const Eigen::DiagonalMatrix<float, 3> scale(
+        std::exp(log_scale.x()),
+        std::exp(log_scale.y()),
+        std::exp(log_scale.z()));
+    const Eigen::Matrix3f R(rotation.normalized());
+    const Eigen::Matrix3f M = R * scale;
+    covA[0] = M.row(0).dot(M.row(0));
+    covA[1] = M.row(0).dot(M.row(1));
+    covA[2] = M.row(0).dot(M.row(2));
+    covB[0] = M.row(1).dot(M.row(1));
+    covB[1] = M.row(1).dot(M.row(2));
+    covB[2] = M.row(2).dot(M.row(2));
+}
+
+// Keeps the splats in `out->depth_index` that are neither deleted nor culled
+// and whose hashed index falls below `fraction`. The subset is the same for
+// every sort and grows monotonically with the fraction, so switching between
+// fractions does not flicker.
+void select_splats(float fraction, const DeletedMask* deleted,
+                   const std::vector<uint8_t>* culled, SortResult* out) {
+    const uint32_t threshold = static_cast<uint32_t>(
+        std::clamp(static_cast<double>(fraction), 0.0, 1.0) * 4294967295.0);
+    size_t num_selected = 0;
+    for (const uint32_t i : out->depth_index) {
+        if (deleted && (*deleted)[i].load(std::memory_order_relaxed))
+            continue;
+        if (culled && (*culled)[i])
+            continue;
+        if (threshold == 0xffffffffu || hash(i) <= threshold)
+            out->depth_index[num_selected++] = i;
+    }
+    out->depth_index.resize(num_selected);
+    out->keys.resize(num_selected);
+    out->keys_tmp.resize(num_selected);
+    out->index_tmp.resize(num_selected);
+}
+
+// Sorts `out->depth_index` by `out->keys`, which hold the key of each entry
+void radix_sort(int key_bits, SortResult* out) {
+    constexpr int RADIX_BITS = SortResult::RADIX_BITS;
+    constexpr uint32_t RADIX_MASK = (1u << RADIX_BITS) - 1;
+    const int num_passes = (key_bits + RADIX_BITS - 1) / RADIX_BITS;
+    const size_t N = out->keys.size();
+    if (N == 0) return;
+
+    auto& histograms = out->histograms;
+    for (size_t i = 0; i < N; ++i) {
+        const uint32_t key = out->keys[i];
+        for (int pass = 0; pass < num_passes; ++pass)
+            ++histograms[pass][(key >> (pass * RADIX_BITS)) & RADIX_MASK];
+    }
+
+    for (int pass = 0; pass < num_passes; ++pass) {
+        const int shift = pass * RADIX_BITS;
+        auto& counts = histograms[pass];
+
+        // All keys share this digit, the pass would not change anything
+        if (counts[(out->keys[0] >> shift) & RADIX_MASK] == N)
+            continue;
+
+        uint64_t start = 0;
+        for (auto& count : counts) {
+            const uint64_t n = count;
+            count = start;
+            start += n;
+        }
 
-    {
-        tracing::RecorderGuard tracing_guard("depth computation");
-        constexpr int DEPTH_SCALE = 4096;
         for (size_t i = 0; i < N; ++i) {
-            const float depth = DEPTH_SCALE * P.block<1, 3>(2, 0).dot(
-                Eigen::Vector3f(buf.at(i).center[0],
-                                buf.at(i).center[1],
-                                buf.at(i).center[2]));
-            out->sizes[i] = static_cast<int>(depth);
-            max_d = std::max(depth, max_d);
-            min_d = std::min(depth, min_d);
+            const uint32_t key = out->keys[i];
+            const uint64_t dst = counts[(key >> shift) & RADIX_MASK]++;
+            out->keys_tmp[dst] = key;
+            out->index_tmp[dst] = out->depth_index[i];
         }
+        std::swap(out->keys, out->keys_tmp);
+        std::swap(out->depth_index, out->index_tmp);
     }
+}
 
-    {
-        tracing::RecorderGuard tracing_guard("counting sort");
-        const int32_t M = static_cast<int32_t>(out->counts0.size());
-        const float depth_inv = M / (max_d - min_d);
+struct DepthRange {
+    float min;
+    float max;
+};
+
+// Camera-space depth (the w row of `P`) of the splats in `out->depth_index`
+// into `out->depths`, in the same order. Returns their range, over splats
+// inside the view frustum only if requested, and the depth quantiles for
+// `DepthBinning::Equalized`.
+DepthRange compute_depths(const Centers& centers, const Eigen::Matrix4f& P,
+                          const SortOptions& options, SortResult* out) {
+    const size_t N = out->depth_index.size();
+    const Eigen::Vector4f p = P.row(3).transpose();
+
+    DepthRange range = {
+        .min = std::numeric_limits<float>::infinity(),
+        .max = -std::numeric_limits<float>::infinity(),
+    };
+    if (options.visible_range) {
+        out->visible.resize(N);
+        for (size_t i = 0; i < N; ++i) {
+            // Same test as the vertex shader
+            const Eigen::Vector4f pos2d = P * centers[out->depth_index[i]].homogeneous();
+            const float bounds = 1.2f * pos2d.w();
+            const bool visible = pos2d.z() >= -pos2d.w()
+                && std::abs(pos2d.x()) <= bounds
+                && std::abs(pos2d.y()) <= bounds;
+            out->depths[i] = pos2d.w();
+            out->visible[i] = visible;
+            if (visible) {
+                range.min = std::min(pos2d.w(), range.min);
+                range.max = std::max(pos2d.w(), range.max);
+            }
+        }
+    } else {
         for (size_t i = 0; i < N; ++i) {
-            out->sizes[i] =
-                std::clamp(static_cast<int32_t>((out->sizes[i] - min_d) * depth_inv), 0, M - 1);
-            ++(out->counts0[out->sizes[i]]);
+            const float depth = p.dot(centers[out->depth_index[i]].homogeneous());
+            out->depths[i] = depth;
+            range.min = std::min(depth, range.min);
+            range.max = std::max(depth, range.max);
         }
-        for (size_t i = 1; i < static_cast<size_t>(M); ++i)
-            out->starts0[i] = out->starts0[i - 1] + out->counts0[i - 1];
-        for (size_t i = 0; i < N; ++i)
-            out->depth_index[out->starts0[out->sizes[i]]++] = i;
+    }
+
+    // Nothing visible
+    if (range.min > range.max)
+        range = {.min = 0.f, .max = 0.f};
+
+    if (options.binning == DepthBinning::Reciprocal
+        || options.binning == DepthBinning::Log) {
+        // Only defined in front of the camera, nothing closer than the near
+        // plane is drawn
+        range.min = std::max(range.min, camera::Z_NEAR);
+        range.max = std::max(range.max, camera::Z_NEAR);
+    }
+
+    if (options.binning == DepthBinning::Equalized) {
+        // Quantiles of a regular subsample of the depths in range
+        constexpr size_t NUM_SAMPLES = 1 << 16;
+        constexpr size_t NUM_QUANTILES = 1 << 10;
+        const size_t stride = std::max<size_t>(1, N / NUM_SAMPLES);
+        out->samples.clear();
+        for (size_t i = 0; i < N; i += stride) {
+            if (options.visible_range && !out->visible[i]) continue;
+            out->samples.push_back(out->depths[i]);
+        }
+        std::sort(out->samples.begin(), out->samples.end());
+        out->quantiles.clear();
+        if (!out->samples.empty()) {
+            for (size_t q = 0; q <= NUM_QUANTILES; ++q)
+                out->quantiles.push_back(
+                    out->samples[q * (out->samples.size() - 1) / NUM_QUANTILES]);
+        }
+
+        // First quantile of each uniform depth cell, to avoid a binary search
+        // per splat
+        out->quantile_lut.assign(SortResult::QUANTILE_LUT_SIZE, 0);
+        if (range.max > range.min && !out->quantiles.empty()) {
+            size_t k = 0;
+            for (size_t cell = 0; cell < out->quantile_lut.size(); ++cell) {
+                const float cell_start = range.min
+                    + (range.max - range.min) * cell / out->quantile_lut.size();
+                while (k + 1 < out->quantiles.size() && out->quantiles[k + 1] <= cell_start)
+                    ++k;
+                out->quantile_lut[cell] = k;
+            }
+        }
+    }
+
+    return range;
+}
+
+// Maps a depth to [0, 1] (clamped by the caller), monotonically increasing
+double normalized_depth(DepthBinning binning, float depth,
+                        float min_d, float max_d,
+                        const SortResult& sr) {
+    if (!(max_d > min_d)) return 0.0;
+    const double linear =
+        (static_cast<double>(depth) - min_d) / (static_cast<double>(max_d) - min_d);
+    switch (binning) {
+    case DepthBinning::Reciprocal:
+        return (1.0 / min_d - 1.0 / std::max(depth, min_d))
+            / (1.0 / min_d - 1.0 / max_d);
+    case DepthBinning::Log:
+        return std::log(std::max(depth, min_d) / static_cast<double>(min_d))
+            / std::log(max_d / static_cast<double>(min_d));
+    case DepthBinning::Equalized: {
+        // Piecewise linear inverse of the sampled depth distribution, mixed
+        // with the linear mapping so that sparsely populated depth ranges
+        // (typically the far tail) keep some resolution
+        const std::vector<float>& quantiles = sr.quantiles;
+        if (quantiles.size() < 2 || depth < quantiles.front()) return 0.5 * linear;
+        if (depth >= quantiles.back()) return 0.5 * (1.0 + linear);
+        const size_t cell = std::min<size_t>(
+            (depth - min_d) / (max_d - min_d) * sr.quantile_lut.size(),
+            sr.quantile_lut.size() - 1);
+        size_t k = sr.quantile_lut[cell];
+        while (k > 0 && quantiles[k] > depth)
+            --k;
+        while (quantiles[k + 1] <= depth)
+            ++k;
+        const double width = quantiles[k + 1] - quantiles[k];
+        const double frac = width > 0.0 ? (depth - quantiles[k]) / width : 0.0;
+        return 0.5 * ((k + frac) / (quantiles.size() - 1) + linear);
+    }
+    case DepthBinning::Linear:
+    default:
+        return linear;
     }
 }
 
-void sort_std(const SplatBuffer& buf, const Eigen::Matrix4f& P, SortResult* out) {
-    const size_t N = buf.size();
+void sort_fast(const Centers& centers, const Eigen::Matrix4f& P,
+               const SortOptions& options, SortResult* out) {
+    const size_t N = out->depth_index.size();
+    const int key_bits = std::clamp(options.key_bits, 8, SortResult::KEY_BITS);
+    const Eigen::Vector3f p = P.block<1, 3>(2, 0).transpose();
+
+    {
+        tracing::RecorderGuard tracing_guard("key computation");
+        switch (options.binning) {
+        case DepthBinning::Float: {
+            const int shift = SortResult::KEY_BITS - key_bits;
+            for (size_t i = 0; i < N; ++i)
+                out->keys[i] = float_to_key(p.dot(centers[out->depth_index[i]])) >> shift;
+            break;
+        }
+        default: {
+            const auto [min_d, max_d] = compute_depths(centers, P, options, out);
+            // Double precision, floats cannot address all bins of wide keys
+            const double max_key = std::ldexp(1.0, key_bits) - 1.0;
+            for (size_t i = 0; i < N; ++i) {
+                const double t = normalized_depth(
+                    options.binning, out->depths[i], min_d, max_d, *out);
+                out->keys[i] = static_cast<uint32_t>(std::clamp(t, 0.0, 1.0) * max_key);
+            }
+            break;
+        }
+        }
+    }
 
     {
+        tracing::RecorderGuard tracing_guard("radix sort");
+        radix_sort(key_bits, out);
+    }
+}
+
+void sort_std(const Centers& centers, const Eigen::Matrix4f& P, SortResult* out) {
+    {
+        // Indexed by splat, not by position in `depth_index`
         tracing::RecorderGuard tracing_guard("depth computation");
-        for (size_t i = 0; i < N; ++i) {
-            out->depths[i] = P.block<1, 3>(2, 0).dot(
-                Eigen::Vector3f(buf.at(i).center[0],
-                                buf.at(i).center[1],
-                                buf.at(i).center[2]));
+        for (const uint32_t i : out->depth_index) {
+            out->depths[i] = P.block<1, 3>(2, 0).dot(centers[i]);
         }
     }
 
     {
         tracing::RecorderGuard tracing_guard("std::sort");
-        for (size_t i = 0; i < N; ++i)
-            out->depth_index[i] = i;
         std::sort(out->depth_index.begin(), out->depth_index.end(),
                   [&](uint32_t i, uint32_t j) {
                       return out->depths[i] < out->depths[j];
@@ -70,11 +346,23 @@ void sort_std(const SplatBuffer& buf, const Eigen::Matrix4f& P, SortResult* out)
     }
 }
 
-}
-
-Dataset from_ply(const std::string& filename) {
-    tracing::RecorderGuard tracing_guard("load dataset");
-    ply::PlyFile ply(filename);
+// Decodes all rows of `ply` into `destination`, and their centers and radii
+// into `centers` and `radii` unless null, in the order of `rows` (see
+// `load_order`) unless empty. Only the coefficients up to `Degree` are read.
+template <int Degree>
+void decode_ply(ply::PlyFile& ply, const std::vector<uint32_t>& rows,
+                SplatT<Degree>* destination, Centers* centers, Radii* radii) {
+    // Decoded in the order of the file, written to the slot of each row
+    std::vector<uint32_t> slots;
+    if (!rows.empty()) {
+        slots.resize(rows.size());
+        for (size_t i = 0; i < rows.size(); ++i)
+            slots[rows[i]] = i;
+    }
+    if (centers)
+        centers->resize(ply.num_vertices());
+    if (radii)
+        radii->resize(ply.num_vertices());
 
     // Create accessors
     const auto x = ply.accessor<float>("x");
@@ -93,15 +381,35 @@ Dataset from_ply(const std::string& filename) {
     const auto f_dc_0 = ply.accessor<float>("f_dc_0");
     const auto f_dc_1 = ply.accessor<float>("f_dc_1");
     const auto f_dc_2 = ply.accessor<float>("f_dc_2");
-    std::vector<ply::PlyAccessor<float>> sh;
-    for (size_t i = 0; i < 45; ++i)
-        sh.push_back(ply.accessor<float>("f_rest_" + std::to_string(i)));
+    // `f_rest_*` holds the higher coefficients channel by channel. Those
+    // missing from the file stay zero.
+    const int file_rest = num_sh_coeffs(file_sh_degree(ply)) - 1;
+    const int num_rest = std::min(num_sh_coeffs(Degree) - 1, file_rest);
+    std::array<std::vector<ply::PlyAccessor<float>>, 3> sh;
+    for (int c = 0; c < 3; ++c) {
+        for (int i = 0; i < num_rest; ++i)
+            sh[c].push_back(ply.accessor<float>("f_rest_" + std::to_string(c * file_rest + i)));
+    }
 
-    SplatBuffer buffer(ply.num_vertices());
-    {
-        tracing::RecorderGuard tracing_guard("buffer population");
-        for (size_t row = 0; row < ply.num_vertices(); ++row) {
-            Splat& splat = buffer.at(row);
+    // Rows are decoded in chunks, keeping the readahead window one chunk in
+    // front of the decode cursor.
+    constexpr size_t READAHEAD_BYTES = 32 << 20;
+    const size_t chunk_rows = std::max<size_t>(1, READAHEAD_BYTES / ply.row_length());
+
+    tracing::RecorderGuard tracing_guard("buffer population");
+    ply.prefetch_rows(0, chunk_rows);
+    for (size_t row = 0; row < ply.num_vertices(); ++row) {
+        if (row % chunk_rows == 0) {
+            ply.prefetch_rows(row + chunk_rows, row + 2 * chunk_rows);
+            // Decoded rows are not needed anymore
+            if (row > 0)
+                ply.release_rows(row - chunk_rows, row);
+        }
+
+        {
+            // Assembled here and written in one go, `destination` may be
+            // write-combined memory
+            SplatT<Degree> splat = {};
 
             // Mean of each Gaussian
             splat.center[0] = x(row);
@@ -109,24 +417,9 @@ Dataset from_ply(const std::string& filename) {
             splat.center[2] = z(row);
 
             // Covariance
-            const Eigen::DiagonalMatrix<float, 3> scale(
-                std::exp(scale_0(row)),
-                std::exp(scale_1(row)),
-                std::exp(scale_2(row)));
-            const Eigen::Vector4f quat_coeffs(
-                rot_qx(row),
-                rot_qy(row),
-                rot_qz(row),
-                rot_qw(row));
-            const Eigen::Matrix3f R(
-                Eigen::Quaternionf(quat_coeffs.normalized()));
-            const Eigen::Matrix3f M = R * scale;
-            splat.covA[0] = M.row(0).dot(M.row(0));
-            splat.covA[1] = M.row(0).dot(M.row(1));
-            splat.covA[2] = M.row(0).dot(M.row(2));
-            splat.covB[0] = M.row(1).dot(M.row(1));
-            splat.covB[1] = M.row(1).dot(M.row(2));
-            splat.covB[2] = M.row(2).dot(M.row(2));
+            covariance(Eigen::Vector3f(scale_0(row), scale_1(row), scale_2(row)),
+                       Eigen::Quaternionf(rot_qw(row), rot_qx(row), rot_qy(row), rot_qz(row)),
+                       splat.covA, splat.covB);
 
             // Alpha
             splat.alpha = 1.f / (1.f + std::exp(-opacity(row)));
@@ -135,29 +428,563 @@ Dataset from_ply(const std::string& filename) {
             splat.sh[0][0] = f_dc_0(row);
             splat.sh[0][1] = f_dc_1(row);
             splat.sh[0][2] = f_dc_2(row);
-            for (size_t sh_idx = 1; sh_idx < 15; ++sh_idx) {
-                splat.sh[sh_idx][0] = sh.at(sh_idx - 1)(row);
-                splat.sh[sh_idx][1] = sh.at(sh_idx + 14)(row);
-                splat.sh[sh_idx][2] = sh.at(sh_idx + 29)(row);
+            for (int i = 0; i < num_rest; ++i) {
+                splat.sh[i + 1][0] = sh[0][i](row);
+                splat.sh[i + 1][1] = sh[1][i](row);
+                splat.sh[i + 1][2] = sh[2][i](row);
             }
 
+            const size_t slot = slots.empty() ? row : slots[row];
+            destination[slot] = splat;
+            if (centers)
+                (*centers)[slot] = Eigen::Vector3f(splat.center[0], splat.center[1], splat.center[2]);
+            if (radii)
+                (*radii)[slot] = bounding_radius(splat.covA, splat.covB);
         }
-        tracing_guard.print();
     }
+    tracing_guard.print();
+}
+
+// Header of `<file>.order`, followed by the rows in the order of the splats
+struct OrderCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t order;
+    uint64_t num_rows;
+    // Of the PLY file, to invalidate the cache when it changes
+    uint64_t file_size;
+    int64_t file_mtime;
+};
+
+constexpr char ORDER_CACHE_MAGIC[8] = {'s', 'p', 'l', 'a', 't', 'o', 'r', 'd'};
+constexpr uint32_t ORDER_CACHE_VERSION = 1;
 
-    return Dataset(std::move(buffer));
+OrderCacheHeader order_cache_header(const std::string& filename, SplatOrder order,
+                                    size_t num_rows) {
+    OrderCacheHeader header = {};
+    std::copy(std::begin(ORDER_CACHE_MAGIC), std::end(ORDER_CACHE_MAGIC), header.magic);
+    header.version = ORDER_CACHE_VERSION;
+    header.order = static_cast<uint32_t>(order);
+    header.num_rows = num_rows;
+    header.file_size = std::filesystem::file_size(filename);
+    header.file_mtime = static_cast<int64_t>(
+        std::filesystem::last_write_time(filename).time_since_epoch().count());
+    return header;
 }
 
-void Dataset::sort(const Eigen::Matrix4f& P, SortResult* out, bool fast_sort) const {
+// Empty unless `cache_filename` holds an order matching `expected`, and
+// each row in it exactly once
+std::vector<uint32_t> read_order_cache(const std::string& cache_filename,
+                                       const OrderCacheHeader& expected) {
+    std::ifstream in(cache_filename, std::ios::binary);
+    OrderCacheHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || std::memcmp(&header, &expected, sizeof(header)) != 0)
+        return {};
+    std::vector<uint32_t> rows(header.num_rows);
+    if (!in.read(reinterpret_cast<char*>(rows.data()), rows.size() * sizeof(uint32_t)))
+        return {};
+    // The decode writes to the slot of each row unchecked
+    std::vector<bool> seen(rows.size());
+    for (const uint32_t row : rows) {
+        if (row >= rows.size() || seen[row]) {
+            LOG_ERROR("%s is corrupt, recomputing the order", cache_filename.c_str());
+            return {};
+        }
+        seen[row] = true;
+    }
+    return rows;
+}
+
+// Rows of `ply` in the order of `options.order`, empty for the file order
+std::vector<uint32_t> load_order(const std::string& filename, ply::PlyFile& ply,
+                                 const LoadOptions& options) {
+    if (options.order == SplatOrder::File)
+        return {};
+
+    const std::string cache_filename = filename + ".order";
+    const OrderCacheHeader header =
+        order_cache_header(filename, options.order, ply.num_vertices());
+    if (options.cache_order) {
+        std::vector<uint32_t> rows = read_order_cache(cache_filename, header);
+        if (!rows.empty())
+            return rows;
+    }
+
+    // Only the centers are read here, the decode reads the file again
+    Centers centers(ply.num_vertices());
+    {
+        tracing::RecorderGuard tracing_guard("read centers");
+        const auto x = ply.accessor<float>("x");
+        const auto y = ply.accessor<float>("y");
+        const auto z = ply.accessor<float>("z");
+        for (size_t row = 0; row < centers.size(); ++row)
+            centers[row] = Eigen::Vector3f(x(row), y(row), z(row));
+    }
+    std::vector<uint32_t> rows = spatial_order(centers, options.order);
+
+    if (options.cache_order) {
+        std::ofstream out(cache_filename, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(rows.data()), rows.size() * sizeof(uint32_t));
+        if (!out)
+            LOG_ERROR("could not write %s", cache_filename.c_str());
+    }
+    return rows;
+}
+
+}
+
+int file_sh_degree(const ply::PlyFile& ply) {
+    int num_rest = 0;
+    while (ply.has_property("f_rest_" + std::to_string(num_rest)))
+        ++num_rest;
+    for (int degree = 3; degree > 0; --degree) {
+        if (num_rest >= 3 * (num_sh_coeffs(degree) - 1))
+            return degree;
+    }
+    return 0;
+}
+
+float bounding_radius(const float covA[3], const float covB[3]) {
+    return 3.f * std::sqrt(std::max(0.f, covA[0] + covB[0] + covB[2]));
+}
+
+Dataset from_ply(const std::string& filename, const LoadOptions& options) {
+    tracing::RecorderGuard tracing_guard("load dataset");
+    ply::PlyFile ply(filename,
+                     options.readahead ? ply::IoMode::Readahead : ply::IoMode::Mmap);
+    std::vector<uint32_t> rows = load_order(filename, ply, options);
+    SplatBuffer buffer(ply.num_vertices());
+    decode_ply(ply, rows, buffer.data(), nullptr, nullptr);
+    return Dataset(std::move(buffer), std::move(rows));
+}
+
+Dataset from_ply(const std::string& filename, const LoadOptions& options,
+                 const Allocator& allocate) {
+    tracing::RecorderGuard tracing_guard("load dataset");
+    ply::PlyFile ply(filename,
+                     options.readahead ? ply::IoMode::Readahead : ply::IoMode::Mmap);
+    const int sh_degree = std::clamp(options.sh_degree, 0, file_sh_degree(ply));
+    std::vector<uint32_t> rows = load_order(filename, ply, options);
+    void* const destination = allocate(ply.num_vertices(), sh_degree);
+    Centers centers;
+    Radii radii;
+    // Specialized per degree, lower ones read and write fewer coefficients
+    switch (sh_degree) {
+    case 0: decode_ply(ply, rows, static_cast<SplatT<0>*>(destination), &centers, &radii); break;
+    case 1: decode_ply(ply, rows, static_cast<SplatT<1>*>(destination), &centers, &radii); break;
+    case 2: decode_ply(ply, rows, static_cast<SplatT<2>*>(destination), &centers, &radii); break;
+    default: decode_ply(ply, rows, static_cast<SplatT<3>*>(destination), &centers, &radii); break;
+    }
+    return Dataset(std::move(centers), std::move(radii), sh_degree, std::move(rows));
+}
+
+std::vector<float> read_splat_params(const std::string& filename, int* sh_degree) {
+    tracing::RecorderGuard tracing_guard("read splat params");
+    ply::PlyFile ply(filename, ply::IoMode::Readahead);
+    *sh_degree = file_sh_degree(ply);
+    const int num_rest = num_sh_coeffs(*sh_degree) - 1;
+    std::vector<std::string> names = {"x", "y", "z", "f_dc_0", "f_dc_1", "f_dc_2"};
+    for (int i = 0; i < 3 * num_rest; ++i)
+        names.push_back("f_rest_" + std::to_string(i));
+    for (const char* name : {"opacity", "scale_0", "scale_1", "scale_2",
+                             "rot_0", "rot_1", "rot_2", "rot_3"})
+        names.push_back(name);
+    std::vector<ply::PlyAccessor<float>> accessors;
+    for (const std::string& name : names)
+        accessors.push_back(ply.accessor<float>(name));
+
+    const size_t num_params = accessors.size();
+    std::vector<float> params(ply.num_vertices() * num_params);
+    for (size_t row = 0; row < ply.num_vertices(); ++row) {
+        for (size_t k = 0; k < num_params; ++k)
+            params[row * num_params + k] = accessors[k](row);
+    }
+    return params;
+}
+
+void sort(const Centers& centers, const Eigen::Matrix4f& P,
+          SortResult* out, const SortOptions& options,
+          const DeletedMask* deleted, const std::vector<uint8_t>* culled) {
     tracing::RecorderGuard tracing_guard("sort");
 
-    const size_t N = buffer_.size();
+    const size_t N = centers.size();
     out->reset(N);
+    std::iota(out->depth_index.begin(), out->depth_index.end(), 0u);
+    if (options.fraction < 1.f || deleted || culled)
+        select_splats(options.fraction, deleted, culled, out);
 
-    if (fast_sort)
-        sort_fast(buffer_, P, out);
+    if (options.fast_sort)
+        sort_fast(centers, P, options, out);
     else
-        sort_std(buffer_, P, out);
+        sort_std(centers, P, out);
+}
+
+bool encode_chunks(SortResult* out, size_t min_run_length) {
+    tracing::RecorderGuard tracing_guard("encode chunks");
+    const size_t N = out->depth_index.size();
+    const size_t max_runs = N / std::max<size_t>(min_run_length, 1);
+    out->chunk_index.resize(N);
+    out->chunk_runs.clear();
+    uint32_t chunk = ~0u;
+    for (size_t i = 0; i < N; ++i) {
+        const uint32_t index = out->depth_index[i];
+        if (index / CHUNK_SIZE != chunk) {
+            // Bails out early, the radix sort interleaves the chunks
+            // entirely with wide keys
+            if (out->chunk_runs.size() == max_runs) {
+                out->chunk_index.clear();
+                out->chunk_runs.clear();
+                return false;
+            }
+            chunk = index / CHUNK_SIZE;
+            out->chunk_runs.push_back({.first = static_cast<uint32_t>(i), .chunk = chunk});
+        }
+        out->chunk_index[i] = static_cast<uint16_t>(index % CHUNK_SIZE);
+    }
+    return true;
+}
+
+Splat decode_splat(const float* params, int sh_degree) {
+    sh_degree = std::clamp(sh_degree, 0, 3);
+    const int num_rest = num_sh_coeffs(sh_degree) - 1;
+    const float* dc = params + 3;
+    const float* rest = dc + 3;
+    const float* opacity = rest + 3 * num_rest;
+    const float* scale = opacity + 1;
+    const float* rot = scale + 3;
+
+    Splat splat = {};
+    std::copy_n(params, 3, splat.center);
+    covariance(Eigen::Vector3f(scale[0], scale[1], scale[2]),
+               Eigen::Quaternionf(rot[0], rot[1], rot[2], rot[3]),
+               splat.covA, splat.covB);
+    splat.alpha = 1.f / (1.f + std::exp(-*opacity));
+    for (int c = 0; c < 3; ++c) {
+        splat.sh[0][c] = dc[c];
+        for (int i = 0; i < num_rest; ++i)
+            splat.sh[i + 1][c] = rest[c * num_rest + i];
+    }
+    return splat;
+}
+
+template <int Degree>
+void copy_splats(const Splat* splats, size_t num_splats, SplatT<Degree>* destination) {
+    for (size_t i = 0; i < num_splats; ++i) {
+        const Splat& s = splats[i];
+        SplatT<Degree> splat = {};
+        std::copy_n(s.center, 3, splat.center);
+        splat.alpha = s.alpha;
+        std::copy_n(s.covA, 3, splat.covA);
+        std::copy_n(s.covB, 3, splat.covB);
+        std::copy_n(&s.sh[0][0], 4 * num_sh_coeffs(Degree), &splat.sh[0][0]);
+        // Written in one go, `destination` may be write-combined memory
+        destination[i] = splat;
+    }
+}
+
+void copy_splats(const Splat* splats, size_t num_splats, int sh_degree, void* destination) {
+    switch (sh_degree) {
+    case 0:
+        copy_splats(splats, num_splats, static_cast<SplatT<0>*>(destination));
+        break;
+    case 1:
+        copy_splats(splats, num_splats, static_cast<SplatT<1>*>(destination));
+        break;
+    case 2:
+        copy_splats(splats, num_splats, static_cast<SplatT<2>*>(destination));
+        break;
+    default:
+        copy_splats(splats, num_splats, static_cast<SplatT<3>*>(destination));
+        break;
+    }
+}
+
+std::optional<SplatOrder> parse_splat_order(const std::string& name) {
+    if (name == "file") return SplatOrder::File;
+    if (name == "morton") return SplatOrder::Morton;
+    if (name == "hilbert") return SplatOrder::Hilbert;
+    return std::nullopt;
+}
+
+std::vector<uint32_t> spatial_order(const Centers& centers, SplatOrder order) {
+    tracing::RecorderGuard tracing_guard("spatial order");
+    const size_t N = centers.size();
+    SortResult result;
+    result.reset(N);
+    std::iota(result.depth_index.begin(), result.depth_index.end(), 0u);
+    if (order == SplatOrder::File || N == 0)
+        return std::move(result.depth_index);
+
+    // Bounds of a sample without the outer percent of each axis, so that a
+    // few stray splats far outside the scene do not collapse it into a few
+    // cells. Those are clamped to the border cells.
+    constexpr size_t MAX_SAMPLES = 65536;
+    const size_t stride = std::max<size_t>(1, N / MAX_SAMPLES);
+    Eigen::Vector3f lo, hi;
+    for (int axis = 0; axis < 3; ++axis) {
+        std::vector<float> samples;
+        for (size_t i = 0; i < N; i += stride)
+            samples.push_back(centers[i][axis]);
+        const auto nth = [&](double q) {
+            auto it = samples.begin() + static_cast<size_t>(q * (samples.size() - 1));
+            std::nth_element(samples.begin(), it, samples.end());
+            return *it;
+        };
+        lo[axis] = nth(0.01);
+        hi[axis] = nth(0.99);
+    }
+    // Cubic cells, a curve through stretched cells loses locality along the
+    // short axes
+    const float extent = std::max((hi - lo).maxCoeff(), 1e-6f);
+    const float scale = (1 << CURVE_BITS) / extent;
+
+    parallel_for(N, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            std::array<uint32_t, 3> cell;
+            for (int axis = 0; axis < 3; ++axis) {
+                const float t = (centers[i][axis] - lo[axis]) * scale;
+                cell[axis] = static_cast<uint32_t>(
+                    std::clamp(t, 0.f, static_cast<float>((1 << CURVE_BITS) - 1)));
+            }
+            result.keys[i] = order == SplatOrder::Hilbert ? hilbert_key(cell) : morton_key(cell);
+        }
+    });
+    radix_sort(3 * CURVE_BITS, &result);
+    tracing_guard.print();
+    return std::move(result.depth_index);
+}
+
+size_t splat_size(int sh_degree) {
+    switch (sh_degree) {
+    case 0: return sizeof(SplatT<0>);
+    case 1: return sizeof(SplatT<1>);
+    case 2: return sizeof(SplatT<2>);
+    default: return sizeof(SplatT<3>);
+    }
+}
+
+Dataset::Dataset(SplatBuffer&& buffer, std::vector<uint32_t>&& source_rows)
+    : buffer_(std::move(buffer)), source_rows_(std::move(source_rows)) {
+    centers_.reserve(buffer_.size());
+    radii_.reserve(buffer_.size());
+    for (const Splat& splat : buffer_) {
+        centers_.emplace_back(splat.center[0], splat.center[1], splat.center[2]);
+        radii_.push_back(bounding_radius(splat.covA, splat.covB));
+    }
+    init();
+}
+
+Dataset::Dataset(Centers&& centers, Radii&& radii, int sh_degree,
+                 std::vector<uint32_t>&& source_rows)
+    : sh_degree_(sh_degree)
+    , centers_(std::move(centers))
+    , radii_(std::move(radii))
+    , source_rows_(std::move(source_rows)) {
+    init();
+}
+
+void Dataset::init() {
+    if (size() > std::numeric_limits<uint32_t>::max())
+        LOG_FATAL("too many splats: %lu", size());
+    if (radii_.size() != size())
+        LOG_FATAL("%zu radii for %zu splats", radii_.size(), size());
+
+    if (source_rows_.empty()) {
+        source_rows_.resize(size());
+        std::iota(source_rows_.begin(), source_rows_.end(), 0u);
+    } else if (source_rows_.size() != size()) {
+        LOG_FATAL("%zu source rows for %zu splats", source_rows_.size(), size());
+    }
+    deleted_ = DeletedMask(size());
+    update_memory();
+}
+
+void Dataset::update_memory() {
+    splats_memory_.resize(buffer_.capacity() * sizeof(Splat));
+    centers_memory_.resize(centers_.capacity() * sizeof(Eigen::Vector3f)
+                           + radii_.capacity() * sizeof(float));
+    edit_memory_.resize(source_rows_.capacity() * sizeof(uint32_t) + deleted_.size());
+}
+
+Dataset::Dataset(Dataset&& other)
+    : buffer_(std::move(other.buffer_))
+    , sh_degree_(other.sh_degree_)
+    , centers_(std::move(other.centers_))
+    , radii_(std::move(other.radii_))
+    , source_rows_(std::move(other.source_rows_))
+    , deleted_(std::move(other.deleted_))
+    , num_deleted_(other.num_deleted_.load())
+    , splats_memory_(std::move(other.splats_memory_))
+    , centers_memory_(std::move(other.centers_memory_))
+    , edit_memory_(std::move(other.edit_memory_)) {}
+
+Dataset& Dataset::operator=(Dataset&& other) {
+    buffer_ = std::move(other.buffer_);
+    sh_degree_ = other.sh_degree_;
+    centers_ = std::move(other.centers_);
+    radii_ = std::move(other.radii_);
+    source_rows_ = std::move(other.source_rows_);
+    deleted_ = std::move(other.deleted_);
+    num_deleted_ = other.num_deleted_.load();
+    splats_memory_ = std::move(other.splats_memory_);
+    centers_memory_ = std::move(other.centers_memory_);
+    edit_memory_ = std::move(other.edit_memory_);
+    return *this;
+}
+
+void Dataset::sort(const Eigen::Matrix4f& P, SortResult* out,
+                   const SortOptions& options,
+                   const std::vector<uint8_t>* culled) const {
+    // Skipping deleted splats costs a pass over the mask
+    dataset::sort(centers_, P, out, options,
+                  num_deleted() > 0 ? &deleted_ : nullptr, culled);
+}
+
+template <typename Predicate>
+std::vector<IndexRange> Dataset::delete_if(Predicate predicate) {
+    tracing::RecorderGuard tracing_guard("delete splats");
+    // Ranges closer than this are merged, for fewer and larger uploads
+    constexpr size_t MERGE_GAP = 64;
+
+    std::vector<IndexRange> ranges;
+    size_t num_deleted = 0;
+    for (size_t i = 0; i < centers_.size(); ++i) {
+        if (!predicate(centers_[i]) || deleted(i)) continue;
+        deleted_[i].store(1, std::memory_order_relaxed);
+        ++num_deleted;
+        if (!ranges.empty() && i - ranges.back().end < MERGE_GAP)
+            ranges.back().end = i + 1;
+        else
+            ranges.push_back({.begin = i, .end = i + 1});
+    }
+    num_deleted_ += num_deleted;
+    return ranges;
+}
+
+std::vector<IndexRange> Dataset::delete_inside(const Box& box) {
+    return delete_if([&](const Eigen::Vector3f& p) { return box.contains(p); });
+}
+
+std::vector<IndexRange> Dataset::delete_outside(const Box& box) {
+    return delete_if([&](const Eigen::Vector3f& p) { return !box.contains(p); });
+}
+
+std::vector<IndexRange> Dataset::delete_range(IndexRange range) {
+    range.end = std::min(range.end, size());
+    size_t num_deleted = 0;
+    for (size_t i = range.begin; i < range.end; ++i) {
+        if (deleted(i)) continue;
+        deleted_[i].store(1, std::memory_order_relaxed);
+        ++num_deleted;
+    }
+    num_deleted_ += num_deleted;
+    if (num_deleted == 0)
+        return {};
+    return {range};
+}
+
+void Dataset::update(size_t first, const SplatBuffer& splats) {
+    if (first > size())
+        LOG_FATAL("update from splat %zu of %zu", first, size());
+    const size_t end = first + splats.size();
+    if (end > std::numeric_limits<uint32_t>::max())
+        LOG_FATAL("too many splats: %zu", end);
+    if (end > size()) {
+        centers_.resize(end);
+        radii_.resize(end);
+        source_rows_.resize(end, NO_SOURCE_ROW);
+        if (!buffer_.empty())
+            buffer_.resize(end);
+        DeletedMask deleted(end);
+        for (size_t i = 0; i < deleted_.size(); ++i)
+            deleted[i].store(deleted_[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        deleted_ = std::move(deleted);
+    }
+
+    size_t num_undeleted = 0;
+    for (size_t i = first; i < end; ++i) {
+        const Splat& splat = splats[i - first];
+        centers_[i] = Eigen::Vector3f(splat.center[0], splat.center[1], splat.center[2]);
+        radii_[i] = bounding_radius(splat.covA, splat.covB);
+        if (!buffer_.empty())
+            buffer_[i] = splat;
+        num_undeleted += deleted_[i].exchange(0, std::memory_order_relaxed);
+    }
+    num_deleted_ -= num_undeleted;
+    update_memory();
+}
+
+Dataset Dataset::compacted() const {
+    tracing::RecorderGuard tracing_guard("compaction");
+    const size_t num_live = size() - std::min(size(), num_deleted());
+    SplatBuffer buffer;
+    Centers centers;
+    Radii radii;
+    std::vector<uint32_t> source_rows;
+    buffer.reserve(buffer_.empty() ? 0 : num_live);
+    centers.reserve(num_live);
+    radii.reserve(num_live);
+    source_rows.reserve(num_live);
+    for (size_t i = 0; i < size(); ++i) {
+        if (deleted(i)) continue;
+        if (!buffer_.empty())
+            buffer.push_back(buffer_[i]);
+        centers.push_back(centers_[i]);
+        radii.push_back(radii_[i]);
+        source_rows.push_back(source_rows_[i]);
+    }
+
+    Dataset d(std::move(centers), std::move(radii), sh_degree_, std::move(source_rows));
+    d.buffer_ = std::move(buffer);
+    d.update_memory();
+    return d;
+}
+
+std::vector<IndexRange> Dataset::live_ranges() const {
+    std::vector<IndexRange> ranges;
+    for (size_t i = 0; i < size(); ++i) {
+        if (deleted(i)) continue;
+        if (!ranges.empty() && ranges.back().end == i)
+            ranges.back().end = i + 1;
+        else
+            ranges.push_back({.begin = i, .end = i + 1});
+    }
+    return ranges;
+}
+
+void save_ply(const Dataset& d, const std::string& source, const std::string& filename) {
+    save_ply(saved_rows(d), source, filename);
+}
+
+std::vector<uint32_t> saved_rows(const Dataset& d) {
+    std::vector<uint32_t> rows;
+    rows.reserve(d.size() - d.num_deleted());
+    for (size_t i = 0; i < d.size(); ++i) {
+        if (!d.deleted(i))
+            rows.push_back(d.source_rows().at(i));
+    }
+    return rows;
+}
+
+void save_ply(const std::vector<uint32_t>& rows, const std::string& source,
+              const std::string& filename) {
+    tracing::RecorderGuard tracing_guard("save dataset");
+    const ply::PlyFile ply(source);
+
+    const std::string header = ply.header_with_num_vertices(rows.size());
+
+    std::ofstream out(filename, std::ios::binary);
+    out.write(header.data(), header.size());
+    for (const uint32_t row : rows) {
+        if (row >= ply.num_vertices())
+            LOG_FATAL("%s does not match the loaded scene", source.c_str());
+        out.write(ply.row(row), ply.row_length());
+    }
+    if (!out)
+        LOG_ERROR("could not write %s", filename.c_str());
+    tracing_guard.print();
 }
 
 }
@@ -1,55 +1,332 @@
 #pragma once
 
+#include "memory.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <optional>
 #include <string>
 #include <vector>
 #include <Eigen/Dense>
 
+namespace viewer::ply {
+class PlyFile;
+}
+
 namespace viewer::dataset {
 
-struct Splat {
-    // Must match splat buffer in `shaders/shader.vs`
+// Spherical harmonics coefficients per color channel up to `degree`
+constexpr int num_sh_coeffs(int degree) { return (degree + 1) * (degree + 1); }
+
+template <int Degree>
+struct SplatT {
+    // Must match splat buffer in `shaders/common.glsl` with
+    // `SPLAT_SH_DEGREE` = `Degree`
     // Must be aligned according to std430 layout.
     alignas(16) float center[3];
     alignas(4)  float alpha;
     alignas(16) float covA[3];
     alignas(16) float covB[3];
-    alignas(16) float sh[16][4]; // vec4 for alignment, TODO: wasteful
+    alignas(16) float sh[num_sh_coeffs(Degree)][4]; // vec4 for alignment, TODO: wasteful
+};
+
+// All coefficients, as kept on the host
+using Splat = SplatT<3>;
+
+// Of `SplatT<sh_degree>`
+size_t splat_size(int sh_degree);
+
+// Splats per chunk of `SortResult::chunk_index`
+constexpr size_t CHUNK_SIZE = 1 << 16;
+
+// A run of consecutive entries of `SortResult::chunk_index` in the same
+// chunk. Must match `shaders/shader.vs`.
+struct ChunkRun {
+    // Position of the run's first entry
+    uint32_t first;
+    uint32_t chunk;
 };
 
 using SplatBuffer = std::vector<Splat>;
 
+// Parameters per splat as trained and stored in PLY files, see `decode_splat`
+constexpr int num_splat_params(int sh_degree) { return 11 + 3 * num_sh_coeffs(sh_degree); }
+
+// Splat from its trained parameters in the order of the PLY properties:
+// x, y, z, f_dc_0-2, f_rest_* (the higher SH coefficients up to `sh_degree`,
+// channel by channel), opacity (logit), scale_0-2 (log), rot_0-3 (w first)
+Splat decode_splat(const float* params, int sh_degree);
+
+// The parameters of all splats of a PLY file in the order of its rows,
+// `num_splat_params(*sh_degree)` each, with `*sh_degree` set to that of the
+// file
+std::vector<float> read_splat_params(const std::string& filename, int* sh_degree);
+
+// Highest spherical harmonics degree with all coefficients in `ply`
+int file_sh_degree(const ply::PlyFile& ply);
+
+// Writes `splats` as `SplatT<sh_degree>` to `destination`, dropping the
+// coefficients above the degree
+void copy_splats(const Splat* splats, size_t num_splats, int sh_degree, void* destination);
+
 struct SortResult {
+    // LSD radix sort over 32 bit keys, `RADIX_BITS` per pass.
+    static constexpr int KEY_BITS = 32;
+    static constexpr int RADIX_BITS = 8;
+    static constexpr int NUM_PASSES = KEY_BITS / RADIX_BITS;
+    static constexpr size_t QUANTILE_LUT_SIZE = 4096;
+
     void reset(size_t num_vertices) {
         depth_index.resize(num_vertices);
+        chunk_index.clear();
+        chunk_runs.clear();
 
         // Scratch space
         depths.resize(num_vertices);
-        sizes.resize(num_vertices);
-        counts0.fill(0);
-        starts0.fill(0);
+        keys.resize(num_vertices);
+        keys_tmp.resize(num_vertices);
+        index_tmp.resize(num_vertices);
+        for (auto& counts : histograms)
+            counts.fill(0);
     }
 
     size_t num_vertices() const {
         return depth_index.size();
     }
 
+    // Allocated, including the scratch space
+    size_t num_bytes() const {
+        return sizeof(*this)
+            + (depth_index.capacity() + keys.capacity() + keys_tmp.capacity()
+               + index_tmp.capacity() + quantile_lut.capacity()) * sizeof(uint32_t)
+            + chunk_index.capacity() * sizeof(uint16_t)
+            + chunk_runs.capacity() * sizeof(ChunkRun)
+            + (depths.capacity() + samples.capacity() + quantiles.capacity()) * sizeof(float)
+            + visible.capacity() / 8;
+    }
+
     std::vector<uint32_t> depth_index;
+    // `depth_index` relative to chunks of `CHUNK_SIZE` splats, and the runs
+    // of entries in the same chunk, if `encode_chunks` succeeded. Empty
+    // otherwise.
+    std::vector<uint16_t> chunk_index;
+    std::vector<ChunkRun> chunk_runs;
 
     // Scratch space
     std::vector<float> depths;
-    std::vector<int32_t> sizes;
-    std::array<float, 256 * 256> counts0;
-    std::array<float, 256 * 256> starts0;
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> keys_tmp;
+    std::vector<uint32_t> index_tmp;
+    std::vector<bool> visible;
+    std::vector<float> samples;
+    std::vector<float> quantiles;
+    std::vector<uint32_t> quantile_lut;
+    std::array<std::array<uint64_t, 1 << RADIX_BITS>, NUM_PASSES> histograms;
+};
+
+enum class DepthBinning {
+    // Order-preserving bit pattern of the float depth, truncated to the key
+    // width. Exact for 32 bit keys, logarithmically spaced bins otherwise.
+    Float,
+    // Bins between the minimum and maximum camera-space depth, uniform in
+    // depth, in reciprocal depth (finer up close, like a z-buffer), in log
+    // depth, or following the sampled depth histogram (roughly equal numbers
+    // of splats per bin)
+    Linear,
+    Reciprocal,
+    Log,
+    Equalized,
+};
+
+struct SortOptions {
+    bool fast_sort = true;
+    // Key width of the radix sort (8 to 32). Narrower keys need fewer passes,
+    // splats that fall into the same bin end up in arbitrary order.
+    int key_bits = 32;
+    DepthBinning binning = DepthBinning::Float;
+    // Take the depth range over the splats in the view frustum only, so that
+    // floaters and splats behind the camera do not waste bins. Not used by
+    // `DepthBinning::Float`.
+    bool visible_range = false;
+    // Sort only a fixed pseudo-random subset of this fraction of the splats.
+    // The others are left out of `SortResult::depth_index` and not drawn.
+    float fraction = 1.f;
+
+    bool operator==(const SortOptions&) const = default;
+};
+
+using Centers = std::vector<Eigen::Vector3f>;
+
+// Bounding sphere radius of each splat, three times the square root of the
+// covariance trace, which bounds three standard deviations along any axis
+using Radii = std::vector<float>;
+float bounding_radius(const float covA[3], const float covB[3]);
+
+// Nonzero for deleted splats. Atomic, so that splats can be deleted while
+// another thread sorts.
+using DeletedMask = std::vector<std::atomic<uint8_t>>;
+
+// Sorts splats by their depth under the view-projection matrix `P`, front to
+// back, leaving out those marked in `deleted` or `culled` (nonzero for splats
+// to skip in this sort only, e.g. occluded ones). Exact for any number of
+// splats that can be indexed by `depth_index` when using `std::sort` or 32 bit
+// `DepthBinning::Float` keys.
+void sort(const Centers& centers, const Eigen::Matrix4f& P,
+          SortResult* out, const SortOptions& options = {},
+          const DeletedMask* deleted = nullptr,
+          const std::vector<uint8_t>* culled = nullptr);
+
+// Encodes `out->depth_index` into `out->chunk_index` and `out->chunk_runs`,
+// which take 2 bytes per entry plus 8 per run instead of 4 per entry. False,
+// leaving them empty, if the runs are shorter than `min_run_length` on
+// average. Splats of the same chunk are only consecutive where the sort does
+// not interleave them, e.g. within the bins of narrow keys.
+bool encode_chunks(SortResult* out, size_t min_run_length = 8);
+
+// Axis-aligned, bounds included
+struct Box {
+    Eigen::Vector3f min;
+    Eigen::Vector3f max;
+
+    // Without branches, which mispredict when scanning unordered splats
+    bool contains(const Eigen::Vector3f& p) const {
+        return (p.x() >= min.x()) & (p.y() >= min.y()) & (p.z() >= min.z())
+            & (p.x() <= max.x()) & (p.y() <= max.y()) & (p.z() <= max.z());
+    }
+
+    bool operator==(const Box&) const = default;
+};
+
+// Splats [begin, end)
+struct IndexRange {
+    size_t begin;
+    size_t end;
 };
 
 class Dataset {
 public:
-    Dataset(SplatBuffer&& buffer) : buffer_(buffer) {}
+    // `source_rows` as in `source_rows()`, empty if the splats are in the
+    // order of the file
+    Dataset(SplatBuffer&& buffer, std::vector<uint32_t>&& source_rows = {});
+    // Without the splats on the host, see `from_ply` with an `Allocator`
+    Dataset(Centers&& centers, Radii&& radii, int sh_degree,
+            std::vector<uint32_t>&& source_rows = {});
+    Dataset(Dataset&& other);
+    Dataset& operator=(Dataset&& other);
+
+    // Empty if the splats are not kept on the host
     const SplatBuffer& buffer() const { return buffer_; }
-    void sort(const Eigen::Matrix4f& P, SortResult* out, bool fast_sort=true) const;
+    size_t size() const { return centers_.size(); }
+    // Of the splat layout, `SplatT<sh_degree()>`. 3 with a host buffer.
+    int sh_degree() const { return sh_degree_; }
+    const Centers& centers() const { return centers_; }
+    const Radii& radii() const { return radii_; }
+    void sort(const Eigen::Matrix4f& P, SortResult* out,
+              const SortOptions& options = {},
+              const std::vector<uint8_t>* culled = nullptr) const;
+
+    // Deleted splats stay in the buffers and are skipped by the sort until
+    // `compacted` drops them. Returns the ranges containing newly deleted
+    // splats, nearby ones merged.
+    std::vector<IndexRange> delete_inside(const Box& box);
+    std::vector<IndexRange> delete_outside(const Box& box);
+    bool deleted(size_t i) const {
+        return deleted_[i].load(std::memory_order_relaxed) != 0;
+    }
+    size_t num_deleted() const {
+        return num_deleted_.load(std::memory_order_relaxed);
+    }
+    // Deletes splats [begin, end), clamped to the dataset, like
+    // `delete_inside`
+    std::vector<IndexRange> delete_range(IndexRange range);
+    // Overwrites the splats from `first` on, which is at most `size()`,
+    // appending those past the end. They are not deleted anymore. Must not
+    // run concurrently with anything else reading the dataset. The host
+    // buffer is only updated if there is one.
+    void update(size_t first, const SplatBuffer& splats);
+    // Copy without the deleted splats. Only the centers for datasets without
+    // a host buffer.
+    Dataset compacted() const;
+    // Runs of splats that `compacted` keeps, in order
+    std::vector<IndexRange> live_ranges() const;
+    // Row of each splat in the file it was loaded from, `NO_SOURCE_ROW` for
+    // splats appended by `update`
+    static constexpr uint32_t NO_SOURCE_ROW = ~0u;
+    const std::vector<uint32_t>& source_rows() const { return source_rows_; }
+
+private:
+    void init();
+    void update_memory();
+    template <typename Predicate>
+    std::vector<IndexRange> delete_if(Predicate predicate);
+
 private:
     SplatBuffer buffer_;
+    int sh_degree_ = 3;
+    // Compact copy of the splat centers for the CPU-side sort, and their
+    // extents for culling
+    Centers centers_;
+    Radii radii_;
+    std::vector<uint32_t> source_rows_;
+    DeletedMask deleted_;
+    std::atomic<size_t> num_deleted_ = 0;
+    memory::Allocation splats_memory_{memory::Subsystem::Splats};
+    memory::Allocation centers_memory_{memory::Subsystem::Centers};
+    memory::Allocation edit_memory_{memory::Subsystem::EditState};
+};
+
+// Order of the splats in memory
+enum class SplatOrder {
+    // As in the file, usually the order of training, which is spatially
+    // random
+    File,
+    // Along a Z-order or Hilbert curve over the centers, so that splats close
+    // in space, and thus in depth order, are close in memory. Hilbert keeps
+    // more of the neighbours together.
+    Morton,
+    Hilbert,
+};
+
+std::optional<SplatOrder> parse_splat_order(const std::string& name);
+
+// Indices of `centers` along the curve of `order`, the identity for
+// `SplatOrder::File`
+std::vector<uint32_t> spatial_order(const Centers& centers, SplatOrder order);
+
+struct LoadOptions {
+    // Issue sequential access hints and read ahead of the decoder instead of
+    // page faulting through the memory-mapped file (for slow storage).
+    bool readahead = false;
+    // Highest spherical harmonics degree to load, lower degrees need fewer
+    // coefficients per splat. Clamped to the degree of the file. Only for
+    // `from_ply` with an `Allocator`, host buffers always hold all of them.
+    int sh_degree = 3;
+    // Reorders the splats while loading, `Dataset::source_rows` maps them
+    // back to the rows of the file
+    SplatOrder order = SplatOrder::File;
+    // Keeps the order in `<file>.order`, reused as long as the file is
+    // unchanged
+    bool cache_order = false;
 };
 
-Dataset from_ply(const std::string& filename);
+Dataset from_ply(const std::string& filename, const LoadOptions& options = {});
+
+// Returns memory for `num_splats` splats of type `SplatT<sh_degree>`
+using Allocator = std::function<void*(size_t num_splats, int sh_degree)>;
+
+// Decodes the splats straight into memory from `allocate`, e.g. a mapped GPU
+// buffer. The dataset keeps only the centers for the sort, the memory-mapped
+// file is released as it is decoded.
+Dataset from_ply(const std::string& filename, const LoadOptions& options,
+                 const Allocator& allocate);
+
+// Writes the rows of `source`, the PLY file `d` was loaded from, that belong
+// to splats which are not deleted. Keeps all properties as they are.
+void save_ply(const Dataset& d, const std::string& source, const std::string& filename);
+// The rows of `source` to write for `d`, see `save_ply`
+std::vector<uint32_t> saved_rows(const Dataset& d);
+void save_ply(const std::vector<uint32_t>& rows, const std::string& source,
+              const std::string& filename);
 }
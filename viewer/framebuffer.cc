@@ -0,0 +1,140 @@
+#include "framebuffer.h"
+#include "logging.h"
+
+#include <glad/glad.h>
+
+#include <iterator>
+#include <utility>
+
+namespace viewer::rendering {
+
+Framebuffer::Framebuffer(bool with_depth)
+    : with_depth_(with_depth)
+    , fbo_(0)
+    , depth_fbo_(0)
+    , tex_color_(0)
+    , rb_depth_(0)
+    , width_(0)
+    , height_(0)
+    , memory_(memory::Subsystem::GpuFramebuffers) {
+    glGenFramebuffers(1, &fbo_);
+    if (with_depth_) {
+        glGenFramebuffers(1, &depth_fbo_);
+        glGenRenderbuffers(1, &rb_depth_);
+    }
+}
+
+Framebuffer::~Framebuffer() {
+    glDeleteFramebuffers(1, &fbo_);
+    glDeleteFramebuffers(1, &depth_fbo_);
+    glDeleteTextures(1, &tex_color_);
+    glDeleteRenderbuffers(1, &rb_depth_);
+}
+
+void Framebuffer::resize(int width, int height) {
+    if (width == width_ && height == height_)
+        return;
+    width_ = width;
+    height_ = height;
+    // RGBA8 color, 24 bit depth padded to 32
+    memory_.resize(static_cast<size_t>(width) * height * (with_depth_ ? 8 : 4));
+
+    GLint prev_fbo;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prev_fbo);
+
+    // Immutable storage so that it can also be bound as an image, recreate
+    // on resize
+    glDeleteTextures(1, &tex_color_);
+    glGenTextures(1, &tex_color_);
+    glBindTexture(GL_TEXTURE_2D, tex_color_);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo_);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, tex_color_, 0);
+
+    if (with_depth_) {
+        glBindRenderbuffer(GL_RENDERBUFFER, rb_depth_);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                  GL_RENDERBUFFER, rb_depth_);
+
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depth_fbo_);
+        glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                  GL_RENDERBUFFER, rb_depth_);
+        glDrawBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            LOG_FATAL("incomplete depth framebuffer");
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo_);
+    }
+
+    if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        LOG_FATAL("incomplete framebuffer");
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prev_fbo);
+}
+
+void Framebuffer::blit(int x, int y, int width, int height) const {
+    GLint prev_read_fbo;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &prev_read_fbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo_);
+    glBlitFramebuffer(0, 0, width_, height_, x, y, x + width, y + height,
+                      GL_COLOR_BUFFER_BIT,
+                      width == width_ && height == height_ ? GL_NEAREST : GL_LINEAR);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, prev_read_fbo);
+}
+
+OitTarget::OitTarget()
+    : fbo_(0)
+    , tex_accum_(0)
+    , tex_revealage_(0)
+    , width_(0)
+    , height_(0)
+    , memory_(memory::Subsystem::GpuFramebuffers) {
+    glGenFramebuffers(1, &fbo_);
+}
+
+OitTarget::~OitTarget() {
+    glDeleteFramebuffers(1, &fbo_);
+    glDeleteTextures(1, &tex_accum_);
+    glDeleteTextures(1, &tex_revealage_);
+}
+
+void OitTarget::resize(int width, int height) {
+    if (width == width_ && height == height_)
+        return;
+    width_ = width;
+    height_ = height;
+    memory_.resize(static_cast<size_t>(width) * height * (16 + 1));
+
+    GLint prev_fbo;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prev_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo_);
+    const std::pair<GLuint*, GLenum> attachments[] = {
+        {&tex_accum_, GL_RGBA32F},
+        {&tex_revealage_, GL_R8},
+    };
+    for (size_t i = 0; i < std::size(attachments); ++i) {
+        const auto [texture, format] = attachments[i];
+        glDeleteTextures(1, texture);
+        glGenTextures(1, texture);
+        glBindTexture(GL_TEXTURE_2D, *texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i,
+                               GL_TEXTURE_2D, *texture, 0);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    const GLenum draw_buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, draw_buffers);
+
+    if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        LOG_FATAL("incomplete OIT framebuffer");
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prev_fbo);
+}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "memory.h"
+
+#include <cstdint>
+
+namespace viewer::rendering {
+
+// Offscreen render target with an RGBA8 color texture and an optional depth
+// attachment
+class Framebuffer {
+public:
+    explicit Framebuffer(bool with_depth = false);
+    ~Framebuffer();
+    Framebuffer(const Framebuffer&) = delete;
+    Framebuffer& operator=(const Framebuffer&) = delete;
+
+    // Reallocates the attachments if the size changed, contents are undefined
+    // afterwards
+    void resize(int width, int height);
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    uint32_t fbo() const { return fbo_; }
+    // Shares the depth attachment but has no color attachment, so that the
+    // color texture can be sampled while writing depth
+    uint32_t depth_fbo() const { return depth_fbo_; }
+    uint32_t color_texture() const { return tex_color_; }
+
+    // Copies the color attachment to the currently bound draw framebuffer,
+    // scaling it to `width` x `height` pixels starting at `x`, `y`
+    void blit(int x, int y, int width, int height) const;
+
+private:
+    bool with_depth_;
+    uint32_t fbo_;
+    uint32_t depth_fbo_;
+    uint32_t tex_color_;
+    uint32_t rb_depth_;
+    int width_;
+    int height_;
+    memory::Allocation memory_;
+};
+
+// Accumulation targets of weighted blended order-independent transparency:
+// the weighted sum of premultiplied colors (RGBA32F, the weights go up to
+// 3000 per fragment) and the product of the transmittances (R8)
+class OitTarget {
+public:
+    OitTarget();
+    ~OitTarget();
+    OitTarget(const OitTarget&) = delete;
+    OitTarget& operator=(const OitTarget&) = delete;
+
+    // Reallocates the attachments if the size changed, contents are undefined
+    // afterwards
+    void resize(int width, int height);
+
+    uint32_t fbo() const { return fbo_; }
+    uint32_t accum_texture() const { return tex_accum_; }
+    uint32_t revealage_texture() const { return tex_revealage_; }
+
+private:
+    uint32_t fbo_;
+    uint32_t tex_accum_;
+    uint32_t tex_revealage_;
+    int width_;
+    int height_;
+    memory::Allocation memory_;
+};
+
+}
@@ -0,0 +1,45 @@
+#include "gpu_timer.h"
+
+#include <glad/glad.h>
+
+namespace viewer::rendering {
+
+GpuTimer::GpuTimer() {
+    glGenQueries(queries_.size(), queries_.data());
+}
+
+GpuTimer::~GpuTimer() {
+    glDeleteQueries(queries_.size(), queries_.data());
+}
+
+std::optional<uint64_t> GpuTimer::begin() {
+    if (running_ || num_begun_ - num_polled_ == NUM_QUERIES)
+        return std::nullopt;
+    glBeginQuery(GL_TIME_ELAPSED, queries_[num_begun_ % NUM_QUERIES]);
+    running_ = true;
+    return num_begun_;
+}
+
+void GpuTimer::end() {
+    if (!running_)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    running_ = false;
+    ++num_begun_;
+}
+
+std::optional<GpuTimer::Sample> GpuTimer::poll() {
+    if (num_polled_ == num_begun_)
+        return std::nullopt;
+    const GLuint query = queries_[num_polled_ % NUM_QUERIES];
+    GLint available = GL_FALSE;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available != GL_TRUE)
+        return std::nullopt;
+
+    GLuint64 ns;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+    return Sample{.id = num_polled_++, .ms = ns * 1e-6};
+}
+
+}
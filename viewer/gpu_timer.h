@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace viewer::rendering {
+
+// Measures GPU time with a ring of timer queries. Results are read a few
+// frames later, so measuring does not stall the pipeline.
+class GpuTimer {
+public:
+    static constexpr size_t NUM_QUERIES = 4;
+
+    struct Sample {
+        // As returned by `begin`
+        uint64_t id;
+        double ms;
+    };
+
+    GpuTimer();
+    ~GpuTimer();
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+
+    // Starts a measurement and returns its id, nothing if all queries are
+    // still in flight. Measurements must not be nested.
+    std::optional<uint64_t> begin();
+    void end();
+    // The oldest finished measurement, if any
+    std::optional<Sample> poll();
+
+private:
+    std::array<uint32_t, NUM_QUERIES> queries_;
+    uint64_t num_begun_ = 0;
+    uint64_t num_polled_ = 0;
+    bool running_ = false;
+};
+
+}
@@ -1,5 +1,6 @@
 #include "gui.h"
 #include "logging.h"
+#include "memory.h"
 #include <imgui/imgui.h>
 #include <cmath>
 #include <iostream>
@@ -82,6 +83,49 @@ void Gui::render() {
     ImGui::SeparatorText("Stats");
 
     ImGui::Text("%.1f FPS", ImGui::GetIO().Framerate);
+    if (ImGui::TreeNode("memory")) {
+        constexpr double MB = 1 << 20;
+        for (const bool gpu : {false, true}) {
+            const memory::Usage total = memory::total(gpu);
+            ImGui::Text("%s: %.1f MB, peak %.1f MB",
+                        gpu ? "GPU" : "host", total.current / MB, total.peak / MB);
+            for (size_t i = 0; i < memory::NUM_SUBSYSTEMS; ++i) {
+                const auto subsystem = static_cast<memory::Subsystem>(i);
+                if (memory::on_gpu(subsystem) != gpu) continue;
+                const memory::Usage usage = memory::usage(subsystem);
+                ImGui::BulletText("%s: %.1f MB, peak %.1f MB", memory::name(subsystem),
+                                  usage.current / MB, usage.peak / MB);
+            }
+        }
+        ImGui::TreePop();
+    }
+
+    scene_step = 0;
+    if (num_scenes > 1) {
+        ImGui::SeparatorText("Scene");
+        ImGui::TextUnformatted(scene_name.c_str());
+        if (ImGui::Button("previous") || ImGui::IsKeyPressed(ImGuiKey_PageUp))
+            scene_step = -1;
+        ImGui::SameLine();
+        if (ImGui::Button("next") || ImGui::IsKeyPressed(ImGuiKey_PageDown))
+            scene_step = 1;
+        ImGui::SameLine();
+        ImGui::Text("%zu / %zu%s", scene_index + 1, num_scenes,
+                    scene_loading ? ", loading..." : "");
+    }
+
+    sequence_seek = false;
+    if (sequence_frames > 0) {
+        ImGui::SeparatorText("Sequence");
+        ImGui::Checkbox("play", &sequence_playing);
+        ImGui::SameLine();
+        ImGui::Checkbox("loop", &sequence_loop);
+        int frame = static_cast<int>(sequence_frame);
+        sequence_seek = ImGui::SliderInt("frame", &frame, 0, static_cast<int>(sequence_frames) - 1);
+        sequence_frame = frame;
+        ImGui::SliderFloat("fps", &sequence_fps, 1.f, 120.f, "%.1f fps");
+        ImGui::Text("%zu of %zu frames decoded ahead", sequence_ahead, sequence_ring_size);
+    }
 
     ImGui::SeparatorText("Camera");
 
@@ -108,10 +152,92 @@ void Gui::render() {
         ImGui::DragFloat3("camera yaw/pitch/roll", cam_ypr.data(), 0.01f);
     }
 
+    ImGui::Checkbox("side by side stereo", &stereo);
+    ImGui::BeginDisabled(!stereo);
+    ImGui::DragFloat("eye separation", &eye_separation, 0.005f, 0.f);
+    ImGui::EndDisabled();
+
     ImGui::SeparatorText("Renderer");
     ImGui::Checkbox("enable vsync", &enable_vsync);
-    ImGui::Checkbox("use fast sorting algorithm", &renderer_config.use_fast_sort);
+    {
+        static const char* BACKENDS[] = {"quads", "tiles (compute)", "unsorted (weighted OIT)"};
+        int backend = static_cast<int>(renderer_config.backend);
+        ImGui::Combo("rasterizer", &backend, BACKENDS, IM_ARRAYSIZE(BACKENDS));
+        renderer_config.backend = static_cast<rendering::Backend>(backend);
+        ImGui::BeginDisabled(renderer_config.backend != rendering::Backend::Quads);
+        ImGui::Checkbox("skip saturated pixels", &renderer_config.early_termination);
+        ImGui::SliderInt("splats per batch", &renderer_config.early_termination_batch_size,
+                         1 << 14, 1 << 22, "%d", ImGuiSliderFlags_Logarithmic);
+        ImGui::Checkbox("occlusion culling", &renderer_config.occlusion_culling);
+        ImGui::Checkbox("16 bit chunk indices", &renderer_config.chunked_indices);
+        ImGui::EndDisabled();
+        if (renderer_config.occlusion_culling)
+            ImGui::Text("%zu splats occluded", frame_stats.num_occluded);
+        ImGui::Text("sort upload: %.2f MB, %s indices", frame_stats.index_bytes / 1e6,
+                    frame_stats.chunked_indices ? "16 bit" : "32 bit");
+        ImGui::Checkbox("unsorted preview until sorted", &renderer_config.unsorted_preview);
+        ImGui::Checkbox("show overdraw", &renderer_config.show_overdraw);
+        if (renderer_config.show_overdraw)
+            ImGui::Text("splats per pixel: %.1f mean, %u max (red: 1024+)",
+                        frame_stats.overdraw.mean, frame_stats.overdraw.max);
+    }
+    {
+        rendering::ResolutionScaling& resolution = renderer_config.resolution;
+        ImGui::Checkbox("dynamic resolution", &resolution.enabled);
+        ImGui::BeginDisabled(!resolution.enabled);
+        ImGui::SliderFloat("target GPU time (ms)", &resolution.target_ms, 2.f, 50.f);
+        ImGui::SliderFloat("min resolution scale", &resolution.min_scale, 0.1f, 1.f);
+        ImGui::SliderFloat("max resolution scale", &resolution.max_scale, 0.1f, 1.f);
+        ImGui::EndDisabled();
+        ImGui::Text("GPU %.1f ms at %.0f%% resolution",
+                    frame_stats.gpu_ms, 100.f * frame_stats.resolution_scale);
+    }
+    {
+        dataset::SortOptions& sort_options = renderer_config.sort_options;
+        ImGui::Checkbox("use fast sorting algorithm", &sort_options.fast_sort);
+        ImGui::BeginDisabled(!sort_options.fast_sort);
+        ImGui::SliderInt("sort key bits", &sort_options.key_bits, 8, 32);
+        static const char* BINNINGS[] = {"float", "linear", "reciprocal", "log", "equalized"};
+        int binning = static_cast<int>(sort_options.binning);
+        ImGui::Combo("depth binning", &binning, BINNINGS, IM_ARRAYSIZE(BINNINGS));
+        sort_options.binning = static_cast<dataset::DepthBinning>(binning);
+        ImGui::Checkbox("depth range of visible splats only", &sort_options.visible_range);
+        ImGui::EndDisabled();
+    }
     ImGui::SliderInt("spherical harmonics degree", &renderer_config.sh_degree, 0, 3);
+    ImGui::Checkbox("predict camera motion", &renderer_config.predict_camera_motion);
+    ImGui::SliderFloat("sort CPU budget", &renderer_config.sort_cpu_budget, 0.05f, 1.f);
+    {
+        rendering::ProgressiveQuality& progressive = renderer_config.progressive;
+        ImGui::Checkbox("reduce quality while moving", &progressive.enabled);
+        ImGui::BeginDisabled(!progressive.enabled);
+        ImGui::SliderInt("still frames to full quality", &progressive.still_frames, 1, 60);
+        ImGui::SliderInt("SH degree while moving", &progressive.sh_degree, 0, 3);
+        ImGui::SliderFloat("splats drawn while moving",
+                           &progressive.sort_options.fraction, 0.05f, 1.f);
+        ImGui::SliderInt("sort key bits while moving", &progressive.sort_options.key_bits, 8, 32);
+        ImGui::EndDisabled();
+        if (frame_stats.reduced_quality)
+            ImGui::Text("reduced quality");
+    }
+
+    ImGui::SeparatorText("Edit");
+    {
+        rendering::BoxEdit& edit = renderer_config.box_edit;
+        ImGui::DragFloat3("box min", edit.box.min.data(), 0.05f);
+        ImGui::DragFloat3("box max", edit.box.max.data(), 0.05f);
+        ImGui::Checkbox("preview", &edit.preview);
+        ImGui::SameLine();
+        ImGui::Checkbox("delete inside", &edit.inside);
+        delete_requested = ImGui::Button("delete");
+        ImGui::SameLine();
+        ImGui::Text("%zu splats deleted", frame_stats.num_deleted);
+        if (frame_stats.num_live_updates > 0)
+            ImGui::Text("%llu live updates",
+                        static_cast<unsigned long long>(frame_stats.num_live_updates));
+        ImGui::InputText("file", save_path.data(), save_path.size());
+        save_requested = ImGui::Button("save");
+    }
 }
 
 }
@@ -5,6 +5,9 @@
 #include <Eigen/Dense>
 #include <GLFW/glfw3.h>
 
+#include <array>
+#include <string>
+
 namespace viewer::gui {
 
 class Gui {
@@ -19,10 +22,36 @@ public:
     float fov_deg = 60.f;
     float rx, ry, rz;
     float px, py, pz;
+    // Left and right eye side by side, sharing one sort
+    bool stereo = false;
+    float eye_separation = 0.065f;
 
     // Rendering controls
     bool enable_vsync;
     rendering::RendererConfig renderer_config;
+    rendering::FrameStats frame_stats;
+
+    // Editing, `renderer_config.box_edit` is applied once requested
+    bool delete_requested = false;
+    bool save_requested = false;
+    std::array<char, 256> save_path = {"edited.ply"};
+
+    // Playlist, `scene_step` scenes forward or backward are requested
+    size_t num_scenes = 1;
+    size_t scene_index = 0;
+    std::string scene_name;
+    bool scene_loading = false;
+    int scene_step = 0;
+
+    // Sequence playback, `sequence_frame` is requested if `sequence_seek`
+    size_t sequence_frames = 0;
+    size_t sequence_frame = 0;
+    bool sequence_playing = true;
+    bool sequence_loop = true;
+    bool sequence_seek = false;
+    float sequence_fps = 30.f;
+    size_t sequence_ahead = 0;
+    size_t sequence_ring_size = 0;
 
     Eigen::Matrix4f mat_view = Eigen::Matrix4f::Identity();
     Eigen::Vector3f cam_ypr = Eigen::Vector3f::Zero();
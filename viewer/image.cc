@@ -0,0 +1,99 @@
+#include "image.h"
+
+#include <algorithm>
+#include <array>
+
+namespace viewer::image {
+
+namespace {
+
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+    static const std::array<uint32_t, 256> TABLE = [] {
+        std::array<uint32_t, 256> table;
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return table;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = TABLE[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+void put_u32_be(std::string* out, uint32_t v) {
+    out->push_back(static_cast<char>(v >> 24));
+    out->push_back(static_cast<char>(v >> 16));
+    out->push_back(static_cast<char>(v >> 8));
+    out->push_back(static_cast<char>(v));
+}
+
+void put_chunk(std::string* out, const char type[4], const std::string& data) {
+    put_u32_be(out, data.size());
+    const size_t start = out->size();
+    out->append(type, 4);
+    out->append(data);
+    put_u32_be(out, crc32(reinterpret_cast<const uint8_t*>(out->data()) + start,
+                          out->size() - start));
+}
+
+}
+
+std::string encode_ppm(const Image& image) {
+    std::string out = "P6\n" + std::to_string(image.width) + " "
+        + std::to_string(image.height) + "\n255\n";
+    out.append(reinterpret_cast<const char*>(image.rgb.data()), image.rgb.size());
+    return out;
+}
+
+std::string encode_png(const Image& image) {
+    std::string out = "\x89PNG\r\n\x1a\n";
+
+    std::string header;
+    put_u32_be(&header, image.width);
+    put_u32_be(&header, image.height);
+    // 8 bit RGB, deflate, no filtering, no interlacing
+    header += std::string("\x08\x02\x00\x00\x00", 5);
+    put_chunk(&out, "IHDR", header);
+
+    // Scanlines prefixed with filter type 0
+    const size_t row_size = 3 * static_cast<size_t>(image.width);
+    std::string raw;
+    raw.reserve((row_size + 1) * image.height);
+    for (int y = 0; y < image.height; ++y) {
+        raw.push_back(0);
+        raw.append(reinterpret_cast<const char*>(image.rgb.data()) + y * row_size, row_size);
+    }
+
+    // zlib stream of stored blocks of at most 65535 bytes, Adler-32 trailer
+    constexpr size_t MAX_BLOCK = 65535;
+    std::string zlib = "\x78\x01";
+    size_t pos = 0;
+    do {
+        const size_t n = std::min(MAX_BLOCK, raw.size() - pos);
+        const bool last = pos + n == raw.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(static_cast<char>(n & 0xff));
+        zlib.push_back(static_cast<char>(n >> 8));
+        zlib.push_back(static_cast<char>(~n & 0xff));
+        zlib.push_back(static_cast<char>((~n >> 8) & 0xff));
+        zlib.append(raw, pos, n);
+        pos += n;
+    } while (pos < raw.size());
+
+    uint32_t a = 1, b = 0;
+    for (const char c : raw) {
+        a = (a + static_cast<uint8_t>(c)) % 65521;
+        b = (b + a) % 65521;
+    }
+    put_u32_be(&zlib, (b << 16) | a);
+    put_chunk(&out, "IDAT", zlib);
+    put_chunk(&out, "IEND", "");
+    return out;
+}
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Encoding of 8 bit RGB images, top row first, without external codecs
+
+namespace viewer::image {
+
+struct Image {
+    int width = 0;
+    int height = 0;
+    // `width * height` RGB triplets
+    std::vector<uint8_t> rgb;
+};
+
+// Binary PPM (P6)
+std::string encode_ppm(const Image& image);
+// PNG with uncompressed (stored) deflate blocks: as large as a PPM, but
+// readable by browsers
+std::string encode_png(const Image& image);
+
+}
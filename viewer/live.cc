@@ -0,0 +1,158 @@
+#include "live.h"
+#include "logging.h"
+#include "net.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <utility>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace viewer::live {
+
+namespace {
+
+// A header is a few dozen bytes, longer lines close the connection
+constexpr size_t MAX_LINE_LENGTH = 4096;
+
+// Reads `num_bytes` into `destination`, the first of them from what is left
+// in `buffer`. False if the connection closed.
+bool receive(int fd, std::string* buffer, char* destination, size_t num_bytes) {
+    const size_t buffered = std::min(buffer->size(), num_bytes);
+    std::copy_n(buffer->data(), buffered, destination);
+    buffer->erase(0, buffered);
+    for (size_t received = buffered; received < num_bytes;) {
+        const ssize_t n = recv(fd, destination + received, num_bytes - received, 0);
+        if (n <= 0) return false;
+        received += n;
+    }
+    return true;
+}
+
+}
+
+Server::Server(const std::string& socket_path, int port, size_t num_splats)
+    : listen_fd_(net::listen_on(socket_path, port))
+    , num_splats_(num_splats) {
+    if (port > 0)
+        LOG_INFO("live updates on localhost:%d", port);
+    else
+        LOG_INFO("live updates on %s", socket_path.c_str());
+
+    acceptor_ = std::jthread([this](std::stop_token stop) {
+        while (!stop.stop_requested()) {
+            const int fd = accept(listen_fd_, nullptr, nullptr);
+            if (fd < 0) {
+                if (!stop.stop_requested())
+                    LOG_ERROR("accept: %s", strerror(errno));
+                continue;
+            }
+            std::lock_guard lg(mutex_);
+            // Their threads only return once `done` is set
+            connections_.remove_if([](const Connection& c) { return c.done; });
+            Connection& connection = connections_.emplace_back(fd);
+            connection.thread = std::jthread(&Server::serve, this, &connection);
+        }
+    });
+}
+
+Server::~Server() {
+    // Wakes the threads blocked in `accept` and `recv`
+    acceptor_.request_stop();
+    shutdown(listen_fd_, SHUT_RDWR);
+    acceptor_.join();
+    {
+        std::lock_guard lg(mutex_);
+        for (const Connection& connection : connections_) {
+            if (!connection.done)
+                shutdown(connection.fd, SHUT_RDWR);
+        }
+    }
+    connections_.clear();
+    close(listen_fd_);
+}
+
+std::vector<Update> Server::poll() {
+    std::lock_guard lg(mutex_);
+    return std::exchange(updates_, {});
+}
+
+void Server::serve(Connection* connection) {
+    const int fd = connection->fd;
+    std::string buffer;
+    std::vector<float> params;
+    while (true) {
+        size_t newline;
+        char chunk[4096];
+        bool connected = true;
+        while (connected && (newline = buffer.find('\n')) == std::string::npos) {
+            const ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            connected = n > 0;
+            if (connected)
+                buffer.append(chunk, n);
+            if (buffer.size() > MAX_LINE_LENGTH && buffer.find('\n') == std::string::npos) {
+                net::send_all(fd, "error line too long\n");
+                connected = false;
+            }
+        }
+        if (!connected) break;
+        std::istringstream in(buffer.substr(0, newline));
+        buffer.erase(0, newline + 1);
+
+        std::string command;
+        size_t first = 0;
+        size_t count = 0;
+        in >> command >> first >> count;
+        Update update;
+        update.first = first;
+        std::string error;
+        if (command == "splats") {
+            int sh_degree = -1;
+            in >> sh_degree;
+            if (in.fail() || sh_degree < 0 || sh_degree > 3)
+                error = "expected: splats <first> <count> <sh_degree 0-3>";
+            else if (count > MAX_UPDATE_SPLATS)
+                error = "too many splats";
+            // The payload cannot be skipped
+            if (!error.empty()) {
+                net::send_all(fd, "error " + error + "\n");
+                break;
+            }
+            const size_t num_params = dataset::num_splat_params(sh_degree);
+            params.resize(count * num_params);
+            if (!receive(fd, &buffer, reinterpret_cast<char*>(params.data()),
+                         params.size() * sizeof(float)))
+                break;
+            update.splats.reserve(count);
+            for (size_t i = 0; i < count; ++i)
+                update.splats.push_back(dataset::decode_splat(&params[i * num_params], sh_degree));
+        } else if (command == "delete") {
+            if (in.fail())
+                error = "expected: delete <first> <count>";
+            update.num_deleted = count;
+        } else {
+            error = "unknown command";
+        }
+
+        if (error.empty()) {
+            std::lock_guard lg(mutex_);
+            if (first > num_splats_) {
+                error = "first splat past the end of the scene";
+            } else {
+                num_splats_ = std::max(num_splats_, first + update.splats.size());
+                updates_.push_back(std::move(update));
+            }
+        }
+        if (!net::send_all(fd, error.empty() ? "ok\n" : "error " + error + "\n"))
+            break;
+    }
+
+    std::lock_guard lg(mutex_);
+    close(fd);
+    connection->done = true;
+}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "dataset.h"
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Live updates of the displayed scene from another process, e.g. a training
+// run pushing the splats it changed every few iterations, over a Unix domain
+// socket or localhost TCP.
+//
+// Protocol, each message a line, the splats followed by a binary payload:
+//
+//   splats <first> <count> <sh_degree>
+//     <count * dataset::num_splat_params(sh_degree) floats, native byte order>
+//   delete <first> <count>
+//
+// `splats` overwrites the splats from `first` on (see `dataset::decode_splat`
+// for the parameters), appending those past the end of the scene, and
+// `delete` hides splats until they are overwritten again. Each message is
+// answered by `ok\n` once it is queued, or by `error <message>\n`. Indices are
+// those of the sender, scenes receiving updates are not compacted.
+
+namespace viewer::live {
+
+// Most splats in one message
+constexpr size_t MAX_UPDATE_SPLATS = 1 << 22;
+
+struct Update {
+    size_t first = 0;
+    // Overwrite these from `first` on, or if empty, delete `num_deleted`
+    dataset::SplatBuffer splats;
+    size_t num_deleted = 0;
+};
+
+class Server {
+public:
+    // Listens on `socket_path`, or on localhost `port` if nonzero, for
+    // updates of a scene of `num_splats`
+    Server(const std::string& socket_path, int port, size_t num_splats);
+    ~Server();
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // The updates received since the last call, in order
+    std::vector<Update> poll();
+
+private:
+    struct Connection {
+        explicit Connection(int fd_) : fd(fd_) {}
+        int fd;
+        // Set by `serve` once `fd` is closed
+        bool done = false;
+        std::jthread thread;
+    };
+
+    void serve(Connection* connection);
+
+    int listen_fd_;
+    std::mutex mutex_;
+    std::vector<Update> updates_;
+    // Including the splats appended by queued updates
+    size_t num_splats_;
+    // Those done are joined when the next one is accepted
+    std::list<Connection> connections_;
+    std::jthread acceptor_;
+};
+
+}
@@ -0,0 +1,143 @@
+#include "memory.h"
+#include "tracing.h"
+
+#include <array>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace viewer::memory {
+
+namespace {
+
+void record_counters(bool gpu);
+
+struct State {
+    State() {
+        tracing::Tracing::get().on_begin([] {
+            record_counters(false);
+            record_counters(true);
+        });
+    }
+
+    std::mutex mutex;
+    std::array<Usage, NUM_SUBSYSTEMS> subsystems;
+    // Host, GPU
+    std::array<Usage, 2> totals;
+};
+
+State& state() {
+    static State instance;
+    return instance;
+}
+
+void grow(Usage* usage, size_t added, size_t removed) {
+    usage->current = usage->current + added - removed;
+    usage->peak = std::max(usage->peak, usage->current);
+}
+
+// One counter track per domain, stacked by subsystem. Called with the state
+// locked.
+std::vector<std::pair<std::string, int64_t>> counter_values(const State& st,
+                                                            bool gpu) {
+    std::vector<std::pair<std::string, int64_t>> values;
+    for (size_t i = 0; i < NUM_SUBSYSTEMS; ++i) {
+        const Subsystem s = static_cast<Subsystem>(i);
+        if (on_gpu(s) == gpu) values.emplace_back(name(s), st.subsystems[i].current);
+    }
+    return values;
+}
+
+void record(bool gpu, std::vector<std::pair<std::string, int64_t>> values) {
+    tracing::Tracing::get().record_counter(gpu ? "GPU memory" : "host memory",
+                                           std::move(values));
+}
+
+// Records the usage at the start of a trace, which later only records changes
+void record_counters(bool gpu) {
+    State& st = state();
+    std::vector<std::pair<std::string, int64_t>> values;
+    {
+        std::lock_guard lg(st.mutex);
+        values = counter_values(st, gpu);
+    }
+    record(gpu, std::move(values));
+}
+
+void update(Subsystem s, size_t added, size_t removed) {
+    if (added == removed) return;
+    State& st = state();
+    const bool gpu = on_gpu(s);
+    std::vector<std::pair<std::string, int64_t>> values;
+    {
+        std::lock_guard lg(st.mutex);
+        grow(&st.subsystems[static_cast<size_t>(s)], added, removed);
+        grow(&st.totals[gpu], added, removed);
+        values = counter_values(st, gpu);
+    }
+    record(gpu, std::move(values));
+}
+
+}
+
+const char* name(Subsystem s) {
+    switch (s) {
+    case Subsystem::PlyFile: return "PLY file (mapped)";
+    case Subsystem::Splats: return "splats";
+    case Subsystem::Centers: return "centers";
+    case Subsystem::EditState: return "edit state";
+    case Subsystem::SortResults: return "sort results";
+    case Subsystem::SequenceState: return "sequence state";
+    case Subsystem::GpuSplats: return "splats";
+    case Subsystem::GpuSortIndices: return "sort indices";
+    case Subsystem::GpuTileRenderer: return "tile renderer";
+    case Subsystem::GpuFramebuffers: return "framebuffers";
+    case Subsystem::GpuPrefetchedScenes: return "prefetched scenes";
+    case Subsystem::GpuSequenceFrames: return "sequence frames";
+    case Subsystem::Count: break;
+    }
+    return "unknown";
+}
+
+bool on_gpu(Subsystem s) {
+    return s >= Subsystem::GpuSplats;
+}
+
+Usage usage(Subsystem s) {
+    State& st = state();
+    std::lock_guard lg(st.mutex);
+    return st.subsystems.at(static_cast<size_t>(s));
+}
+
+Usage total(bool gpu) {
+    State& st = state();
+    std::lock_guard lg(st.mutex);
+    return st.totals[gpu];
+}
+
+Allocation::Allocation(Subsystem subsystem, size_t bytes)
+    : subsystem_(subsystem), bytes_(0) {
+    resize(bytes);
+}
+
+Allocation::~Allocation() {
+    resize(0);
+}
+
+Allocation::Allocation(Allocation&& other)
+    : subsystem_(other.subsystem_), bytes_(std::exchange(other.bytes_, 0)) {}
+
+Allocation& Allocation::operator=(Allocation&& other) {
+    if (this == &other) return *this;
+    resize(0);
+    subsystem_ = other.subsystem_;
+    bytes_ = std::exchange(other.bytes_, 0);
+    return *this;
+}
+
+void Allocation::resize(size_t bytes) {
+    update(subsystem_, bytes, bytes_);
+    bytes_ = bytes;
+}
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+
+// Accounting of the host and GPU memory held by each subsystem, for capacity
+// planning. Owners of large buffers keep an `Allocation` sized like them. The
+// totals are shown in the GUI and recorded as counter tracks while tracing.
+
+namespace viewer::memory {
+
+enum class Subsystem {
+    // Host
+    PlyFile,      // Memory-mapped input file, not necessarily resident
+    Splats,       // Host copy of the splats
+    Centers,      // Splat centers and radii for the sort
+    EditState,    // Deleted mask and source rows
+    SortResults,  // Depth indices and sort scratch space
+    SequenceState,  // Parameters of the decoded frame, see `sequence.h`
+    // GPU
+    GpuSplats,
+    GpuSortIndices,
+    GpuTileRenderer,
+    GpuFramebuffers,  // Including the overdraw counters
+    GpuPrefetchedScenes,  // Splats of scenes loaded ahead, see `playlist.h`
+    GpuSequenceFrames,  // Splats of frames decoded ahead, see `sequence.h`
+    Count,
+};
+
+constexpr size_t NUM_SUBSYSTEMS = static_cast<size_t>(Subsystem::Count);
+
+const char* name(Subsystem s);
+bool on_gpu(Subsystem s);
+
+struct Usage {
+    size_t current = 0;
+    size_t peak = 0;
+};
+
+Usage usage(Subsystem s);
+// Over all host or all GPU subsystems, the peak is that of the sum
+Usage total(bool gpu);
+
+// Bytes held by one owner, released on destruction
+class Allocation {
+public:
+    explicit Allocation(Subsystem subsystem, size_t bytes = 0);
+    ~Allocation();
+    Allocation(Allocation&& other);
+    Allocation& operator=(Allocation&& other);
+    Allocation(const Allocation&) = delete;
+    Allocation& operator=(const Allocation&) = delete;
+
+    void resize(size_t bytes);
+    size_t bytes() const { return bytes_; }
+
+private:
+    Subsystem subsystem_;
+    size_t bytes_;
+};
+
+}
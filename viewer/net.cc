@@ -0,0 +1,52 @@
+#include "net.h"
+#include "logging.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace viewer::net {
+
+int listen_on(const std::string& socket_path, int port) {
+    const int fd = socket(port > 0 ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        LOG_FATAL("socket: %s", strerror(errno));
+
+    int result;
+    if (port > 0) {
+        const int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        result = bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    } else {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(addr.sun_path))
+            LOG_FATAL("socket path too long: %s", socket_path.c_str());
+        socket_path.copy(addr.sun_path, socket_path.size());
+        unlink(socket_path.c_str());
+        result = bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    }
+    if (result < 0 || listen(fd, SOMAXCONN) < 0)
+        LOG_FATAL("bind/listen: %s", strerror(errno));
+    return fd;
+}
+
+bool send_all(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        const ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+// Stream sockets for the local services of the viewer
+
+namespace viewer::net {
+
+// Listening socket on `socket_path` (a Unix domain socket, replacing a
+// stale file), or on localhost `port` if nonzero
+int listen_on(const std::string& socket_path, int port);
+
+// False if the connection closed before all of `data` was sent
+bool send_all(int fd, const std::string& data);
+
+}
@@ -0,0 +1,264 @@
+#include "occlusion.h"
+#include "camera.h"
+#include "logging.h"
+#include "program.h"
+#include "tracing.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace viewer::occlusion {
+
+namespace {
+
+static const char* COMMON_SHADER_SOURCE =
+#include "shaders/common.glsl"
+;
+static const char* REDUCE_SHADER_SOURCE =
+#include "shaders/occlusion_reduce.cs"
+;
+
+// Of `shaders/occlusion_reduce.cs`
+constexpr int WORK_GROUP_SIZE = 8;
+// Per pixel, see `shaders/common.glsl`
+constexpr size_t PIXEL_BYTES = 4 * sizeof(uint32_t);
+// Per cell, the opaque and the nearest depth
+constexpr size_t CELL_BYTES = 2 * sizeof(float);
+// Widenings of the cells tested until they cover the shift of the nearest
+// splats in them
+constexpr int MAX_WIDENINGS = 3;
+// Covers the constant footprint the shaders add to every splat
+constexpr float PIXEL_MARGIN = 2.f;
+
+}
+
+OcclusionBuffer::OcclusionBuffer(const Eigen::Matrix4f& view,
+                                 const Eigen::Matrix4f& projection,
+                                 int width, int height, int cols, int rows,
+                                 std::vector<float> cells, std::vector<float> nearest,
+                                 uint64_t layout, uint64_t generation)
+    : view_(view)
+    , view_projection_(projection * view)
+    , width_(width)
+    , height_(height)
+    , focal_(0.5f * std::max(std::abs(projection(0, 0)) * width,
+                             std::abs(projection(1, 1)) * height))
+    , layout_(layout)
+    , generation_(generation) {
+    if (cells.size() != static_cast<size_t>(cols) * rows || nearest.size() != cells.size())
+        LOG_FATAL("%zu occlusion cells for %dx%d", cells.size(), cols, rows);
+    levels_.push_back({.cols = cols, .rows = rows,
+                       .cells = std::move(cells), .nearest = std::move(nearest)});
+    while (levels_.back().cols > 1 || levels_.back().rows > 1) {
+        const Level& fine = levels_.back();
+        Level coarse = {
+            .cols = (fine.cols + 1) / 2,
+            .rows = (fine.rows + 1) / 2,
+            .cells = {},
+            .nearest = {},
+        };
+        const size_t num_cells = static_cast<size_t>(coarse.cols) * coarse.rows;
+        coarse.cells.assign(num_cells, 0.f);
+        coarse.nearest.assign(num_cells, std::numeric_limits<float>::infinity());
+        for (int y = 0; y < fine.rows; ++y) {
+            for (int x = 0; x < fine.cols; ++x) {
+                const size_t c = (y / 2) * coarse.cols + x / 2;
+                coarse.cells[c] = std::max(coarse.cells[c], fine.cells[y * fine.cols + x]);
+                coarse.nearest[c] = std::min(coarse.nearest[c], fine.nearest[y * fine.cols + x]);
+            }
+        }
+        levels_.push_back(std::move(coarse));
+    }
+}
+
+bool OcclusionBuffer::occluded(const Eigen::Vector3f& center, float radius, float moved,
+                               float depth_scale) const {
+    const Eigen::Vector4f p = view_projection_ * center.homogeneous();
+    const float depth = p.w();
+    const float nearest = depth - radius - moved;
+    if (nearest <= camera::Z_NEAR)
+        return false;
+
+    // Bounds of the sphere's silhouette in pixels, from the bottom left like
+    // the cells
+    const float x = (0.5f * p.x() / depth + 0.5f) * width_;
+    const float y = (0.5f * p.y() / depth + 0.5f) * height_;
+    const float r_sphere = focal_ * (radius + moved) / nearest + PIXEL_MARGIN;
+    const float sorted_depth = depth * depth_scale;
+    // Splats at a depth of at least `occluder_depth` shift by at most
+    // `focal_ * moved / (occluder_depth - moved)`. Starts from those just in
+    // front of the sphere, and widens the bounds by the shift of the nearest
+    // splats in them until it covers it.
+    float occluder_depth = depth;
+    for (int widening = 0; widening < MAX_WIDENINGS; ++widening) {
+        if (occluder_depth - moved <= camera::Z_NEAR)
+            return false;
+        const float r = r_sphere + focal_ * moved / (occluder_depth - moved);
+        if (!(x - r >= 0.f && y - r >= 0.f && x + r <= width_ && y + r <= height_))
+            return false;
+
+        int x0 = static_cast<int>(x - r) / CELL_SIZE;
+        int y0 = static_cast<int>(y - r) / CELL_SIZE;
+        int x1 = static_cast<int>(x + r) / CELL_SIZE;
+        int y1 = static_cast<int>(y + r) / CELL_SIZE;
+        // The first level at which the bounds cover at most 2x2 cells
+        size_t l = 0;
+        while (l + 1 < levels_.size() && (x1 - x0 > 1 || y1 - y0 > 1)) {
+            x0 /= 2;
+            y0 /= 2;
+            x1 /= 2;
+            y1 /= 2;
+            ++l;
+        }
+        const Level& level = levels_[l];
+        x1 = std::min(x1, level.cols - 1);
+        y1 = std::min(y1, level.rows - 1);
+        float nearest_drawn = std::numeric_limits<float>::infinity();
+        for (int cy = y0; cy <= y1; ++cy) {
+            for (int cx = x0; cx <= x1; ++cx) {
+                if (!(sorted_depth > level.cells[cy * level.cols + cx]))
+                    return false;
+                nearest_drawn = std::min(nearest_drawn, level.nearest[cy * level.cols + cx]);
+            }
+        }
+        if (moved == 0.f || nearest_drawn >= occluder_depth)
+            return true;
+        occluder_depth = nearest_drawn;
+    }
+    return false;
+}
+
+size_t cull(const OcclusionBuffer& buffer, const Eigen::Matrix4f& view,
+            const dataset::Centers& centers, const dataset::Radii& radii,
+            std::vector<uint8_t>* culled) {
+    tracing::RecorderGuard tracing_guard("occlusion culling");
+    culled->assign(centers.size(), 0);
+
+    const Eigen::Matrix3f R0 = buffer.view().block<3, 3>(0, 0);
+    const Eigen::Matrix3f R1 = view.block<3, 3>(0, 0);
+    const float angle = Eigen::AngleAxisf(Eigen::Matrix3f(R1 * R0.transpose())).angle();
+    if (!(angle <= MAX_ANGLE_DEG * M_PI / 180.f))
+        return 0;
+    // Camera positions
+    const Eigen::Vector3f c0 = -R0.transpose() * buffer.view().block<3, 1>(0, 3);
+    const Eigen::Vector3f c1 = -R1.transpose() * view.block<3, 1>(0, 3);
+    const float moved = (c1 - c0).norm();
+    // The depth order ignores translation. Under a rotation by `angle`, the
+    // depths of two splats at most 2 * 1.5 times the depth apart (within
+    // the field of view) change relative to each other by less than this.
+    const float depth_scale = 1.f - 3.f * angle;
+
+    size_t num_culled = 0;
+    for (size_t i = 0; i < centers.size(); ++i) {
+        const bool occluded = buffer.occluded(centers[i], radii[i], moved, depth_scale);
+        (*culled)[i] = occluded;
+        num_culled += occluded;
+    }
+    return num_culled;
+}
+
+OcclusionRecorder::OcclusionRecorder()
+    : program_reduce_(rendering::create_program({
+          {.type = GL_COMPUTE_SHADER,
+           .sources = {COMMON_SHADER_SOURCE, REDUCE_SHADER_SOURCE}},
+      })) {
+    glGenBuffers(1, &buf_pixels_);
+    for (Readback& r : readbacks_)
+        glGenBuffers(1, &r.buf_cells);
+}
+
+OcclusionRecorder::~OcclusionRecorder() {
+    for (Readback& r : readbacks_) {
+        if (r.fence)
+            glDeleteSync(static_cast<GLsync>(r.fence));
+        glDeleteBuffers(1, &r.buf_cells);
+    }
+    glDeleteBuffers(1, &buf_pixels_);
+    glDeleteProgram(program_reduce_);
+}
+
+bool OcclusionRecorder::begin(int width, int height) {
+    if (num_begun_ - num_polled_ == NUM_READBACKS || width <= 0 || height <= 0)
+        return false;
+    const size_t num_bytes = static_cast<size_t>(width) * height * PIXEL_BYTES;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buf_pixels_);
+    if (width != width_ || height != height_) {
+        glBufferData(GL_SHADER_STORAGE_BUFFER, num_bytes, nullptr, GL_DYNAMIC_COPY);
+        width_ = width;
+        height_ = height;
+    }
+    const GLuint zero = 0;
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+                      GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, buf_pixels_);
+    return true;
+}
+
+void OcclusionRecorder::end(const Eigen::Matrix4f& view,
+                            const Eigen::Matrix4f& projection, uint64_t layout,
+                            uint64_t generation) {
+    tracing::RecorderGuard tracing_guard("occlusion reduce");
+    Readback& r = readbacks_[num_begun_ % NUM_READBACKS];
+    r.view = view;
+    r.projection = projection;
+    r.width = width_;
+    r.height = height_;
+    r.cols = (width_ + CELL_SIZE - 1) / CELL_SIZE;
+    r.rows = (height_ + CELL_SIZE - 1) / CELL_SIZE;
+    r.layout = layout;
+    r.generation = generation;
+    const size_t num_cells = static_cast<size_t>(r.cols) * r.rows;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, r.buf_cells);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, num_cells * CELL_BYTES, nullptr, GL_STREAM_READ);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glUseProgram(program_reduce_);
+    glUniform2i(glGetUniformLocation(program_reduce_, "size"), r.width, r.height);
+    glUniform2i(glGetUniformLocation(program_reduce_, "num_cells"), r.cols, r.rows);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, r.buf_cells);
+    glDispatchCompute((r.cols + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE,
+                      (r.rows + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE, 1);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, 0);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ++num_begun_;
+
+    size_t num_bytes = static_cast<size_t>(width_) * height_ * PIXEL_BYTES;
+    for (const Readback& readback : readbacks_)
+        num_bytes += static_cast<size_t>(readback.cols) * readback.rows * CELL_BYTES;
+    memory_.resize(num_bytes);
+}
+
+std::optional<OcclusionBuffer> OcclusionRecorder::poll() {
+    if (num_polled_ == num_begun_)
+        return std::nullopt;
+    Readback& r = readbacks_[num_polled_ % NUM_READBACKS];
+    const GLenum status = glClientWaitSync(static_cast<GLsync>(r.fence), 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return std::nullopt;
+    glDeleteSync(static_cast<GLsync>(r.fence));
+    r.fence = nullptr;
+    ++num_polled_;
+
+    const size_t num_cells = static_cast<size_t>(r.cols) * r.rows;
+    std::vector<Eigen::Vector2f> interleaved(num_cells);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, r.buf_cells);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, num_cells * CELL_BYTES, interleaved.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    std::vector<float> cells(num_cells);
+    std::vector<float> nearest(num_cells);
+    for (size_t i = 0; i < num_cells; ++i) {
+        cells[i] = interleaved[i].x();
+        nearest[i] = interleaved[i].y();
+    }
+    return OcclusionBuffer(r.view, r.projection, r.width, r.height, r.cols, r.rows,
+                           std::move(cells), std::move(nearest), r.layout, r.generation);
+}
+
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "dataset.h"
+#include "memory.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+#include <Eigen/Dense>
+
+// Occlusion culling from the previous frame. While drawing, the quad renderer
+// records per pixel the largest depth of the splats it blended until the pixel
+// became opaque. Splats sorted after those change it by less than an 8 bit
+// step. Reduced to cells and read back, the next sort leaves out the splats
+// behind that depth in every cell they cover.
+//
+// When the camera moved since the recording, nearer splats shift further on
+// screen than those behind them, uncovering them at the edges. The cells also
+// hold the nearest depth drawn, and the cells tested are widened by the shift
+// of the nearest splats in them. Splats culled by mistake anyway, e.g. seen
+// through gaps opening between occluders at different depths, do not make any
+// pixel opaque. So the next recording does not cover them, and the sort after
+// it brings them back.
+
+namespace viewer::occlusion {
+
+// Pixels per cell side
+constexpr int CELL_SIZE = 16;
+// Views turned further than this from the recorded one are not culled
+constexpr float MAX_ANGLE_DEG = 5.f;
+
+// Opaque depths of one recorded view, with coarser levels of the maximum
+// (and of the minimum of the nearest depths) over 2x2 cells up to a single one
+class OcclusionBuffer {
+public:
+    // `cells` holds, row by row from the bottom left of the view, the largest
+    // camera-space depth at which the pixels of each cell became opaque,
+    // infinity if any of them did not, and `nearest` the smallest depth of
+    // the splats drawn in each cell. `layout` and `generation` are passed
+    // through.
+    OcclusionBuffer(const Eigen::Matrix4f& view, const Eigen::Matrix4f& projection,
+                    int width, int height, int cols, int rows,
+                    std::vector<float> cells, std::vector<float> nearest,
+                    uint64_t layout, uint64_t generation);
+
+    const Eigen::Matrix4f& view() const { return view_; }
+    uint64_t layout() const { return layout_; }
+    uint64_t generation() const { return generation_; }
+    // Whether a sphere is drawn after the opaque depth in all cells it
+    // covers, seen from `view()` moved by up to `moved`. The sphere is grown
+    // by `moved`, and the cells by the shift of the nearest splats in them.
+    // Its depth is scaled by `depth_scale` first. Spheres reaching outside of
+    // the view or close to the camera are not.
+    bool occluded(const Eigen::Vector3f& center, float radius, float moved,
+                  float depth_scale) const;
+
+private:
+    struct Level {
+        int cols;
+        int rows;
+        std::vector<float> cells;
+        std::vector<float> nearest;
+    };
+
+    Eigen::Matrix4f view_;
+    Eigen::Matrix4f view_projection_;
+    int width_;
+    int height_;
+    // Pixels per unit of camera-space extent at unit depth, the larger axis
+    float focal_;
+    std::vector<Level> levels_;
+    uint64_t layout_;
+    uint64_t generation_;
+};
+
+// Sets `culled` to nonzero for the splats that `buffer` occludes for a sort
+// from `view` and returns their number. The camera motion since the recording
+// is accounted for by the screen shifts of `OcclusionBuffer::occluded`, and by
+// a depth margin for the change of the depth order, see `MAX_ANGLE_DEG`.
+size_t cull(const OcclusionBuffer& buffer, const Eigen::Matrix4f& view,
+            const dataset::Centers& centers, const dataset::Radii& radii,
+            std::vector<uint8_t>* culled);
+
+// Records the opaque depths of the views drawn with it on the GPU, and reads
+// them back a few frames later, so recording does not stall the pipeline.
+// Needs a current GL context.
+class OcclusionRecorder {
+public:
+    static constexpr size_t NUM_READBACKS = 2;
+
+    OcclusionRecorder();
+    ~OcclusionRecorder();
+    OcclusionRecorder(const OcclusionRecorder&) = delete;
+    OcclusionRecorder& operator=(const OcclusionRecorder&) = delete;
+
+    // Clears the per-pixel buffer of a `width` x `height` view and binds it
+    // at binding 9 for the quad program, see `shaders/common.glsl`. False if
+    // all readbacks are still in flight, then nothing is recorded.
+    bool begin(int width, int height);
+    // Reduces the view drawn since `begin` to cells and starts reading them
+    // back, see `OcclusionBuffer` for `layout` and `generation`
+    void end(const Eigen::Matrix4f& view, const Eigen::Matrix4f& projection,
+             uint64_t layout, uint64_t generation);
+    // The oldest finished recording, if any
+    std::optional<OcclusionBuffer> poll();
+
+private:
+    struct Readback {
+        uint32_t buf_cells = 0;
+        // GLsync of the reduction
+        void* fence = nullptr;
+        Eigen::Matrix4f view = Eigen::Matrix4f::Identity();
+        Eigen::Matrix4f projection = Eigen::Matrix4f::Identity();
+        int width = 0;
+        int height = 0;
+        int cols = 0;
+        int rows = 0;
+        uint64_t layout = 0;
+        uint64_t generation = 0;
+    };
+
+    uint32_t program_reduce_;
+    uint32_t buf_pixels_;
+    std::array<Readback, NUM_READBACKS> readbacks_;
+    uint64_t num_begun_ = 0;
+    uint64_t num_polled_ = 0;
+    int width_ = 0;
+    int height_ = 0;
+    memory::Allocation memory_{memory::Subsystem::GpuFramebuffers};
+};
+
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace viewer {
+
+// Calls `f(begin, end)` on consecutive ranges of [0, n) on `num_threads`,
+// the calling one included, and returns once all are done
+template <typename F>
+void parallel_for(size_t n, int num_threads, F f) {
+    const size_t chunk = (n + num_threads - 1) / std::max(num_threads, 1);
+    std::vector<std::jthread> threads;
+    for (size_t begin = chunk; begin < n; begin += chunk)
+        threads.emplace_back([=] { f(begin, std::min(begin + chunk, n)); });
+    f(0, std::min(chunk, n));
+}
+
+// On all cores
+template <typename F>
+void parallel_for(size_t n, F f) {
+    parallel_for(n, static_cast<int>(std::max(1u, std::thread::hardware_concurrency())), f);
+}
+
+}
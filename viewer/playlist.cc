@@ -0,0 +1,161 @@
+#include "playlist.h"
+#include "logging.h"
+#include "ply.h"
+#include "render.h"
+#include "tracing.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+namespace viewer::playlist {
+
+std::vector<std::string> expand(const std::vector<std::string>& paths) {
+    std::vector<std::string> filenames;
+    for (const std::string& path : paths) {
+        if (!std::filesystem::is_directory(path)) {
+            filenames.push_back(path);
+            continue;
+        }
+        std::vector<std::string> in_directory;
+        for (const auto& entry : std::filesystem::directory_iterator(path)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".ply")
+                in_directory.push_back(entry.path().string());
+        }
+        std::sort(in_directory.begin(), in_directory.end());
+        filenames.insert(filenames.end(), in_directory.begin(), in_directory.end());
+    }
+    return filenames;
+}
+
+Playlist::Playlist(std::vector<std::string> filenames, const Options& options,
+                   GLFWwindow* loader_window)
+    : filenames_(std::move(filenames))
+    , options_(options)
+    , loader_window_(loader_window)
+    , scenes_(filenames_.size()) {
+    for (size_t i = 0; i < filenames_.size(); ++i)
+        scene_memory_.emplace_back(memory::Subsystem::GpuPrefetchedScenes);
+    if (filenames_.empty())
+        LOG_FATAL("no scenes to show");
+    for (const std::string& filename : filenames_) {
+        // Splats on the GPU, centers, radii, source rows and deleted mask on
+        // the host. Files of a lower SH degree need less.
+        const size_t num_splats = ply::PlyFile(filename).num_vertices();
+        scene_bytes_.push_back(num_splats * (dataset::splat_size(options.load.sh_degree)
+                                             + sizeof(Eigen::Vector3f) + sizeof(float)
+                                             + sizeof(uint32_t) + 1));
+    }
+    thread_ = std::jthread(std::bind_front(&Playlist::loader, this));
+}
+
+std::optional<Scene> Playlist::try_take(size_t index) {
+    std::lock_guard lg(mutex_);
+    return take_locked(index);
+}
+
+Scene Playlist::take(size_t index) {
+    std::unique_lock lock(mutex_);
+    std::optional<Scene> scene;
+    loaded_cv_.wait(lock, [&] {
+        scene = take_locked(index);
+        return scene.has_value();
+    });
+    return std::move(*scene);
+}
+
+void Playlist::set_current(size_t index) {
+    std::lock_guard lg(mutex_);
+    if (index == current_) return;
+    current_ = index;
+    request_cv_.notify_all();
+}
+
+std::optional<Scene> Playlist::take_locked(size_t index) {
+    if (index != current_) {
+        current_ = index;
+        request_cv_.notify_all();
+    }
+    if (!scenes_.at(index)) return std::nullopt;
+    std::optional<Scene> scene = std::move(scenes_[index]);
+    scenes_[index].reset();
+    scene_memory_[index].resize(0);
+    taken_ = index;
+    // Its memory no longer counts against the budget
+    request_cv_.notify_all();
+    return scene;
+}
+
+std::vector<size_t> Playlist::wanted() const {
+    std::vector<size_t> indices;
+    const size_t num_ahead = std::min<size_t>(std::max(0, options_.prefetch), size() - 1);
+    for (size_t k = 0; k <= num_ahead; ++k) {
+        const size_t index = (current_ + k) % size();
+        if (k == 0 && taken_ == index) continue;
+        indices.push_back(index);
+    }
+    return indices;
+}
+
+void Playlist::loader(std::stop_token stop) {
+    glfwMakeContextCurrent(loader_window_);
+    while (!stop.stop_requested()) {
+        std::vector<Scene> evicted;
+        std::optional<size_t> index;
+        {
+            std::unique_lock lock(mutex_);
+            request_cv_.wait(lock, stop, [&] {
+                const std::vector<size_t> indices = wanted();
+                size_t loaded_bytes = 0;
+                for (size_t i = 0; i < scenes_.size(); ++i) {
+                    if (!scenes_[i]) continue;
+                    if (std::find(indices.begin(), indices.end(), i) == indices.end()) {
+                        evicted.push_back(std::move(*scenes_[i]));
+                        scenes_[i].reset();
+                        scene_memory_[i].resize(0);
+                    } else {
+                        loaded_bytes += scene_bytes_[i];
+                    }
+                }
+                for (size_t k = 0; k < indices.size(); ++k) {
+                    const size_t i = indices[k];
+                    if (scenes_[i]) continue;
+                    // The requested scene is loaded regardless of the budget
+                    if (!(k == 0 && i == current_)
+                        && loaded_bytes + scene_bytes_[i] > options_.budget_bytes)
+                        break;
+                    index = i;
+                    return true;
+                }
+                return !evicted.empty();
+            });
+        }
+        for (const Scene& scene : evicted)
+            glDeleteBuffers(1, &scene.ssbo_splats);
+        evicted.clear();
+        if (!index || stop.stop_requested()) continue;
+
+        tracing::RecorderGuard tracing_guard("prefetch scene");
+        LOG_INFO("loading %s...", filenames_[*index].c_str());
+        uint32_t ssbo_splats;
+        dataset::Dataset d = rendering::load_ply(filenames_[*index], options_.load, &ssbo_splats);
+        // Complete before another context uses the buffer
+        glFinish();
+        const size_t gpu_bytes = dataset::splat_size(d.sh_degree()) * d.size();
+        {
+            std::lock_guard lg(mutex_);
+            scenes_[*index] = Scene{.dataset = std::move(d), .ssbo_splats = ssbo_splats};
+            scene_memory_[*index].resize(gpu_bytes);
+        }
+        loaded_cv_.notify_all();
+    }
+
+    for (const std::optional<Scene>& scene : scenes_) {
+        if (scene)
+            glDeleteBuffers(1, &scene->ssbo_splats);
+    }
+    glfwMakeContextCurrent(nullptr);
+}
+
+}
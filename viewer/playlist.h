@@ -0,0 +1,88 @@
+#pragma once
+
+#include "dataset.h"
+#include "memory.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct GLFWwindow;
+
+// A list of scenes viewed one after the other. The scenes following the
+// current one are loaded ahead on a background thread, straight into GPU
+// buffers of a shared GL context, so that switching to them only swaps
+// buffers in the renderer.
+
+namespace viewer::playlist {
+
+// Ready for `rendering::Renderer::set_scene`
+struct Scene {
+    dataset::Dataset dataset;
+    uint32_t ssbo_splats;
+};
+
+struct Options {
+    dataset::LoadOptions load;
+    // Scenes after the current one to keep loaded
+    int prefetch = 1;
+    // Bound on the host and GPU memory of the scenes loaded ahead. The
+    // requested scene is loaded regardless.
+    size_t budget_bytes = size_t{4} << 30;
+};
+
+// Replaces directories by the PLY files in them, sorted by name
+std::vector<std::string> expand(const std::vector<std::string>& paths);
+
+class Playlist {
+public:
+    // Loads into the context of `loader_window`, which must share objects
+    // with the renderer's context and is made current on the loading thread
+    Playlist(std::vector<std::string> filenames, const Options& options,
+             GLFWwindow* loader_window);
+
+    size_t size() const { return filenames_.size(); }
+    const std::string& filename(size_t index) const { return filenames_.at(index); }
+
+    // Makes `index` the current scene and hands it over if it is loaded.
+    // The scenes ahead of it are loaded next. A scene that was taken is
+    // loaded again when it is requested another time.
+    std::optional<Scene> try_take(size_t index);
+    // Blocks until the scene is loaded
+    Scene take(size_t index);
+    // Makes `index` the current scene without taking it, e.g. to load ahead
+    // of the scene shown again once another request is withdrawn
+    void set_current(size_t index);
+
+private:
+    void loader(std::stop_token stop);
+    // With `mutex_` held
+    std::optional<Scene> take_locked(size_t index);
+    // The current scene unless taken, then the ones ahead of it
+    std::vector<size_t> wanted() const;
+
+private:
+    const std::vector<std::string> filenames_;
+    const Options options_;
+    GLFWwindow* const loader_window_;
+    // Of each scene once loaded, estimated from the PLY header
+    std::vector<size_t> scene_bytes_;
+
+    std::mutex mutex_;
+    // Signals the loader that the current scene changed
+    std::condition_variable_any request_cv_;
+    // Signals `take` that a scene was loaded
+    std::condition_variable_any loaded_cv_;
+    size_t current_ = 0;
+    std::optional<size_t> taken_;
+    std::vector<std::optional<Scene>> scenes_;
+    // GPU memory of `scenes_`
+    std::vector<memory::Allocation> scene_memory_;
+    std::jthread thread_;
+};
+
+}
@@ -84,4 +84,12 @@ PlyHeader::PlyHeader(const llfio::mapped_file_handle& file) {
     }
 }
 
+std::string PlyFile::header_with_num_vertices(size_t num_vertices) const {
+    const std::regex VERTEX_REGEX("element vertex \\d+\n");
+    return std::regex_replace(
+        std::string(header()), VERTEX_REGEX,
+        "element vertex " + std::to_string(num_vertices) + "\n",
+        std::regex_constants::format_first_only);
+}
+
 }
@@ -0,0 +1,82 @@
+#include "dataset.h"
+#include "logging.h"
+
+#include <chrono>
+#include <iostream>
+#include <cxxopts.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Compares PLY loading with and without readahead on a cold page cache.
+
+namespace {
+
+void evict_from_page_cache(const std::string& filename) {
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        LOG_FATAL("could not open %s", filename.c_str());
+    fdatasync(fd);
+    if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) != 0)
+        LOG_ERROR("posix_fadvise failed, page cache may still be warm");
+    close(fd);
+}
+
+double time_load(const std::string& filename,
+                 const viewer::dataset::LoadOptions& options,
+                 bool cold) {
+    if (cold)
+        evict_from_page_cache(filename);
+    const auto start = std::chrono::steady_clock::now();
+    const viewer::dataset::Dataset d = viewer::dataset::from_ply(filename, options);
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+}
+
+int main(int argc, char** argv) {
+    using namespace viewer;
+
+    cxxopts::Options options(argv[0], "PLY loading benchmark");
+    // clang-format off
+    options
+        .positional_help("file.ply")
+        .add_options()
+            ("h,help", "print this help message")
+            ("n,iterations", "number of loads per mode",
+             cxxopts::value<int>()->default_value("3"))
+            ("warm", "do not evict the file from the page cache before each load")
+            ("positional", "", cxxopts::value<std::vector<std::string>>());
+    // clang-format on
+
+    options.parse_positional({"positional"});
+    auto parsed_options = options.parse(argc, argv);
+
+    if (parsed_options.count("help") || parsed_options.count("positional") == 0 ||
+        parsed_options["positional"].as<std::vector<std::string>>().size() != 1) {
+        std::cout << options.help() << std::endl;
+        return -1;
+    }
+
+    const std::string ply_file_name =
+        parsed_options["positional"].as<std::vector<std::string>>().at(0);
+    const int iterations = parsed_options["iterations"].as<int>();
+    const bool cold = parsed_options.count("warm") == 0;
+
+    for (const bool readahead : {false, true}) {
+        double total_ms = 0.0;
+        double min_ms = std::numeric_limits<double>::infinity();
+        for (int i = 0; i < iterations; ++i) {
+            const double ms = time_load(ply_file_name, {.readahead = readahead}, cold);
+            total_ms += ms;
+            min_ms = std::min(min_ms, ms);
+        }
+        LOG_INFO("%-9s (%s cache): mean %.1f ms, min %.1f ms over %d loads",
+                 readahead ? "readahead" : "mmap",
+                 cold ? "cold" : "warm",
+                 total_ms / iterations, min_ms, iterations);
+    }
+
+    return 0;
+}
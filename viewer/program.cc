@@ -0,0 +1,65 @@
+#include "program.h"
+#include "logging.h"
+
+#include <glad/glad.h>
+
+namespace viewer::rendering {
+
+namespace {
+
+constexpr const char* VERSION_HEADER = "#version 430\n";
+
+GLuint compile_shader(const ShaderStage& stage) {
+    constexpr GLsizei MAX_INFO_LOG_LENGTH = 2000;
+    GLsizei info_log_length;
+    GLchar info_log[MAX_INFO_LOG_LENGTH];
+    GLint compilation_status;
+
+    std::vector<const char*> sources = {VERSION_HEADER};
+    sources.insert(sources.end(), stage.sources.begin(), stage.sources.end());
+
+    const GLuint shader = glCreateShader(stage.type);
+    glShaderSource(shader, sources.size(), sources.data(), NULL);
+    glCompileShader(shader);
+
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compilation_status);
+    if (compilation_status != GL_TRUE) {
+        LOG_ERROR("shader compilation failure");
+        glGetShaderInfoLog(shader, MAX_INFO_LOG_LENGTH, &info_log_length, info_log);
+        if (info_log_length >= MAX_INFO_LOG_LENGTH)
+            info_log[MAX_INFO_LOG_LENGTH - 1] = 0;
+        LOG_INFO("error message:\n%s", info_log);
+        LOG_FATAL("aborting");
+    }
+    return shader;
+}
+
+}
+
+uint32_t create_program(std::initializer_list<ShaderStage> stages) {
+    const GLuint program = glCreateProgram();
+    std::vector<GLuint> shaders;
+    for (const ShaderStage& stage : stages) {
+        shaders.push_back(compile_shader(stage));
+        glAttachShader(program, shaders.back());
+    }
+
+    GLint link_status;
+    glLinkProgram(program);
+    glGetProgramiv(program, GL_LINK_STATUS, &link_status);
+    if (link_status != GL_TRUE)
+        LOG_FATAL("GL program link failure.");
+
+    for (const GLuint shader : shaders) {
+        glDetachShader(program, shader);
+        glDeleteShader(shader);
+    }
+    return program;
+}
+
+std::string sh_variant_defines(int splat_sh_degree, int sh_degree) {
+    return "#define SPLAT_SH_DEGREE " + std::to_string(splat_sh_degree) + "\n"
+        + "#define SH_DEGREE " + std::to_string(sh_degree) + "\n";
+}
+
+}
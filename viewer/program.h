@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+namespace viewer::rendering {
+
+struct ShaderStage {
+    // GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_COMPUTE_SHADER, ...
+    uint32_t type;
+    // Concatenated after the `#version` line
+    std::vector<const char*> sources;
+};
+
+// Compiles and links a program, aborts on errors
+uint32_t create_program(std::initializer_list<ShaderStage> stages);
+
+// Source to put in front of `shaders/common.glsl`, specializes a program for
+// splats of `dataset::SplatT<splat_sh_degree>` shaded up to `sh_degree`
+std::string sh_variant_defines(int splat_sh_degree, int sh_degree);
+
+}
@@ -0,0 +1,365 @@
+#include "camera.h"
+#include "cpu_render.h"
+#include "dataset.h"
+#include "logging.h"
+#include "ply.h"
+
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <cxxopts.hpp>
+
+// Shrinks a scene offline: removes splats that are too transparent or too
+// small on screen to matter and merges near-duplicate neighbours. Reports the
+// splat count, file size and the image error against the original in the CPU
+// reference renderer along a camera orbit.
+
+namespace {
+
+using namespace viewer;
+
+constexpr float SH_C0 = 0.28209479177387814f;
+// f_dc_* and f_rest_* up to degree 3
+constexpr int MAX_SH_PROPERTIES = 48;
+
+struct Thresholds {
+    // Splats with at most this alpha are culled by the shaders anyway, see
+    // `cutoff_radius` in shaders/common.glsl
+    float min_opacity;
+    // Pixel radius at the closest camera of the orbit
+    float min_footprint;
+    // Size of the grid cells within which splats are merged, 0 disables
+    float merge_distance;
+    // Max difference of the base colors of merged splats, in [0, 1]
+    float merge_color;
+};
+
+// Orbit around the centroid, robust against far away floaters
+std::vector<Eigen::Matrix4f> orbit(const dataset::Centers& centers, int num_poses) {
+    const size_t N = centers.size();
+    Eigen::Vector3f centroid = Eigen::Vector3f::Zero();
+    for (const auto& c : centers)
+        centroid += c;
+    centroid /= N;
+    std::vector<float> distances;
+    distances.reserve(N);
+    for (const auto& c : centers)
+        distances.push_back((c - centroid).norm());
+    std::nth_element(distances.begin(), distances.begin() + N / 2, distances.end());
+    const float radius = 2.f * distances.at(N / 2);
+
+    std::vector<Eigen::Matrix4f> views;
+    for (int pose = 0; pose < num_poses; ++pose) {
+        const float angle = 2.f * M_PI * pose / num_poses;
+        const Eigen::Vector3f eye =
+            centroid + radius * Eigen::Vector3f(std::sin(angle), 0.f, std::cos(angle));
+        views.push_back(camera::look_at(eye, centroid, -Eigen::Vector3f::UnitY()));
+    }
+    return views;
+}
+
+// Largest pixel radius of the splat's quad over the views, without the
+// shaders' low-pass filter. Infinite for splats in front of no camera, which
+// are kept.
+float footprint(const dataset::Splat& s, float max_scale,
+                const std::vector<Eigen::Matrix4f>& views, float focal) {
+    // See `cutoff_radius` in shaders/common.glsl
+    const float cutoff = std::sqrt(std::clamp(std::log(s.alpha * 255.f), 0.f, 4.f));
+    const Eigen::Vector3f center(s.center[0], s.center[1], s.center[2]);
+    float min_z = std::numeric_limits<float>::infinity();
+    for (const Eigen::Matrix4f& view : views) {
+        const float z = view.block<1, 3>(2, 0).dot(center) + view(2, 3);
+        if (z > camera::Z_NEAR)
+            min_z = std::min(min_z, z);
+    }
+    if (std::isinf(min_z))
+        return std::numeric_limits<float>::infinity();
+    return std::sqrt(2.f) * cutoff * focal * max_scale / min_z;
+}
+
+// Grid cell of a finite point, its integer coordinates as doubles, which hold
+// those of any float point divided by a small cell size without wrapping
+using Cell = std::array<double, 3>;
+
+Cell cell_of(const Eigen::Vector3f& p, float cell_size) {
+    const Eigen::Vector3d c = (p.cast<double>() / cell_size).array().floor();
+    return {c.x(), c.y(), c.z()};
+}
+
+class Merger {
+public:
+    // Averages the spherical harmonics coefficients up to `sh_degree`
+    Merger(const ply::PlyFile& ply, int sh_degree) : ply_(ply) {
+        for (const char* name : {"x", "y", "z", "opacity", "scale_0", "scale_1",
+                                 "scale_2", "rot_0", "rot_1", "rot_2", "rot_3"})
+            offsets_.push_back(ply.offset(name));
+        for (int i = 0; i < 3; ++i)
+            sh_offsets_.push_back(ply.offset("f_dc_" + std::to_string(i)));
+        for (int i = 0; i < 3 * (dataset::num_sh_coeffs(sh_degree) - 1); ++i)
+            sh_offsets_.push_back(ply.offset("f_rest_" + std::to_string(i)));
+    }
+
+    // Moment matching: the merged Gaussian has the mass-weighted mean and
+    // covariance of the cluster, with the opacity of the members composited
+    // on top of each other. Writes a row based on that of the heaviest member.
+    std::vector<char> merge(const dataset::Dataset& d, const std::vector<uint32_t>& cluster) const {
+        std::vector<double> weights;
+        double total = 0.0;
+        float transmittance = 1.f;
+        for (const uint32_t i : cluster) {
+            const dataset::Splat& s = d.buffer()[i];
+            // Opacity times volume
+            const double w = s.alpha * std::sqrt(std::max(0.f, covariance(s).determinant()));
+            weights.push_back(w + 1e-30);
+            total += weights.back();
+            transmittance *= 1.f - s.alpha;
+        }
+
+        Eigen::Vector3f mean = Eigen::Vector3f::Zero();
+        for (size_t k = 0; k < cluster.size(); ++k)
+            mean += weights[k] / total * d.centers()[cluster[k]];
+        Eigen::Matrix3f cov = Eigen::Matrix3f::Zero();
+        std::array<float, MAX_SH_PROPERTIES> sh = {};
+        for (size_t k = 0; k < cluster.size(); ++k) {
+            const float w = weights[k] / total;
+            const Eigen::Vector3f offset = d.centers()[cluster[k]] - mean;
+            cov += w * (covariance(d.buffer()[cluster[k]]) + offset * offset.transpose());
+            const char* row = ply_.row(cluster[k]);
+            for (size_t j = 0; j < sh_offsets_.size(); ++j)
+                sh[j] += w * read(row, sh_offsets_[j]);
+        }
+
+        const Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> eigen(cov);
+        Eigen::Matrix3f R = eigen.eigenvectors();
+        if (R.determinant() < 0.f)
+            R.col(0) = -R.col(0);
+        const Eigen::Quaternionf q(R);
+        const Eigen::Vector3f scale =
+            eigen.eigenvalues().cwiseMax(1e-12f).cwiseSqrt().array().log();
+        const float alpha = std::clamp(1.f - transmittance, 1e-6f, 0.99f);
+
+        const uint32_t heaviest = cluster[std::distance(
+            weights.begin(), std::max_element(weights.begin(), weights.end()))];
+        const char* source = ply_.row(heaviest);
+        std::vector<char> row(source, source + ply_.row_length());
+        const float values[] = {
+            mean.x(), mean.y(), mean.z(), std::log(alpha / (1.f - alpha)),
+            scale.x(), scale.y(), scale.z(), q.w(), q.x(), q.y(), q.z(),
+        };
+        for (size_t j = 0; j < offsets_.size(); ++j)
+            write(row.data(), offsets_[j], values[j]);
+        for (size_t j = 0; j < sh_offsets_.size(); ++j)
+            write(row.data(), sh_offsets_[j], sh[j]);
+        return row;
+    }
+
+private:
+    static Eigen::Matrix3f covariance(const dataset::Splat& s) {
+        Eigen::Matrix3f cov;
+        // clang-format off
+        cov <<
+            s.covA[0], s.covA[1], s.covA[2],
+            s.covA[1], s.covB[0], s.covB[1],
+            s.covA[2], s.covB[1], s.covB[2];
+        // clang-format on
+        return cov;
+    }
+
+    static float read(const char* row, size_t offset) {
+        float v;
+        std::memcpy(&v, row + offset, sizeof(v));
+        return v;
+    }
+
+    static void write(char* row, size_t offset, float v) {
+        std::memcpy(row + offset, &v, sizeof(v));
+    }
+
+private:
+    const ply::PlyFile& ply_;
+    // Of the values written by `merge`, in that order
+    std::vector<size_t> offsets_;
+    std::vector<size_t> sh_offsets_;
+};
+
+// Greedy clusters of splats in the same grid cell with similar base colors
+std::vector<std::vector<uint32_t>> clusters(const dataset::Dataset& d,
+                                            const std::vector<uint32_t>& splats,
+                                            const Thresholds& t) {
+    std::vector<std::vector<uint32_t>> result;
+    std::vector<std::pair<Cell, uint32_t>> keyed;
+    keyed.reserve(splats.size());
+    for (const uint32_t i : splats) {
+        const Eigen::Vector3f& center = d.centers()[i];
+        if (t.merge_distance > 0.f && center.allFinite())
+            keyed.emplace_back(cell_of(center, t.merge_distance), i);
+        else
+            result.push_back({i});
+    }
+    std::sort(keyed.begin(), keyed.end());
+
+    const auto color = [&](uint32_t i) -> Eigen::Vector3f {
+        const auto& dc = d.buffer()[i].sh[0];
+        return Eigen::Vector3f(dc[0], dc[1], dc[2]) * SH_C0;
+    };
+
+    // Clusters of the current cell are at the end of `result`
+    size_t cell_begin = result.size();
+    for (size_t k = 0; k < keyed.size(); ++k) {
+        if (k > 0 && keyed[k].first != keyed[k - 1].first)
+            cell_begin = result.size();
+        const uint32_t i = keyed[k].second;
+        const auto it = std::find_if(
+            result.begin() + cell_begin, result.end(), [&](const auto& c) {
+                return (color(c.front()) - color(i)).cwiseAbs().maxCoeff() <= t.merge_color;
+            });
+        if (it == result.end())
+            result.push_back({i});
+        else
+            it->push_back(i);
+    }
+    return result;
+}
+
+}
+
+int main(int argc, char** argv) {
+    cxxopts::Options options(argv[0], "Splat scene pruning");
+    // clang-format off
+    options
+        .positional_help("in.ply out.ply")
+        .add_options()
+            ("h,help", "print this help message")
+            ("min-opacity", "remove splats with at most this opacity (default: just below 1/255, culled anyway)",
+             cxxopts::value<float>()->default_value("0.00392"))
+            ("min-footprint", "remove splats with a smaller radius in pixels at the closest orbit camera",
+             cxxopts::value<float>()->default_value("0"))
+            ("merge-distance", "merge similar splats within grid cells of this size, 0 disables",
+             cxxopts::value<float>()->default_value("0"))
+            ("merge-color", "max base color difference of merged splats",
+             cxxopts::value<float>()->default_value("0.05"))
+            ("n,poses", "number of camera poses on the orbit",
+             cxxopts::value<int>()->default_value("8"))
+            ("width", "width of the reference rendering",
+             cxxopts::value<int>()->default_value("320"))
+            ("height", "height of the reference rendering",
+             cxxopts::value<int>()->default_value("180"))
+            ("fov", "horizontal field of view in degrees",
+             cxxopts::value<float>()->default_value("60"))
+            ("positional", "", cxxopts::value<std::vector<std::string>>());
+    // clang-format on
+
+    options.parse_positional({"positional"});
+    auto parsed_options = options.parse(argc, argv);
+
+    if (parsed_options.count("help") || parsed_options.count("positional") == 0 ||
+        parsed_options["positional"].as<std::vector<std::string>>().size() != 2) {
+        std::cout << options.help() << std::endl;
+        return -1;
+    }
+
+    const auto& files = parsed_options["positional"].as<std::vector<std::string>>();
+    const std::string& in_file_name = files.at(0);
+    const std::string& out_file_name = files.at(1);
+    const Thresholds thresholds = {
+        .min_opacity = parsed_options["min-opacity"].as<float>(),
+        .min_footprint = parsed_options["min-footprint"].as<float>(),
+        .merge_distance = parsed_options["merge-distance"].as<float>(),
+        .merge_color = parsed_options["merge-color"].as<float>(),
+    };
+    const camera::CameraIntrinsics intrinsics = camera::from_fov(
+        parsed_options["fov"].as<float>(),
+        parsed_options["width"].as<int>(),
+        parsed_options["height"].as<int>());
+
+    LOG_INFO("loading %s...", in_file_name.c_str());
+    const dataset::Dataset d(dataset::from_ply(in_file_name));
+    ply::PlyFile ply(in_file_name);
+    const size_t N = d.buffer().size();
+    if (N == 0)
+        LOG_FATAL("empty scene");
+    const std::vector<Eigen::Matrix4f> views = orbit(d.centers(), parsed_options["poses"].as<int>());
+
+    // Removal
+    const auto scale_0 = ply.accessor<float>("scale_0");
+    const auto scale_1 = ply.accessor<float>("scale_1");
+    const auto scale_2 = ply.accessor<float>("scale_2");
+    std::vector<uint32_t> kept;
+    size_t num_transparent = 0, num_small = 0;
+    for (uint32_t i = 0; i < N; ++i) {
+        const dataset::Splat& s = d.buffer()[i];
+        if (s.alpha <= thresholds.min_opacity) {
+            ++num_transparent;
+            continue;
+        }
+        const float max_scale =
+            std::exp(std::max({scale_0(i), scale_1(i), scale_2(i)}));
+        if (thresholds.min_footprint > 0.f
+            && footprint(s, max_scale, views, intrinsics.fx) < thresholds.min_footprint) {
+            ++num_small;
+            continue;
+        }
+        kept.push_back(i);
+    }
+
+    // Merging and output
+    const std::vector<std::vector<uint32_t>> merged = clusters(d, kept, thresholds);
+    // Looks up the properties, only those of the file's degree
+    std::optional<Merger> merger;
+    if (thresholds.merge_distance > 0.f)
+        merger.emplace(ply, dataset::file_sh_degree(ply));
+    {
+        const std::string header = ply.header_with_num_vertices(merged.size());
+        std::ofstream out(out_file_name, std::ios::binary);
+        out.write(header.data(), header.size());
+        for (const std::vector<uint32_t>& cluster : merged) {
+            if (cluster.size() == 1) {
+                out.write(ply.row(cluster.front()), ply.row_length());
+            } else {
+                const std::vector<char> row = merger->merge(d, cluster);
+                out.write(row.data(), row.size());
+            }
+        }
+        if (!out)
+            LOG_FATAL("could not write %s", out_file_name.c_str());
+    }
+
+    // Error estimate
+    const dataset::Dataset pruned(dataset::from_ply(out_file_name));
+    double mean_abs_error = 0.0, affected_pixels = 0.0;
+    float max_abs_error = 0.f;
+    dataset::SortResult sorted, sorted_pruned;
+    for (size_t pose = 0; pose < views.size(); ++pose) {
+        const Eigen::Matrix4f P = camera::projection_matrix(intrinsics) * views[pose];
+        d.sort(P, &sorted, {.fast_sort = false});
+        pruned.sort(P, &sorted_pruned, {.fast_sort = false});
+        const cpu_render::ImageDiff diff = cpu_render::compare(
+            cpu_render::render(d.buffer(), sorted.depth_index, views[pose], intrinsics),
+            cpu_render::render(pruned.buffer(), sorted_pruned.depth_index, views[pose], intrinsics));
+        mean_abs_error += diff.mean_abs_error / views.size();
+        affected_pixels += diff.affected_pixels / views.size();
+        max_abs_error = std::max(max_abs_error, diff.max_abs_error);
+        logging::print_progress(static_cast<double>(pose + 1) / views.size());
+    }
+
+    const auto percent = [&](size_t n) { return 100.0 * n / N; };
+    // clang-format off
+    std::printf("%-28s %12zu\n", "splats", N);
+    std::printf("%-28s %12zu %7.2f%%\n", "removed, opacity", num_transparent, percent(num_transparent));
+    std::printf("%-28s %12zu %7.2f%%\n", "removed, footprint", num_small, percent(num_small));
+    std::printf("%-28s %12zu %7.2f%%\n", "removed, merged", kept.size() - merged.size(),
+                percent(kept.size() - merged.size()));
+    std::printf("%-28s %12zu %7.2f%%\n", "splats after pruning", merged.size(), percent(merged.size()));
+    std::printf("%-28s %12.1f -> %.1f MB\n", "file size",
+                std::filesystem::file_size(in_file_name) / 1e6,
+                std::filesystem::file_size(out_file_name) / 1e6);
+    std::printf("%-28s %12.6f\n", "mean abs error", mean_abs_error);
+    std::printf("%-28s %12.4f\n", "max abs error", max_abs_error);
+    std::printf("%-28s %12.4f%%\n", "affected pixels", 100.0 * affected_pixels);
+    // clang-format on
+
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "render.h"
+#include "program.h"
 #include "tracing.h"
 
 #include <glad/glad.h>
@@ -8,62 +9,44 @@ namespace viewer::rendering {
 
 namespace {
 
+static const char* COMMON_SHADER_SOURCE =
+#include "shaders/common.glsl"
+;
 static const char* VERTEX_SHADER_SOURCE =
 #include "shaders/shader.vs"
 ;
 static const char* FRAGMENT_SHADER_SOURCE =
 #include "shaders/shader.fs"
 ;
+static const char* FULLSCREEN_VERTEX_SHADER_SOURCE =
+#include "shaders/fullscreen.vs"
+;
+static const char* MASK_FRAGMENT_SHADER_SOURCE =
+#include "shaders/saturation_mask.fs"
+;
+static const char* OVERDRAW_FRAGMENT_SHADER_SOURCE =
+#include "shaders/overdraw.fs"
+;
+static const char* OIT_ACCUMULATE_SHADER_SOURCE =
+#include "shaders/oit_accumulate.fs"
+;
+static const char* OIT_COMPOSITE_SHADER_SOURCE =
+#include "shaders/oit_composite.fs"
+;
 
-uint32_t create_shaders() {
-    constexpr GLsizei MAX_INFO_LOG_LENGTH = 2000;
-    GLsizei info_log_length;
-    GLchar info_log[MAX_INFO_LOG_LENGTH];
-    GLint compilation_status;
-    auto check_comp_status = [&](GLuint shader) {
-        glGetShaderiv(shader, GL_COMPILE_STATUS, &compilation_status);
-        if (compilation_status == GL_TRUE)
-            return;
-
-        LOG_ERROR("shader compilation failure");
-        glGetShaderInfoLog(shader, MAX_INFO_LOG_LENGTH, &info_log_length, info_log);
-        if (info_log_length >= MAX_INFO_LOG_LENGTH)
-            info_log[MAX_INFO_LOG_LENGTH - 1] = 0;
-        LOG_INFO("error message:\n%s", info_log);
-        LOG_FATAL("aborting");
-    };
-
-    const GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex_shader, 1, &VERTEX_SHADER_SOURCE, NULL);
-    glCompileShader(vertex_shader);
-    check_comp_status(vertex_shader);
-
-    const GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment_shader, 1, &FRAGMENT_SHADER_SOURCE, NULL);
-    glCompileShader(fragment_shader);
-    check_comp_status(fragment_shader);
-
-    const GLuint program = glCreateProgram();
-    glAttachShader(program, vertex_shader);
-    glAttachShader(program, fragment_shader);
-    glLinkProgram(program);
-    glGetProgramiv(program, GL_LINK_STATUS, &compilation_status);
-    if (compilation_status != GL_TRUE)
-        LOG_FATAL("GL program link failure.");
-
-    return program;
+void check_ssbo_size(size_t data_num_bytes) {
+    GLint max_size;
+    glGetIntegerv(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &max_size);
+    if (max_size <= 0 || data_num_bytes > static_cast<size_t>(max_size))
+        LOG_FATAL("ssbo size too large, %ld (requested) > %d (max size)",
+                  data_num_bytes, max_size);
 }
 
 template <typename Container>
 GLuint ssbo_setup(const Container& d) {
     const size_t data_num_bytes =
         sizeof(typename Container::value_type) * d.size();
-
-    GLint max_size;
-    glGetIntegerv(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &max_size);
-    if (max_size <= 0 || data_num_bytes > static_cast<size_t>(max_size))
-        LOG_FATAL("ssbo size too large, %ld (requested) > %d (max size)",
-                  data_num_bytes, max_size);
+    check_ssbo_size(data_num_bytes);
 
     GLuint ssbo;
     glGenBuffers(1, &ssbo);
@@ -135,25 +118,43 @@ void buf_data(GLuint buf, const Container& d, GLenum usage = GL_DYNAMIC_DRAW) {
 
 }
 
-Renderer::Renderer(const dataset::Dataset& d)
+Renderer::Renderer(dataset::Dataset& d, uint32_t ssbo_splats, bool recycle)
     : d_(d)
-    , program_(create_shaders())
-    , u_projection_(glGetUniformLocation(program_, "projection"))
-    , u_viewport_(glGetUniformLocation(program_, "viewport"))
-    , u_focal_(glGetUniformLocation(program_, "focal"))
-    , u_view_(glGetUniformLocation(program_, "view"))
-    , u_cam_pos_(glGetUniformLocation(program_, "cam_position"))
-    , u_sh_degree_(glGetUniformLocation(program_, "sh_degree"))
+    , ssbo_sh_degree_(d.sh_degree())
+    , program_(&quad_program(d.sh_degree()))
+    , a_depth_index_(glGetAttribLocation(program_->program, "depth_index"))
     , triangle_vertices_({-2.f, -2.f, 2.f, -2.f, 2.f, 2.f, -2.f, 2.f})
       // Set up buffers:
-    , ssbo_splats_(ssbo_setup(d.buffer()))
+    , ssbo_splats_(ssbo_splats ? ssbo_splats : ssbo_setup(d.buffer()))
+    , ssbo_recycle_(ssbo_splats && recycle)
+    , ssbo_num_splats_(d.size())
+    , ssbo_capacity_(d.size())
     , buf_vertex_(buf_setup(GL_FLOAT,
-                            program_, "position", 2, false,
+                            program_->program, "position", 2, false,
                             triangle_vertices_.data(),
                             triangle_vertices_.size()))
-    , buf_index_(buf_setup<uint32_t>(GL_UNSIGNED_INT, program_, "depth_index"))
+    , buf_indices_({buf_setup<uint32_t>(GL_UNSIGNED_INT, program_->program, "depth_index")})
+    , program_mask_(create_program({
+          {.type = GL_VERTEX_SHADER, .sources = {FULLSCREEN_VERTEX_SHADER_SOURCE}},
+          {.type = GL_FRAGMENT_SHADER, .sources = {MASK_FRAGMENT_SHADER_SOURCE}},
+      }))
+    , program_overdraw_(create_program({
+          {.type = GL_VERTEX_SHADER, .sources = {FULLSCREEN_VERTEX_SHADER_SOURCE}},
+          {.type = GL_FRAGMENT_SHADER,
+           .sources = {COMMON_SHADER_SOURCE, OVERDRAW_FRAGMENT_SHADER_SOURCE}},
+      }))
+    , program_oit_composite_(create_program({
+          {.type = GL_VERTEX_SHADER, .sources = {FULLSCREEN_VERTEX_SHADER_SOURCE}},
+          {.type = GL_FRAGMENT_SHADER, .sources = {OIT_COMPOSITE_SHADER_SOURCE}},
+      }))
+    , vao_fullscreen_(0)
+    , buf_fragment_counts_(0)
+    , target_(true)
     , thread_(std::bind_front(&Renderer::sort_worker, this)) {
-    glUseProgram(program_);
+    // Compiled ahead, progressive quality switches between them
+    for (int sh_degree = 0; sh_degree < ssbo_sh_degree_; ++sh_degree)
+        quad_program(sh_degree);
+    glUseProgram(program_->program);
     // General setup
     glDisable(GL_DEPTH_TEST);
     glEnable(GL_BLEND);
@@ -163,93 +164,1021 @@ Renderer::Renderer(const dataset::Dataset& d)
         GL_ONE_MINUS_DST_ALPHA,
         GL_ONE);
     glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
+    glGenVertexArrays(1, &vao_fullscreen_);
+    glGenBuffers(1, &buf_fragment_counts_);
+    buf_chunk_runs_.resize(1);
+    glGenBuffers(1, buf_chunk_runs_.data());
+    splats_memory_.resize(dataset::splat_size(ssbo_sh_degree_) * d_.size());
+    indices_memory_.emplace_back(memory::Subsystem::GpuSortIndices);
+}
+
+const Renderer::QuadProgram& Renderer::quad_program(int sh_degree,
+                                                     bool storage_order) const {
+    sh_degree = std::clamp(sh_degree, 0, ssbo_sh_degree_);
+    std::optional<QuadProgram>& p =
+        quad_programs_.at(storage_order * 16 + ssbo_sh_degree_ * 4 + sh_degree);
+    if (p) return *p;
+
+    tracing::RecorderGuard tracing_guard("compile quad program");
+    const std::string defines = sh_variant_defines(ssbo_sh_degree_, sh_degree)
+        + (storage_order ? "#define STORAGE_ORDER\n" : "");
+    const GLuint program = create_program({
+        {.type = GL_VERTEX_SHADER,
+         .sources = {defines.c_str(), COMMON_SHADER_SOURCE, VERTEX_SHADER_SOURCE}},
+        {.type = GL_FRAGMENT_SHADER,
+         .sources = {defines.c_str(), COMMON_SHADER_SOURCE,
+                     storage_order ? OIT_ACCUMULATE_SHADER_SOURCE : FRAGMENT_SHADER_SOURCE}},
+    });
+    p = QuadProgram{
+        .program = program,
+        .u_projection = glGetUniformLocation(program, "projection"),
+        .u_viewport = glGetUniformLocation(program, "viewport"),
+        .u_focal = glGetUniformLocation(program, "focal"),
+        .u_view = glGetUniformLocation(program, "view"),
+        .u_cam_pos = glGetUniformLocation(program, "cam_pos"),
+        .u_opacity_exponent = glGetUniformLocation(program, "opacity_exponent"),
+        .u_count_fragments = glGetUniformLocation(program, "count_fragments"),
+        .u_record_occlusion = glGetUniformLocation(program, "record_occlusion"),
+        .u_num_chunk_runs = glGetUniformLocation(program, "num_chunk_runs"),
+        .u_base_instance = glGetUniformLocation(program, "base_instance"),
+        .u_viewport_origin = glGetUniformLocation(program, "viewport_origin"),
+        .u_crop_mode = glGetUniformLocation(program, "crop_mode"),
+        .u_crop_min = glGetUniformLocation(program, "crop_min"),
+        .u_crop_max = glGetUniformLocation(program, "crop_max"),
+    };
+    return *p;
 }
 
 void Renderer::use_program() const {
-    glUseProgram(program_);
+    glUseProgram(program_->program);
 }
 
 void Renderer::set_camera_intrinsics(const CameraIntrinsics& c) {
-    constexpr float z_near = 0.2f;
-    constexpr float z_far = 200.f;
-    constexpr float dz = z_far - z_near;
     {
         std::lock_guard lg(mutex_);
-        // clang-format off
-        mat_projection_ <<
-            2.f * c.fx / c.width,  0.f,                   0.f,         0.f,
-            0.f,                  -2.f * c.fy / c.height, 0.f,         0.f,
-            0.f,                   0.f,                   z_far / dz, -z_far * z_near / dz,
-            0.f,                   0.f,                   1.f,         0.f;
-        // clang-format on
+        intrinsics_ = c;
+        const Eigen::Matrix4f projection = camera::projection_matrix(c);
+        if (projection != mat_projection_) {
+            mat_projection_ = projection;
+            invalidate_sort();
+        }
     }
-    glUniformMatrix4fv(u_projection_, 1, GL_FALSE, mat_projection_.data());
-    glUniform2f(u_viewport_, c.width, c.height);
-    glUniform2f(u_focal_, c.fx, c.fy);
 }
 
 void Renderer::set_view(const Eigen::Matrix4f& view) {
-    {
-        std::lock_guard lg(mutex_);
-        mat_view_ = view;
+    set_views({view});
+}
+
+void Renderer::set_views(const std::vector<Eigen::Matrix4f>& views) {
+    if (views.empty()) return;
+    std::lock_guard lg(mutex_);
+    const bool changed = views != views_;
+    if (changed) {
+        views_ = views;
+        mat_view_ = camera::mean_view(views);
+    }
+
+    // Recorded every frame, so that the history shows when the camera stops
+    constexpr size_t MAX_VIEW_HISTORY = 16;
+    view_history_.push_back({.time = Clock::now(), .view = mat_view_});
+    if (view_history_.size() > MAX_VIEW_HISTORY)
+        view_history_.pop_front();
+
+    if (changed) {
+        still_frames_ = 0;
+        invalidate_sort();
+    } else {
+        if (still_frames_ < std::numeric_limits<int>::max()) {
+            ++still_frames_;
+            // Sort again at full quality
+            if (config_.progressive.enabled
+                && still_frames_ == config_.progressive.still_frames)
+                invalidate_sort();
+        }
+        // A sort of a predicted view is redone with this sample
+        sort_cv_.notify_one();
     }
-    glUniformMatrix4fv(u_view_, 1, GL_FALSE, mat_view_.data());
-    const Eigen::Vector3f cam_pos(mat_view_.inverse().block<3, 1>(0, 3));
-    glUniform3fv(u_cam_pos_, 1, cam_pos.data());
 }
 
 void Renderer::set_config(const RendererConfig& config) {
     {
         std::lock_guard lg(mutex_);
+        // The box edit preview is drawn without sorting again
+        RendererConfig sorted = config;
+        sorted.box_edit = config_.box_edit;
+        if (!(sorted == config_))
+            invalidate_sort();
+        // The box edit preview hides splats
+        const bool cropped = config.box_edit.preview || config_.box_edit.preview;
+        if (!(sorted == config_) || (cropped && !(config.box_edit == config_.box_edit)))
+            ++occlusion_generation_;
         config_ = config;
     }
-    glUniform1i(u_sh_degree_, config_.sh_degree);
 }
 
 void Renderer::render() const {
     tracing::RecorderGuard tracing_guard("render");
-    use_program();
     {
         std::lock_guard lg(mutex_);
 
-        const dataset::SortResult& sr = buffer_index_ == 0 ? sr0_ : sr1_;
+        const std::vector<dataset::SortResult>& results = sort_results_[buffer_index_];
 
-        if (buffer_index_ != prev_buffer_index_) {
-            buf_data(buf_index_, sr.depth_index);
-            prev_buffer_index_ = buffer_index_;
+        while (std::optional<occlusion::OcclusionBuffer> buffer = occlusion_recorder_.poll()) {
+            occlusion_buffer_ =
+                std::make_shared<const occlusion::OcclusionBuffer>(std::move(*buffer));
+            sort_cv_.notify_one();
         }
+        if (!config_.occlusion_culling)
+            occlusion_buffer_.reset();
+        // Into the layout they were applied to, before it changes below
+        upload_live_updates();
 
-        {
-            tracing::RecorderGuard tracing_guard("draw");
-            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ssbo_splats_);
-            glDrawArraysInstanced(
-                GL_TRIANGLE_FAN, 0, 4, static_cast<GLsizei>(sr.num_vertices()));
-            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+        // The subset drawn is that of the displayed sort, which may still be
+        // a reduced one after the camera stopped
+        const bool reduced = reduced_quality();
+        // Without a sort result only the unsorted preview can be shown
+        const bool unsorted = config_.backend == Backend::WeightedOit
+            || (config_.unsorted_preview && results.empty());
+        const Quality quality = {
+            .sh_degree = reduced
+                ? std::min(config_.sh_degree, config_.progressive.sh_degree)
+                : config_.sh_degree,
+            .opacity_exponent = unsorted ? 1.f : 1.f / sort_fractions_[buffer_index_],
+            .unsorted = unsorted,
+            // Not while live updates of the current generation are pending,
+            // the recording would show the splats before them
+            .record_occlusion = config_.occlusion_culling
+                && config_.backend == Backend::Quads && views_.size() == 1 && !unsorted
+                && live_updates_.empty(),
+        };
+        frame_stats_.reduced_quality = reduced || sort_fractions_[buffer_index_] < 1.f;
+        frame_stats_.num_deleted = d_.num_deleted();
+
+        if (sort_layouts_[buffer_index_] != uploaded_layout_ && scene_ssbo_splats_) {
+            // The displayed sort indexes a new scene
+            release_ssbo(ssbo_splats_, ssbo_recycle_);
+            ssbo_splats_ = std::exchange(scene_ssbo_splats_, 0);
+            ssbo_recycle_ = scene_ssbo_recycle_;
+            ssbo_sh_degree_ = d_.sh_degree();
+            ssbo_num_splats_ = d_.size();
+            ssbo_capacity_ = d_.size();
+            splats_memory_.resize(dataset::splat_size(ssbo_sh_degree_) * d_.size());
+            uploaded_layout_ = sort_layouts_[buffer_index_];
+            // A scene set meanwhile waits for this one to be uploaded
+            if (next_scene_)
+                sort_cv_.notify_one();
+        } else if (sort_layouts_[buffer_index_] != uploaded_layout_) {
+            // The displayed sort indexes the compacted dataset. The live
+            // splats are copied on the GPU, the host may not have them.
+            tracing::RecorderGuard tracing_guard("compact splat buffer");
+            const size_t SPLAT_BYTES = dataset::splat_size(ssbo_sh_degree_);
+            GLuint compacted;
+            glGenBuffers(1, &compacted);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, compacted);
+            glBufferData(GL_COPY_WRITE_BUFFER, SPLAT_BYTES * d_.size(), nullptr,
+                         GL_STATIC_DRAW);
+            glBindBuffer(GL_COPY_READ_BUFFER, ssbo_splats_);
+            size_t offset = 0;
+            for (const dataset::IndexRange& range : live_ranges_) {
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                    range.begin * SPLAT_BYTES, offset * SPLAT_BYTES,
+                                    (range.end - range.begin) * SPLAT_BYTES);
+                offset += range.end - range.begin;
+            }
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            release_ssbo(ssbo_splats_, ssbo_recycle_);
+            ssbo_splats_ = compacted;
+            ssbo_recycle_ = false;
+            ssbo_num_splats_ = d_.size();
+            ssbo_capacity_ = d_.size();
+            splats_memory_.resize(SPLAT_BYTES * d_.size());
+            live_ranges_.clear();
+            uploaded_layout_ = sort_layouts_[buffer_index_];
         }
+        // Ranges of a compacted dataset wait until it is uploaded
+        if (uploaded_layout_ == layout_)
+            upload_edits();
+
+        if (num_sorts_ != num_sorts_uploaded_) {
+            while (buf_indices_.size() < results.size()) {
+                GLuint buffers[2];
+                glGenBuffers(2, buffers);
+                buf_indices_.push_back(buffers[0]);
+                buf_chunk_runs_.push_back(buffers[1]);
+                indices_memory_.emplace_back(memory::Subsystem::GpuSortIndices);
+            }
+            size_t index_bytes = 0;
+            for (size_t k = 0; k < results.size(); ++k) {
+                const dataset::SortResult& r = results[k];
+                size_t num_bytes;
+                if (r.chunk_runs.empty()) {
+                    buf_data(buf_indices_[k], r.depth_index);
+                    num_bytes = r.depth_index.size() * sizeof(uint32_t);
+                } else {
+                    buf_data(buf_indices_[k], r.chunk_index);
+                    buf_data(buf_chunk_runs_[k], r.chunk_runs);
+                    num_bytes = r.chunk_index.size() * sizeof(uint16_t)
+                        + r.chunk_runs.size() * sizeof(dataset::ChunkRun);
+                }
+                indices_memory_[k].resize(num_bytes);
+                index_bytes += num_bytes;
+            }
+            frame_stats_.index_bytes = index_bytes;
+            frame_stats_.chunked_indices = !results.empty() && !results[0].chunk_runs.empty();
+            num_sorts_uploaded_ = num_sorts_;
+            frame_stats_.sort_latency_ms = std::chrono::duration<double, std::milli>(
+                Clock::now() - sort_request_times_[buffer_index_]).count();
+        }
+
+        while (const auto sample = gpu_timer_.poll()) {
+            const float scale = timed_scales_[sample->id % timed_scales_.size()];
+            frame_stats_.gpu_ms = sample->ms;
+            resolution_controller_.update(config_.resolution, sample->ms, scale);
+        }
+        const float scale =
+            config_.resolution.enabled ? resolution_controller_.scale() : 1.f;
+        frame_stats_.resolution_scale = scale;
+
+        const auto timer_id = gpu_timer_.begin();
+        if (timer_id)
+            timed_scales_[*timer_id % timed_scales_.size()] = scale;
+
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        for (size_t i = 0; i < views_.size(); ++i) {
+            // Either one shared sort result or one per view
+            const size_t k = std::min(i, results.size() - 1);
+            const View v = {
+                .view = views_[i],
+                .buf_index = results.empty() ? buf_indices_[0] : buf_indices_[k],
+                .buf_chunk_runs = results.empty() ? buf_chunk_runs_[0] : buf_chunk_runs_[k],
+                .num_chunk_runs = results.empty() ? 0 : results[k].chunk_runs.size(),
+                .num_splats = results.empty() ? 0 : results[k].num_vertices(),
+            };
+            const int x = viewport[0] + static_cast<int>(i * intrinsics_.width);
+            const int y = viewport[1];
+            glViewport(x, y, intrinsics_.width, intrinsics_.height);
+
+            if (scale == 1.f) {
+                draw(v, intrinsics_, quality);
+                continue;
+            }
+
+            // Render to an offscreen target and upscale
+            const int width =
+                std::max(1, static_cast<int>(std::round(intrinsics_.width * scale)));
+            const int height =
+                std::max(1, static_cast<int>(std::round(intrinsics_.height * scale)));
+            scaled_target_.resize(width, height);
+
+            GLint prev_fbo;
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prev_fbo);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, scaled_target_.fbo());
+            const GLfloat clear_color[] = {0.f, 0.f, 0.f, 0.f};
+            glClearBufferfv(GL_COLOR, 0, clear_color);
+            glViewport(0, 0, width, height);
+
+            draw(v, camera::resized(intrinsics_, width, height), quality);
+
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prev_fbo);
+            glViewport(x, y, intrinsics_.width, intrinsics_.height);
+            scaled_target_.blit(x, y, intrinsics_.width, intrinsics_.height);
+        }
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+        if (timer_id)
+            gpu_timer_.end();
     }
 }
 
+void Renderer::wait_for_sort() const {
+    std::unique_lock lock(mutex_);
+    sorted_cv_.wait(lock, [&] { return sorted_generation_ == sort_generation_; });
+}
+
+FrameStats Renderer::frame_stats() const {
+    std::lock_guard lg(mutex_);
+    return frame_stats_;
+}
+
+void Renderer::delete_splats(const dataset::Box& box, bool inside) {
+    // Compact once this fraction of the splats is deleted
+    constexpr float COMPACTION_THRESHOLD = 0.25f;
+
+    std::lock_guard lg(mutex_);
+    // Would edit the scene that is about to be replaced
+    if (next_scene_) {
+        LOG_ERROR("not deleting splats, the next scene is not shown yet");
+        return;
+    }
+    const std::vector<dataset::IndexRange> ranges =
+        inside ? d_.delete_inside(box) : d_.delete_outside(box);
+    if (ranges.empty()) return;
+    dirty_ranges_.insert(dirty_ranges_.end(), ranges.begin(), ranges.end());
+    ++num_edits_;
+    ++occlusion_generation_;
+    invalidate_sort();
+
+    // Live updates index the splats as they are
+    if (!compacting_ && !live_ && live_updates_.empty()
+        && d_.num_deleted() > COMPACTION_THRESHOLD * d_.size())
+        start_compaction();
+}
+
+void Renderer::update_splats(size_t first, dataset::SplatBuffer&& splats) {
+    if (splats.empty()) return;
+    std::lock_guard lg(mutex_);
+    live_updates_.push_back({.first = first, .splats = std::move(splats), .deleted = {}});
+    // Drops a running compaction, it would change the indices
+    ++num_edits_;
+    ++occlusion_generation_;
+    invalidate_sort();
+}
+
+void Renderer::delete_range(dataset::IndexRange range) {
+    if (range.begin >= range.end) return;
+    std::lock_guard lg(mutex_);
+    live_updates_.push_back({.first = range.begin, .splats = {}, .deleted = range});
+    ++num_edits_;
+    ++occlusion_generation_;
+    invalidate_sort();
+}
+
+void Renderer::set_live() {
+    std::lock_guard lg(mutex_);
+    live_ = true;
+}
+
+void Renderer::save_ply(const std::string& source, const std::string& filename) const {
+    std::vector<uint32_t> rows;
+    {
+        std::lock_guard lg(mutex_);
+        if (live_ || !live_updates_.empty()) {
+            LOG_ERROR("not saving %s, %s lacks the live updates",
+                      filename.c_str(), source.c_str());
+            return;
+        }
+        // Callers pass the source of the scene they set last, `d_` is still
+        // the one before
+        if (next_scene_) {
+            LOG_ERROR("not saving %s, %s is not shown yet",
+                      filename.c_str(), source.c_str());
+            return;
+        }
+        rows = dataset::saved_rows(d_);
+    }
+    // Writing takes seconds for large scenes, neither rendering nor the
+    // sort wait for it
+    save_thread_ = std::jthread([rows = std::move(rows), source, filename] {
+        dataset::save_ply(rows, source, filename);
+        LOG_INFO("saved %s", filename.c_str());
+    });
+}
+
+void Renderer::set_scene(dataset::Dataset&& d, uint32_t ssbo_splats, bool recycle) {
+    std::lock_guard lg(mutex_);
+    // Replaced before it was shown
+    if (next_scene_)
+        release_ssbo(next_ssbo_splats_, next_ssbo_recycle_);
+    next_scene_.emplace(std::move(d));
+    next_ssbo_splats_ = ssbo_splats;
+    next_ssbo_recycle_ = recycle;
+    invalidate_sort();
+}
+
+std::vector<uint32_t> Renderer::recycled_buffers() {
+    std::lock_guard lg(mutex_);
+    return std::exchange(recycled_ssbos_, {});
+}
+
+void Renderer::release_ssbo(uint32_t ssbo, bool recycle) const {
+    if (recycle)
+        recycled_ssbos_.push_back(ssbo);
+    else
+        glDeleteBuffers(1, &ssbo);
+}
+
+void Renderer::upload_edits() const {
+    // Called with `mutex_` held. Clears the opacity of deleted splats, so that
+    // they disappear before the sort skips them.
+    // Only the opacities are written through the mapping, the host may not
+    // have the splats.
+    if (dirty_ranges_.empty()) return;
+    tracing::RecorderGuard tracing_guard("upload edits");
+    // The alpha is at the same offset in all layouts
+    const size_t splat_bytes = dataset::splat_size(ssbo_sh_degree_);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_splats_);
+    for (const dataset::IndexRange& range : dirty_ranges_) {
+        auto* splats = static_cast<char*>(glMapBufferRange(
+            GL_SHADER_STORAGE_BUFFER,
+            range.begin * splat_bytes,
+            (range.end - range.begin) * splat_bytes,
+            GL_MAP_WRITE_BIT));
+        if (!splats)
+            LOG_FATAL("could not map the splat buffer");
+        for (size_t i = range.begin; i < range.end; ++i) {
+            if (d_.deleted(i))
+                reinterpret_cast<dataset::Splat*>(
+                    splats + (i - range.begin) * splat_bytes)->alpha = 0.f;
+        }
+        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    dirty_ranges_.clear();
+}
+
+void Renderer::upload_live_updates() const {
+    // Called with `mutex_` held, while `ssbo_splats_` holds the layout the
+    // sort worker applied the updates to
+    if (live_uploads_.empty()) return;
+    tracing::RecorderGuard tracing_guard("upload live updates");
+    const size_t splat_bytes = dataset::splat_size(ssbo_sh_degree_);
+    size_t num_splats = ssbo_num_splats_;
+    for (const LiveUpdate& update : live_uploads_)
+        num_splats = std::max(num_splats, update.first + update.splats.size());
+
+    if (num_splats > ssbo_capacity_) {
+        // Grown geometrically, so that appending a few splats per update
+        // does not copy the whole scene every time
+        const size_t capacity = std::max(num_splats, ssbo_capacity_ + ssbo_capacity_ / 2);
+        check_ssbo_size(capacity * splat_bytes);
+        GLuint grown;
+        glGenBuffers(1, &grown);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity * splat_bytes, nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_READ_BUFFER, ssbo_splats_);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                            0, 0, ssbo_num_splats_ * splat_bytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        release_ssbo(ssbo_splats_, ssbo_recycle_);
+        ssbo_splats_ = grown;
+        ssbo_recycle_ = false;
+        ssbo_capacity_ = capacity;
+        splats_memory_.resize(capacity * splat_bytes);
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_splats_);
+    for (const LiveUpdate& update : live_uploads_) {
+        void* splats = glMapBufferRange(
+            GL_SHADER_STORAGE_BUFFER,
+            update.first * splat_bytes,
+            update.splats.size() * splat_bytes,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        if (!splats)
+            LOG_FATAL("could not map the splat buffer");
+        dataset::copy_splats(update.splats.data(), update.splats.size(), ssbo_sh_degree_, splats);
+        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    ssbo_num_splats_ = num_splats;
+    frame_stats_.num_live_updates += live_uploads_.size();
+    live_uploads_.clear();
+}
+
+void Renderer::start_compaction() {
+    // Called with `mutex_` held. `d_` is only replaced once `compacted_` is
+    // set, so the copy can be made without holding the lock.
+    compacting_ = true;
+    const uint64_t num_edits = num_edits_;
+    compaction_thread_ = std::jthread([this, num_edits] {
+        dataset::Dataset compacted = d_.compacted();
+        std::vector<dataset::IndexRange> live_ranges = d_.live_ranges();
+        std::lock_guard lg(mutex_);
+        compacted_.emplace(std::move(compacted));
+        compacted_live_ranges_ = std::move(live_ranges);
+        compacted_edits_ = num_edits;
+        invalidate_sort();
+    });
+}
+
+void Renderer::draw(const View& v, const CameraIntrinsics& c,
+                    const Quality& q) const {
+    if (config_.show_overdraw) {
+        const size_t num_pixels = static_cast<size_t>(
+            std::max(0.f, c.width) * std::max(0.f, c.height));
+        fragment_counts_.resize(num_pixels);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buf_fragment_counts_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER,
+                     num_pixels * sizeof(uint32_t), nullptr, GL_STREAM_READ);
+        overdraw_memory_.resize(num_pixels * sizeof(uint32_t));
+        const GLuint zero = 0;
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+                          GL_UNSIGNED_INT, &zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, buf_fragment_counts_);
+    }
+
+    switch (q.unsorted ? Backend::WeightedOit : config_.backend) {
+    case Backend::Quads:
+        draw_quads(v, c, q);
+        break;
+    case Backend::WeightedOit:
+        draw_oit(v, c, q);
+        break;
+    case Backend::Tiles:
+        // A chunk encoded sort of the quads, until the sort for the tiles is
+        // done
+        if (v.num_chunk_runs > 0) {
+            draw_quads(v, c, q);
+            break;
+        }
+        tile_renderer_.render({.projection = mat_projection_,
+                               .view = v.view,
+                               .intrinsics = c,
+                               .splat_sh_degree = ssbo_sh_degree_,
+                               .sh_degree = q.sh_degree,
+                               .opacity_exponent = q.opacity_exponent,
+                               .crop_mode = crop_mode(),
+                               .crop_min = config_.box_edit.box.min,
+                               .crop_max = config_.box_edit.box.max,
+                               .count_fragments = config_.show_overdraw},
+                              ssbo_splats_, v.buf_index, v.num_splats);
+        break;
+    }
+
+    if (config_.show_overdraw) {
+        draw_overdraw(c);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, 0);
+    }
+}
+
+void Renderer::draw_quads(const View& v, const CameraIntrinsics& c,
+                          const Quality& q) const {
+    tracing::RecorderGuard tracing_guard("draw");
+    program_ = &quad_program(q.sh_degree);
+    const QuadProgram& p = *program_;
+    use_program();
+    set_quad_uniforms(p, v, c, q);
+    glBindBuffer(GL_ARRAY_BUFFER, v.buf_index);
+    glVertexAttribIPointer(a_depth_index_, 1,
+                           v.num_chunk_runs > 0 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, 0, 0);
+    glUniform1i(p.u_num_chunk_runs, static_cast<GLint>(v.num_chunk_runs));
+    glUniform1i(p.u_base_instance, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, v.buf_chunk_runs);
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    // The masked path draws into its own target, at the origin
+    if (config_.early_termination)
+        glUniform2f(p.u_viewport_origin, 0.f, 0.f);
+    else
+        glUniform2f(p.u_viewport_origin, viewport[0], viewport[1]);
+    const bool record_occlusion = q.record_occlusion
+        && occlusion_recorder_.begin(static_cast<int>(c.width), static_cast<int>(c.height));
+    glUniform1i(p.u_record_occlusion, record_occlusion);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ssbo_splats_);
+    if (config_.early_termination)
+        draw_quads_masked(v.num_splats, c);
+    else
+        glDrawArraysInstanced(
+            GL_TRIANGLE_FAN, 0, 4, static_cast<GLsizei>(v.num_splats));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, 0);
+    if (record_occlusion) {
+        occlusion_recorder_.end(v.view, mat_projection_, uploaded_layout_,
+                                occlusion_generation_);
+        use_program();
+    }
+}
+
+void Renderer::set_quad_uniforms(const QuadProgram& p, const View& v,
+                                 const CameraIntrinsics& c, const Quality& q) const {
+    glUniformMatrix4fv(p.u_projection, 1, GL_FALSE, mat_projection_.data());
+    glUniformMatrix4fv(p.u_view, 1, GL_FALSE, v.view.data());
+    const Eigen::Vector3f cam_pos(v.view.inverse().block<3, 1>(0, 3));
+    glUniform3fv(p.u_cam_pos, 1, cam_pos.data());
+    glUniform1f(p.u_opacity_exponent, q.opacity_exponent);
+    glUniform1i(p.u_crop_mode, crop_mode());
+    glUniform3fv(p.u_crop_min, 1, config_.box_edit.box.min.data());
+    glUniform3fv(p.u_crop_max, 1, config_.box_edit.box.max.data());
+    glUniform2f(p.u_viewport, c.width, c.height);
+    glUniform2f(p.u_focal, c.fx, c.fy);
+    glUniform1i(p.u_count_fragments, config_.show_overdraw);
+}
+
+void Renderer::draw_oit(const View& v, const CameraIntrinsics& c,
+                        const Quality& q) const {
+    tracing::RecorderGuard tracing_guard("draw unsorted");
+    const int width = static_cast<int>(c.width);
+    const int height = static_cast<int>(c.height);
+    if (width <= 0 || height <= 0) return;
+    oit_target_.resize(width, height);
+
+    GLint prev_fbo;
+    GLint prev_viewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prev_fbo);
+    glGetIntegerv(GL_VIEWPORT, prev_viewport);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, oit_target_.fbo());
+    glViewport(0, 0, width, height);
+    const GLfloat zero[] = {0.f, 0.f, 0.f, 0.f};
+    const GLfloat one[] = {1.f, 1.f, 1.f, 1.f};
+    glClearBufferfv(GL_COLOR, 0, zero);
+    glClearBufferfv(GL_COLOR, 1, one);
+
+    // Sums the weighted colors, multiplies the transmittances
+    program_ = &quad_program(q.sh_degree, true);
+    const QuadProgram& p = *program_;
+    use_program();
+    set_quad_uniforms(p, v, c, q);
+    glUniform2f(p.u_viewport_origin, 0.f, 0.f);
+    glBlendFunci(0, GL_ONE, GL_ONE);
+    glBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+    // Not read by the storage order variant
+    glDisableVertexAttribArray(a_depth_index_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ssbo_splats_);
+    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, static_cast<GLsizei>(ssbo_num_splats_));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+    glEnableVertexAttribArray(a_depth_index_);
+    glBlendFuncSeparate(
+        GL_ONE_MINUS_DST_ALPHA,
+        GL_ONE,
+        GL_ONE_MINUS_DST_ALPHA,
+        GL_ONE);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prev_fbo);
+    glViewport(prev_viewport[0], prev_viewport[1], prev_viewport[2], prev_viewport[3]);
+    GLint prev_vao;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &prev_vao);
+    glUseProgram(program_oit_composite_);
+    glUniform1i(glGetUniformLocation(program_oit_composite_, "accum"), 0);
+    glUniform1i(glGetUniformLocation(program_oit_composite_, "revealage"), 1);
+    glUniform2i(glGetUniformLocation(program_oit_composite_, "origin"),
+                prev_viewport[0], prev_viewport[1]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, oit_target_.accum_texture());
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, oit_target_.revealage_texture());
+    glBindVertexArray(vao_fullscreen_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(prev_vao);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    use_program();
+}
+
+void Renderer::draw_quads_masked(size_t num_splats, const CameraIntrinsics& c) const {
+    const int width = static_cast<int>(c.width);
+    const int height = static_cast<int>(c.height);
+    if (width <= 0 || height <= 0) return;
+    target_.resize(width, height);
+
+    GLint prev_fbo;
+    GLint prev_viewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prev_fbo);
+    glGetIntegerv(GL_VIEWPORT, prev_viewport);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target_.fbo());
+    glViewport(0, 0, width, height);
+    const GLfloat clear_color[] = {0.f, 0.f, 0.f, 0.f};
+    const GLfloat clear_depth = 1.f;
+    // Clearing depth respects the depth mask
+    glDepthMask(GL_TRUE);
+    glClearBufferfv(GL_COLOR, 0, clear_color);
+    glClearBufferfv(GL_DEPTH, 0, &clear_depth);
+
+    // Splats are drawn at depth 0.5 without writing depth, the mask pass
+    // writes 0 where a pixel is saturated
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glDepthFunc(GL_LESS);
+
+    const size_t batch_size =
+        static_cast<size_t>(std::max(1, config_.early_termination_batch_size));
+    for (size_t first = 0; first < num_splats; first += batch_size) {
+        if (first > 0) {
+            tracing::RecorderGuard tracing_guard("saturation mask");
+            GLint prev_vao;
+            glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &prev_vao);
+            // Samples the color attachment, so draw into a framebuffer
+            // without it
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target_.depth_fbo());
+            glUseProgram(program_mask_);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, target_.color_texture());
+            glBindVertexArray(vao_fullscreen_);
+            glDepthFunc(GL_ALWAYS);
+            glDepthMask(GL_TRUE);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            glDepthMask(GL_FALSE);
+            glDepthFunc(GL_LESS);
+            glBindVertexArray(prev_vao);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target_.fbo());
+            use_program();
+        }
+        glUniform1i(program_->u_base_instance, static_cast<GLint>(first));
+        glDrawArraysInstancedBaseInstance(
+            GL_TRIANGLE_FAN, 0, 4,
+            static_cast<GLsizei>(std::min(batch_size, num_splats - first)),
+            static_cast<GLuint>(first));
+    }
+
+    glDepthMask(GL_TRUE);
+    glDisable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prev_fbo);
+    glViewport(prev_viewport[0], prev_viewport[1], prev_viewport[2], prev_viewport[3]);
+    target_.blit(prev_viewport[0], prev_viewport[1], width, height);
+}
+
+void Renderer::draw_overdraw(const CameraIntrinsics& c) const {
+    tracing::RecorderGuard tracing_guard("overdraw");
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    GLint prev_vao;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &prev_vao);
+    glUseProgram(program_overdraw_);
+    glUniform2f(glGetUniformLocation(program_overdraw_, "viewport"), c.width, c.height);
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glUniform2f(glGetUniformLocation(program_overdraw_, "viewport_origin"),
+                viewport[0], viewport[1]);
+    glBindVertexArray(vao_fullscreen_);
+    glDisable(GL_BLEND);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glEnable(GL_BLEND);
+    glBindVertexArray(prev_vao);
+    use_program();
+
+    // Stalls the pipeline, fine for a debug view
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buf_fragment_counts_);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                       fragment_counts_.size() * sizeof(uint32_t),
+                       fragment_counts_.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    uint64_t total = 0;
+    uint32_t max = 0;
+    for (const uint32_t count : fragment_counts_) {
+        total += count;
+        max = std::max(max, count);
+    }
+    frame_stats_.overdraw = {
+        .mean = fragment_counts_.empty()
+            ? 0.0 : static_cast<double>(total) / fragment_counts_.size(),
+        .max = max,
+    };
+}
+
+void Renderer::invalidate_sort() {
+    // Called with `mutex_` held
+    ++sort_generation_;
+    invalidated_time_ = Clock::now();
+    sort_cv_.notify_one();
+}
+
+bool Renderer::reduced_quality() const {
+    // Called with `mutex_` held
+    return config_.progressive.enabled
+        && still_frames_ < config_.progressive.still_frames;
+}
+
+bool Renderer::views_share_sort() const {
+    // Called with `mutex_` held
+    const float min_cos = std::cos(config_.max_shared_sort_angle_deg * M_PI / 180.f);
+    const Eigen::Vector3f forward = mat_view_.block<1, 3>(2, 0).transpose();
+    for (const Eigen::Matrix4f& view : views_) {
+        if (view.block<1, 3>(2, 0).dot(forward) < min_cos)
+            return false;
+    }
+    return true;
+}
+
+int Renderer::crop_mode() const {
+    // See `shaders/common.glsl`
+    const BoxEdit& edit = config_.box_edit;
+    return !edit.preview ? 0 : edit.inside ? 1 : 2;
+}
+
+Eigen::Matrix4f Renderer::predict_view(Clock::time_point t) const {
+    // Called with `mutex_` held. Extrapolates the motion over the recent
+    // history, a longer baseline smooths out frames without input events.
+    constexpr auto MAX_BASELINE = std::chrono::milliseconds(100);
+    // Do not extrapolate further than the observed motion
+    constexpr float MAX_EXTRAPOLATION = 2.f;
+
+    if (view_history_.size() < 2)
+        return mat_view_;
+    const ViewSample& latest = view_history_.back();
+    const auto oldest = std::find_if(
+        view_history_.begin(), view_history_.end(),
+        [&](const ViewSample& s) { return latest.time - s.time <= MAX_BASELINE; });
+    if (oldest == view_history_.end() || oldest->time == latest.time)
+        return mat_view_;
+
+    const float s = std::min(
+        std::chrono::duration<float>(t - latest.time).count()
+            / std::chrono::duration<float>(latest.time - oldest->time).count(),
+        MAX_EXTRAPOLATION);
+    return camera::extrapolate_view(oldest->view, latest.view, s);
+}
+
 void Renderer::sort_worker(std::stop_token stop) {
+    uint64_t sorted_generation = 0;
+    // The last sort used an extrapolated view, sort again once the camera
+    // comes to rest even if nothing changes anymore. Only with a new sample
+    // of the view, a stalled caller would sort the same prediction forever.
+    bool sorted_prediction = false;
+    Clock::time_point predicted_from;
+    Clock::duration sort_duration = Clock::duration::zero();
+    // The last sort culled with a buffer recorded from another view, which
+    // may have culled splats visible in this one. Sorted again with the next
+    // buffer.
+    std::shared_ptr<const occlusion::OcclusionBuffer> stale_occlusion;
+    std::vector<uint8_t> culled;
+
     while (!stop.stop_requested()) {
-        tracing::RecorderGuard tracing_guard("sort worker");
-        Eigen::Matrix4f P;
-        bool use_fast_sort;
+        // One per view if the views do not share a sort
+        std::vector<Eigen::Matrix4f> Ps;
+        dataset::SortOptions sort_options;
+        float cpu_budget;
+        bool chunked_indices;
+        uint64_t layout;
+        Clock::time_point requested;
+        Eigen::Matrix4f view;
+        std::shared_ptr<const occlusion::OcclusionBuffer> occlusion;
         {
-            std::lock_guard lg(mutex_);
-            P = mat_projection_ * mat_view_;
-            use_fast_sort = config_.use_fast_sort;
+            std::unique_lock lock(mutex_);
+            const bool woken = sort_cv_.wait(lock, stop, [&] {
+                return sort_generation_ != sorted_generation
+                    || (sorted_prediction && view_history_.back().time != predicted_from)
+                    || (stale_occlusion && occlusion_buffer_ != stale_occlusion)
+                    || (next_scene_ && !compacting_ && uploaded_layout_ == layout_);
+            });
+            if (!woken) return;
+
+            // Swapped in here, as nothing else reads `d_` without the lock.
+            // Waits for the previous layout to be uploaded, so that the
+            // displayed sort result always matches `ssbo_splats_` or `d_`.
+            if (compacted_ && uploaded_layout_ == layout_) {
+                // Not worth swapping in when the scene is replaced anyway
+                if (compacted_edits_ == num_edits_ && !next_scene_) {
+                    d_ = std::move(*compacted_);
+                    live_ranges_ = std::move(compacted_live_ranges_);
+                    ++layout_;
+                    dirty_ranges_.clear();
+                }
+                compacted_.reset();
+                compacting_ = false;
+            }
+            // Waits for a running compaction, which reads `d_`
+            if (next_scene_ && !compacting_ && uploaded_layout_ == layout_) {
+                d_ = std::move(*next_scene_);
+                next_scene_.reset();
+                scene_ssbo_splats_ = next_ssbo_splats_;
+                scene_ssbo_recycle_ = next_ssbo_recycle_;
+                ++layout_;
+                // Sorted the previous scene if it came too soon after that
+                ++sort_generation_;
+                dirty_ranges_.clear();
+                live_ = false;
+            }
+            // Once `ssbo_splats_` holds the layout of `d_`, `render` uploads
+            // them there
+            if (!live_updates_.empty() && !compacting_ && !next_scene_
+                && uploaded_layout_ == layout_) {
+                for (LiveUpdate& update : live_updates_) {
+                    if (update.splats.empty()) {
+                        const std::vector<dataset::IndexRange> ranges =
+                            d_.delete_range(update.deleted);
+                        dirty_ranges_.insert(dirty_ranges_.end(), ranges.begin(), ranges.end());
+                    } else if (update.first > d_.size()) {
+                        LOG_ERROR("live update from splat %zu of %zu skipped",
+                                  update.first, d_.size());
+                    } else {
+                        d_.update(update.first, update.splats);
+                        live_uploads_.push_back(std::move(update));
+                    }
+                }
+                live_updates_.clear();
+                live_ = true;
+            }
+            layout = layout_;
+            requested = invalidated_time_;
+
+            sorted_generation = sort_generation_;
+            view = mat_view_;
+            if (config_.predict_camera_motion)
+                view = predict_view(Clock::now() + sort_duration);
+            sorted_prediction = !view.isApprox(mat_view_);
+            if (!view_history_.empty())
+                predicted_from = view_history_.back().time;
+            if (views_share_sort()) {
+                Ps = {mat_projection_ * view};
+            } else {
+                // Each view moves along with the mean view
+                const Eigen::Matrix4f motion = mat_view_.inverse() * view;
+                Ps.clear();
+                for (const Eigen::Matrix4f& v : views_)
+                    Ps.push_back(mat_projection_ * v * motion);
+            }
+            sort_options = reduced_quality()
+                ? config_.progressive.sort_options : config_.sort_options;
+            cpu_budget = std::clamp(config_.sort_cpu_budget, 0.01f, 1.f);
+            // The tile renderer reads 32 bit indices
+            chunked_indices = config_.chunked_indices && config_.backend == Backend::Quads
+                && sort_options.key_bits <= 16;
+            // Only passes the layout on to `render`
+            if (config_.backend == Backend::WeightedOit) {
+                Ps.clear();
+                sorted_prediction = false;
+            }
+            // Recorded from this scene as it is now, with the views `render`
+            // records
+            if (config_.occlusion_culling && config_.backend == Backend::Quads
+                && views_.size() == 1 && occlusion_buffer_
+                && occlusion_buffer_->layout() == layout
+                && occlusion_buffer_->generation() == occlusion_generation_)
+                occlusion = occlusion_buffer_;
+            stale_occlusion =
+                occlusion && !occlusion->view().isApprox(view) ? occlusion : nullptr;
         }
+
+        tracing::RecorderGuard tracing_guard("sort worker");
+        const auto start = Clock::now();
+        size_t num_occluded = 0;
         {
             tracing::RecorderGuard tracing_guard("sort");
-            dataset::SortResult& sr = buffer_index_ == 0 ? sr1_ : sr0_;
-            d_.sort(P, &sr, use_fast_sort);
+            std::vector<dataset::SortResult>& results = sort_results_[(buffer_index_ + 1) % 2];
+            results.resize(Ps.size());
+            if (occlusion && !Ps.empty())
+                num_occluded = occlusion::cull(*occlusion, view, d_.centers(), d_.radii(), &culled);
+            for (size_t k = 0; k < Ps.size(); ++k) {
+                d_.sort(Ps[k], &results[k], sort_options, num_occluded > 0 ? &culled : nullptr);
+                if (chunked_indices)
+                    dataset::encode_chunks(&results[k]);
+            }
         }
         {
             std::lock_guard lg(mutex_);
             buffer_index_ = (buffer_index_ + 1) % 2;
+            sort_fractions_[buffer_index_] = std::clamp(sort_options.fraction, 0.f, 1.f);
+            sort_layouts_[buffer_index_] = layout;
+            sort_request_times_[buffer_index_] = requested;
+            frame_stats_.sort_ms =
+                std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            frame_stats_.num_occluded = num_occluded;
+            ++num_sorts_;
+            sorted_generation_ = sorted_generation;
+            size_t sort_bytes = culled.capacity();
+            for (const std::vector<dataset::SortResult>& r : sort_results_) {
+                for (const dataset::SortResult& result : r)
+                    sort_bytes += result.num_bytes();
+            }
+            sort_memory_.resize(sort_bytes);
+        }
+        sorted_cv_.notify_all();
+        const auto elapsed = Clock::now() - start;
+        // Smoothed, used as the prediction horizon
+        sort_duration = (3 * sort_duration + elapsed) / 4;
+
+        if (cpu_budget < 1.f) {
+            // Only interrupted when stopping
+            tracing::RecorderGuard tracing_guard("sort worker idle");
+            std::unique_lock lock(mutex_);
+            sort_cv_.wait_for(
+                lock, stop,
+                std::chrono::duration_cast<Clock::duration>(elapsed * (1.f / cpu_budget - 1.f)),
+                [] { return false; });
         }
         // tracing_guard.print();
     }
 }
 
+uint32_t splat_buffer(size_t num_splats, int sh_degree) {
+    const size_t data_num_bytes = dataset::splat_size(sh_degree) * num_splats;
+    check_ssbo_size(data_num_bytes);
+    GLuint ssbo;
+    glGenBuffers(1, &ssbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, data_num_bytes, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return ssbo;
+}
+
+dataset::Dataset load_ply(const std::string& filename,
+                          const dataset::LoadOptions& options,
+                          uint32_t* ssbo_splats) {
+    GLuint ssbo;
+    glGenBuffers(1, &ssbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    const auto allocate = [](size_t num_splats, int sh_degree) -> void* {
+        const size_t data_num_bytes = dataset::splat_size(sh_degree) * num_splats;
+        check_ssbo_size(data_num_bytes);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, data_num_bytes, nullptr, GL_STATIC_DRAW);
+        if (num_splats == 0) return nullptr;
+        void* data = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, data_num_bytes,
+                                      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (!data)
+            LOG_FATAL("could not map the splat buffer");
+        return data;
+    };
+    dataset::Dataset d = dataset::from_ply(filename, options, allocate);
+    // The contents are undefined if the mapping was lost, e.g. on a mode switch
+    if (d.size() > 0 && glUnmapBuffer(GL_SHADER_STORAGE_BUFFER) != GL_TRUE)
+        LOG_FATAL("splat buffer corrupted during upload");
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    *ssbo_splats = ssbo;
+    return d;
+}
+
 }
@@ -1,60 +1,402 @@
 #pragma once
 
+#include "camera.h"
 #include "dataset.h"
+#include "framebuffer.h"
+#include "gpu_timer.h"
+#include "memory.h"
+#include "occlusion.h"
+#include "resolution.h"
+#include "tile_render.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <optional>
 #include <thread>
 #include <mutex>
 
 namespace viewer::rendering {
-    struct CameraIntrinsics {
-        float fx;
-        float fy;
-        float width;
-        float height;
+    using camera::CameraIntrinsics;
+
+    enum class Backend {
+        // Instanced quads blended by the fixed-function pipeline
+        Quads,
+        // Compute shader tile rasterizer, see `tile_render.h`
+        Tiles,
+        // Instanced quads in storage order with weighted blended
+        // order-independent transparency. Needs no sort, but approximates
+        // the blending order by a weight that falls off with depth.
+        WeightedOit,
+    };
+
+    // Reduced workload while the camera moves, full quality once it rests
+    struct ProgressiveQuality {
+        bool enabled = false;
+        // Frames the view has to stay unchanged before switching to full
+        // quality, the full sort then runs in the background
+        int still_frames = 4;
+        // Used while moving, instead of the values in `RendererConfig` if
+        // those are higher
+        int sh_degree = 0;
+        // Draws a random subset of the splats, with the opacities raised to
+        // make up for the missing ones
+        dataset::SortOptions sort_options = {
+            .key_bits = 16,
+            .binning = dataset::DepthBinning::Linear,
+            .visible_range = true,
+            .fraction = 0.5f,
+        };
+
+        bool operator==(const ProgressiveQuality&) const = default;
+    };
+
+    // Deleting the splats inside or outside of a box, see
+    // `Renderer::delete_splats`
+    struct BoxEdit {
+        // Hide the splats the edit would delete, without deleting them
+        bool preview = false;
+        bool inside = true;
+        dataset::Box box = {
+            .min = Eigen::Vector3f::Constant(-1.f),
+            .max = Eigen::Vector3f::Constant(1.f),
+        };
+
+        bool operator==(const BoxEdit&) const = default;
     };
 
     struct RendererConfig {
-        bool use_fast_sort = true;
+        Backend backend = Backend::Quads;
+        // Quads only: draw the sorted splats in batches and mask the pixels
+        // that are saturated after each batch, so that the fragments of later
+        // splats are rejected there before shading
+        bool early_termination = false;
+        int early_termination_batch_size = 1 << 18;
+        // Until the first sort of the scene is done, draw it like
+        // `Backend::WeightedOit` instead of showing nothing
+        bool unsorted_preview = true;
+        // Quads with a single view only: leave the splats out of the sort
+        // that a recent frame drew behind opaque pixels, see `occlusion.h`
+        bool occlusion_culling = false;
+        // Quads only: upload the sort results as 16 bit indices relative to
+        // chunks of splats where the sort keeps the chunks in runs, see
+        // `dataset::encode_chunks`. Only tried with keys of up to 16 bits,
+        // wider ones interleave the chunks.
+        bool chunked_indices = false;
+        // Debug view: show a heatmap of the splat evaluations per pixel
+        // instead of the image
+        bool show_overdraw = false;
+        ResolutionScaling resolution;
+        dataset::SortOptions sort_options;
         int sh_degree = 3;
+        // Sort for the camera pose expected when the sort result gets
+        // displayed, extrapolated from the recent camera motion
+        bool predict_camera_motion = true;
+        // Fraction of a CPU core the sort worker may use, it idles between
+        // sorts accordingly
+        float sort_cpu_budget = 1.f;
+        ProgressiveQuality progressive;
+        // Several views share the sort of their mean view while their
+        // viewing directions are within this angle of it. Sorting by depth
+        // ignores translation, and splats a distance d apart can only swap
+        // if their depths differ by less than d * sin(angle). Views further
+        // apart are sorted separately.
+        float max_shared_sort_angle_deg = 2.f;
+        BoxEdit box_edit;
+
+        bool operator==(const RendererConfig&) const = default;
     };
     
+    struct OverdrawStats {
+        // Splat evaluations (fragment shader invocations or tile raster
+        // iterations) per pixel
+        double mean = 0.0;
+        uint32_t max = 0;
+    };
+
+    struct FrameStats {
+        // Of the splat rendering, measured a few frames late
+        double gpu_ms = 0.0;
+        // Render resolution relative to the window, per axis
+        float resolution_scale = 1.f;
+        // Only updated with `RendererConfig::show_overdraw`, of the last view
+        OverdrawStats overdraw;
+        // Rendered with the reduced workload of `ProgressiveQuality`
+        bool reduced_quality = false;
+        size_t num_deleted = 0;
+        // Left out of the latest sort by `RendererConfig::occlusion_culling`
+        size_t num_occluded = 0;
+        // Of the latest sort results uploaded, and whether they were chunk
+        // encoded
+        size_t index_bytes = 0;
+        bool chunked_indices = false;
+        // Live updates applied to the scene, see `Renderer::update_splats`
+        uint64_t num_live_updates = 0;
+        // Duration of the latest sort, and the time from the change of the
+        // view or config it sorted for until it was uploaded
+        double sort_ms = 0.0;
+        double sort_latency_ms = 0.0;
+    };
+
     class Renderer {
     public:
-        Renderer(const dataset::Dataset& d);
+        // Edits `d`, and replaces it by compacted copies, see `delete_splats`.
+        // Takes over `ssbo_splats` holding the splats of `d` if nonzero (see
+        // `load_ply`), uploads `d.buffer()` otherwise. See `set_scene` for
+        // `recycle`.
+        Renderer(dataset::Dataset& d, uint32_t ssbo_splats = 0, bool recycle = false);
         void use_program() const;
         void set_camera_intrinsics(const CameraIntrinsics& c);
         void set_view(const Eigen::Matrix4f& view);
+        // Renders one view per matrix, side by side from the lower left
+        // corner of the viewport, each of the size of the camera intrinsics
+        void set_views(const std::vector<Eigen::Matrix4f>& views);
         void set_config(const RendererConfig& config);
         void render() const;
+        // Blocks until the sort for the current views, projection and config
+        // is done, so that the next `render` shows it
+        void wait_for_sort() const;
+        FrameStats frame_stats() const;
+        // Deletes the splats inside or outside of the box. They disappear
+        // with the next frame, and the next sort skips them. Once a large
+        // part of the dataset is deleted, it is compacted in the background.
+        // Does nothing while a scene of `set_scene` is not shown yet.
+        void delete_splats(const dataset::Box& box, bool inside);
+        // Live updates, see `live.h`: overwrites the splats from `first` on,
+        // appending those past the end, or deletes splats. Applied with the
+        // next sort, only the changed splats are uploaded. Scenes receiving
+        // them keep their indices, they are not compacted, and cannot be
+        // saved.
+        void update_splats(size_t first, dataset::SplatBuffer&& splats);
+        void delete_range(dataset::IndexRange range);
+        // Treats the scene as receiving live updates before the first one
+        // arrives, so that it is neither compacted nor saved meanwhile
+        void set_live();
+        // See `dataset::save_ply`. Writes on a background thread, a save
+        // started before is waited for. Does nothing while a scene of
+        // `set_scene` is not shown yet, `source` being that of the new one.
+        void save_ply(const std::string& source, const std::string& filename) const;
+        // Replaces the dataset by `d`, with its splats in `ssbo_splats` (see
+        // `load_ply`). The previous scene is shown until the first sort of
+        // the new one is done, then both are swapped in the same frame. With
+        // `recycle`, `ssbo_splats` is handed back by `recycled_buffers` once
+        // it is replaced instead of being deleted, e.g. to decode the next
+        // frames of a sequence into it.
+        void set_scene(dataset::Dataset&& d, uint32_t ssbo_splats, bool recycle = false);
+        // Buffers of `set_scene` with `recycle` that are not used anymore.
+        // Commands using them may still be pending in this context.
+        std::vector<uint32_t> recycled_buffers();
     private:
+        using Clock = std::chrono::steady_clock;
+
+        struct ViewSample {
+            Clock::time_point time;
+            Eigen::Matrix4f view;
+        };
+
+        // One of the views of a frame
+        struct View {
+            Eigen::Matrix4f view;
+            uint32_t buf_index;
+            // Chunk runs of a 16 bit `buf_index`, 0 for 32 bit indices
+            uint32_t buf_chunk_runs;
+            size_t num_chunk_runs;
+            size_t num_splats;
+        };
+
+        // See `update_splats`, deletes `deleted` if `splats` is empty
+        struct LiveUpdate {
+            size_t first;
+            dataset::SplatBuffer splats;
+            dataset::IndexRange deleted;
+        };
+
+        // Shading settings of one frame
+        struct Quality {
+            int sh_degree;
+            // See `shaders/common.glsl`
+            float opacity_exponent;
+            // All splats in storage order, see `Backend::WeightedOit`
+            bool unsorted;
+            // Record the opaque depths for occlusion culling
+            bool record_occlusion;
+        };
+
+        // Instanced quad program, specialized for a splat layout and a
+        // shading degree, see `sh_variant_defines`
+        struct QuadProgram {
+            uint32_t program;
+            int32_t u_projection;
+            int32_t u_viewport;
+            int32_t u_focal;
+            int32_t u_view;
+            int32_t u_cam_pos;
+            int32_t u_opacity_exponent;
+            int32_t u_count_fragments;
+            int32_t u_record_occlusion;
+            int32_t u_num_chunk_runs;
+            int32_t u_base_instance;
+            int32_t u_viewport_origin;
+            int32_t u_crop_mode;
+            int32_t u_crop_min;
+            int32_t u_crop_max;
+        };
+
+        // For the layout of `ssbo_splats_`, compiled on first use. The
+        // storage order variant draws instance i from splat i.
+        const QuadProgram& quad_program(int sh_degree, bool storage_order = false) const;
         void sort_worker(std::stop_token stop);
+        Eigen::Matrix4f predict_view(Clock::time_point t) const;
+        void invalidate_sort();
+        bool reduced_quality() const;
+        bool views_share_sort() const;
+        int crop_mode() const;
+        void upload_edits() const;
+        void upload_live_updates() const;
+        // Deletes `ssbo` or, if `recycle`, keeps it for `recycled_buffers`
+        void release_ssbo(uint32_t ssbo, bool recycle) const;
+        void start_compaction();
+        void draw(const View& v, const CameraIntrinsics& c, const Quality& q) const;
+        void draw_quads(const View& v, const CameraIntrinsics& c, const Quality& q) const;
+        void draw_quads_masked(size_t num_splats, const CameraIntrinsics& c) const;
+        void draw_overdraw(const CameraIntrinsics& c) const;
+        void draw_oit(const View& v, const CameraIntrinsics& c, const Quality& q) const;
+        // All but `viewport_origin`
+        void set_quad_uniforms(const QuadProgram& p, const View& v,
+                               const CameraIntrinsics& c, const Quality& q) const;
     private:
-        const dataset::Dataset& d_;
+        dataset::Dataset& d_;
         
-        uint32_t program_;
-        int32_t u_projection_;
-        int32_t u_viewport_;
-        int32_t u_focal_;
-        int32_t u_view_;
-        int32_t u_cam_pos_;
-        int32_t u_sh_degree_;
+        // SH degree of the splat layout in `ssbo_splats_`
+        mutable int ssbo_sh_degree_;
+        // Indexed by `storage_order * 16 + ssbo_sh_degree_ * 4 + sh_degree`
+        mutable std::array<std::optional<QuadProgram>, 32> quad_programs_;
+        // Of the latest draw
+        mutable const QuadProgram* program_;
+        int32_t a_depth_index_;
 
         std::array<float, 8> triangle_vertices_;
 
-        uint32_t ssbo_splats_;
+        mutable uint32_t ssbo_splats_;
+        mutable bool ssbo_recycle_;
+        mutable size_t ssbo_num_splats_;
+        // Splats `ssbo_splats_` has room for, more than its splats once live
+        // updates appended some
+        mutable size_t ssbo_capacity_;
         uint32_t buf_vertex_;
-        uint32_t buf_index_;
+        // One per sort result
+        mutable std::vector<uint32_t> buf_indices_;
+        mutable std::vector<uint32_t> buf_chunk_runs_;
+        mutable memory::Allocation splats_memory_{memory::Subsystem::GpuSplats};
+        mutable std::vector<memory::Allocation> indices_memory_;
+        mutable memory::Allocation overdraw_memory_{memory::Subsystem::GpuFramebuffers};
+        memory::Allocation sort_memory_{memory::Subsystem::SortResults};
+
+        uint32_t program_mask_;
+        uint32_t program_overdraw_;
+        uint32_t program_oit_composite_;
+        // The full screen passes have no vertex attributes
+        uint32_t vao_fullscreen_;
+        uint32_t buf_fragment_counts_;
+        mutable std::vector<uint32_t> fragment_counts_;
+        mutable Framebuffer scaled_target_;
+        mutable GpuTimer gpu_timer_;
+        mutable ResolutionController resolution_controller_;
+        // Resolution scale of the frames in flight in `gpu_timer_`
+        mutable std::array<float, GpuTimer::NUM_QUERIES> timed_scales_;
+        mutable FrameStats frame_stats_;
+        mutable Framebuffer target_;
+        mutable OitTarget oit_target_;
+        mutable TileRenderer tile_renderer_;
+        mutable occlusion::OcclusionRecorder occlusion_recorder_;
+        // Latest recording, for the sort worker
+        mutable std::shared_ptr<const occlusion::OcclusionBuffer> occlusion_buffer_;
+        // Changed by edits and by config changes that may change which
+        // pixels become opaque. Recordings of other generations are not
+        // culled with, like those of other layouts.
+        uint64_t occlusion_generation_ = 0;
 
+        CameraIntrinsics intrinsics_;
         Eigen::Matrix4f mat_projection_;
+        std::vector<Eigen::Matrix4f> views_;
+        // Mean of `views_`, sorted for and extrapolated
         Eigen::Matrix4f mat_view_;
         RendererConfig config_;
+        std::deque<ViewSample> view_history_;
+        // Consecutive frames with an unchanged view
+        int still_frames_ = 0;
+
+        // Index of the sort result to display, and the number of sorts done
+        // and uploaded. Two sorts can finish between frames, so the index
+        // alone does not tell whether the upload is stale.
+        mutable size_t buffer_index_ = 0;
+        mutable uint64_t num_sorts_ = 0;
+        mutable uint64_t num_sorts_uploaded_ = 0;
+        // Double buffered, one result shared by all views or one per view
+        mutable std::array<std::vector<dataset::SortResult>, 2> sort_results_;
+        // `SortOptions::fraction` of `sort_results_`
+        std::array<float, 2> sort_fractions_ = {1.f, 1.f};
 
-        mutable size_t prev_buffer_index_;
-        mutable size_t buffer_index_;
-        mutable dataset::SortResult sr0_;
-        mutable dataset::SortResult sr1_;
+        // Incremented whenever `d_` is replaced by a compacted copy, the
+        // sort results and `ssbo_splats_` index one of these layouts
+        uint64_t layout_ = 0;
+        std::array<uint64_t, 2> sort_layouts_ = {0, 0};
+        mutable uint64_t uploaded_layout_ = 0;
+        // Deleted splats not yet cleared in `ssbo_splats_`
+        mutable std::vector<dataset::IndexRange> dirty_ranges_;
+        uint64_t num_edits_ = 0;
+        bool compacting_ = false;
+        std::optional<dataset::Dataset> compacted_;
+        // `num_edits_` when the compaction started, edits made since are
+        // missing from `compacted_`
+        uint64_t compacted_edits_ = 0;
+        // Live splats of the previous layout, copied into the new
+        // `ssbo_splats_` once the compacted layout is displayed
+        std::vector<dataset::IndexRange> compacted_live_ranges_;
+        mutable std::vector<dataset::IndexRange> live_ranges_;
+        // Scene of `set_scene` until the sort worker swaps it into `d_`, and
+        // its splats until the new layout is displayed
+        std::optional<dataset::Dataset> next_scene_;
+        uint32_t next_ssbo_splats_ = 0;
+        mutable uint32_t scene_ssbo_splats_ = 0;
+        bool next_ssbo_recycle_ = false;
+        mutable bool scene_ssbo_recycle_ = false;
+        mutable std::vector<uint32_t> recycled_ssbos_;
+        // Live updates until the sort worker applies them to `d_`, and those
+        // applied until `render` uploads them to `ssbo_splats_`
+        std::vector<LiveUpdate> live_updates_;
+        mutable std::vector<LiveUpdate> live_uploads_;
+        // `d_` received live updates
+        bool live_ = false;
 
         mutable std::mutex mutex_;
+        // Signals the sort worker that the view, projection or config
+        // changed, a new occlusion buffer arrived or the scene before a new
+        // one was uploaded
+        mutable std::condition_variable_any sort_cv_;
+        uint64_t sort_generation_ = 0;
+        // Of the latest `invalidate_sort`, and of the one each of
+        // `sort_results_` sorted for
+        Clock::time_point invalidated_time_;
+        std::array<Clock::time_point, 2> sort_request_times_;
+        // Generation of the latest finished sort
+        uint64_t sorted_generation_ = 0;
+        mutable std::condition_variable_any sorted_cv_;
         std::jthread thread_;
+        std::jthread compaction_thread_;
+        mutable std::jthread save_thread_;
     };
+
+    // Loads a scene for `Renderer` without a copy of the splats on the host:
+    // they are decoded straight into a mapped shader storage buffer, returned
+    // in `ssbo_splats`. Needs a current GL context.
+    dataset::Dataset load_ply(const std::string& filename,
+                              const dataset::LoadOptions& options,
+                              uint32_t* ssbo_splats);
+
+    // Shader storage buffer with room for `num_splats` of
+    // `SplatT<sh_degree>`, to be filled for `Renderer::set_scene`. Needs a
+    // current GL context.
+    uint32_t splat_buffer(size_t num_splats, int sh_degree);
 }
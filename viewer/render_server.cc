@@ -0,0 +1,349 @@
+#include "camera.h"
+#include "dataset.h"
+#include "framebuffer.h"
+#include "image.h"
+#include "logging.h"
+#include "render.h"
+#include "net.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include <cxxopts.hpp>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+// Keeps a scene and the renderer resident and renders camera requests from
+// clients over a Unix domain socket or localhost TCP.
+//
+// Requests arriving while a batch renders are batched: requests with the same
+// image size and field of view are rendered side by side as views of one
+// frame, sharing one sort if their viewing directions are close (see
+// `RendererConfig::max_shared_sort_angle_deg`), and duplicate poses are
+// rendered once. A pose unchanged since the previous frame reuses its sort.
+//
+// Protocol, one request per line:
+//
+//   render <width> <height> <fov_deg> <ppm|png> <view matrix, 16 numbers, row-major>
+//
+// answered by `ok <num_bytes>\n` followed by the encoded image, or by
+// `error <message>\n`.
+
+namespace {
+
+using namespace viewer;
+
+constexpr int MAX_IMAGE_SIZE = 8192;
+// A request is a few hundred bytes, longer lines close the connection
+constexpr size_t MAX_LINE_LENGTH = 4096;
+
+struct Request {
+    int width;
+    int height;
+    float fov_deg;
+    std::string format;
+    Eigen::Matrix4f view;
+    std::promise<std::string> response;
+};
+
+class RequestQueue {
+public:
+    std::future<std::string> push(Request&& request) {
+        std::future<std::string> response = request.response.get_future();
+        {
+            std::lock_guard lg(mutex_);
+            requests_.push_back(std::move(request));
+        }
+        cv_.notify_one();
+        return response;
+    }
+
+    // Blocks until a request is pending, returns up to `max_requests`
+    std::vector<Request> pop_batch(size_t max_requests) {
+        std::unique_lock lock(mutex_);
+        cv_.wait(lock, [&] { return !requests_.empty(); });
+        std::vector<Request> batch;
+        while (!requests_.empty() && batch.size() < max_requests) {
+            batch.push_back(std::move(requests_.front()));
+            requests_.pop_front();
+        }
+        return batch;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Request> requests_;
+};
+
+std::optional<Request> parse_request(const std::string& line, std::string* error) {
+    std::istringstream in(line);
+    std::string command;
+    Request request;
+    in >> command >> request.width >> request.height >> request.fov_deg >> request.format;
+    for (int row = 0; row < 4; ++row)
+        for (int col = 0; col < 4; ++col)
+            in >> request.view(row, col);
+
+    if (command != "render") {
+        *error = "unknown command";
+        return std::nullopt;
+    }
+    if (in.fail()) {
+        *error = "expected: render <width> <height> <fov_deg> <ppm|png> <16 numbers>";
+        return std::nullopt;
+    }
+    if (request.width <= 0 || request.width > MAX_IMAGE_SIZE
+        || request.height <= 0 || request.height > MAX_IMAGE_SIZE) {
+        *error = "invalid image size";
+        return std::nullopt;
+    }
+    if (!(request.fov_deg > 0.f && request.fov_deg < 180.f)) {
+        *error = "invalid field of view";
+        return std::nullopt;
+    }
+    if (request.format != "ppm" && request.format != "png") {
+        *error = "unknown image format";
+        return std::nullopt;
+    }
+    return request;
+}
+
+void serve_connection(int fd, RequestQueue* queue) {
+    std::string buffer;
+    char chunk[4096];
+    while (true) {
+        size_t newline;
+        while ((newline = buffer.find('\n')) == std::string::npos) {
+            const ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) {
+                close(fd);
+                return;
+            }
+            buffer.append(chunk, n);
+            if (buffer.size() > MAX_LINE_LENGTH && buffer.find('\n') == std::string::npos) {
+                net::send_all(fd, "error request too long\n");
+                close(fd);
+                return;
+            }
+        }
+        const std::string line = buffer.substr(0, newline);
+        buffer.erase(0, newline + 1);
+
+        std::string error;
+        std::optional<Request> request = parse_request(line, &error);
+        const std::string response = request
+            ? queue->push(std::move(*request)).get()
+            : "error " + error + "\n";
+        if (!net::send_all(fd, response)) break;
+    }
+    close(fd);
+}
+
+// Renders `views` side by side and returns one image per view
+std::vector<image::Image> render_views(rendering::Renderer& r,
+                                       rendering::Framebuffer* target,
+                                       const std::vector<Eigen::Matrix4f>& views,
+                                       int width, int height, float fov_deg) {
+    const int num_views = views.size();
+    target->resize(num_views * width, height);
+    glBindFramebuffer(GL_FRAMEBUFFER, target->fbo());
+    glViewport(0, 0, num_views * width, height);
+    const GLfloat clear_color[] = {0.f, 0.f, 0.f, 0.f};
+    glClearBufferfv(GL_COLOR, 0, clear_color);
+
+    r.use_program();
+    r.set_camera_intrinsics(camera::from_fov(fov_deg, width, height));
+    r.set_views(views);
+    r.wait_for_sort();
+    r.render();
+
+    std::vector<image::Image> images(num_views);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    std::vector<uint8_t> rows(3 * static_cast<size_t>(width) * height);
+    for (int i = 0; i < num_views; ++i) {
+        glReadPixels(i * width, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, rows.data());
+        image::Image& image = images[i];
+        image.width = width;
+        image.height = height;
+        image.rgb.resize(rows.size());
+        // GL's first row is the bottom one
+        const size_t row_size = 3 * static_cast<size_t>(width);
+        for (int y = 0; y < height; ++y)
+            std::copy_n(rows.data() + (height - 1 - y) * row_size, row_size,
+                        image.rgb.data() + y * row_size);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return images;
+}
+
+void render_batch(rendering::Renderer& renderer,
+                  rendering::Framebuffer* target,
+                  std::vector<Request>* batch,
+                  int max_framebuffer_width) {
+    // Requests that can share a frame
+    std::map<std::tuple<int, int, float>, std::vector<Request*>> groups;
+    for (Request& request : *batch)
+        groups[{request.width, request.height, request.fov_deg}].push_back(&request);
+
+    for (auto& [key, requests] : groups) {
+        const auto [width, height, fov_deg] = key;
+
+        // Duplicate poses are rendered once
+        std::vector<Eigen::Matrix4f> views;
+        std::vector<size_t> view_indices;
+        for (const Request* request : requests) {
+            const auto it = std::find(views.begin(), views.end(), request->view);
+            view_indices.push_back(it - views.begin());
+            if (it == views.end())
+                views.push_back(request->view);
+        }
+
+        const size_t max_views = std::max(1, max_framebuffer_width / width);
+        std::vector<image::Image> images;
+        for (size_t first = 0; first < views.size(); first += max_views) {
+            const std::vector<Eigen::Matrix4f> frame_views(
+                views.begin() + first,
+                views.begin() + std::min(views.size(), first + max_views));
+            auto frame_images =
+                render_views(renderer, target, frame_views, width, height, fov_deg);
+            std::move(frame_images.begin(), frame_images.end(), std::back_inserter(images));
+        }
+
+        for (size_t i = 0; i < requests.size(); ++i) {
+            const image::Image& image = images[view_indices[i]];
+            const std::string encoded = requests[i]->format == "png"
+                ? image::encode_png(image) : image::encode_ppm(image);
+            requests[i]->response.set_value(
+                "ok " + std::to_string(encoded.size()) + "\n" + encoded);
+        }
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    cxxopts::Options options(argv[0], "3D Gaussian Splat Render Server");
+    // clang-format off
+    options
+        .positional_help("file.ply")
+        .add_options()
+            ("h,help", "print this help message")
+            ("socket", "Unix domain socket to listen on",
+             cxxopts::value<std::string>()->default_value("/tmp/splatview.sock"))
+            ("port", "listen on this localhost TCP port instead of the socket",
+             cxxopts::value<int>()->default_value("0"))
+            ("max-batch", "maximum number of requests rendered together",
+             cxxopts::value<int>()->default_value("16"))
+            ("readahead", "read ahead sequentially while loading (for slow storage)")
+            ("sh-degree", "highest spherical harmonics degree to load (0-3, lower needs less memory)",
+             cxxopts::value<int>()->default_value("3"))
+            ("splat-order", "order of the splats in memory: file, morton or hilbert (spatially coherent, faster to draw)",
+             cxxopts::value<std::string>()->default_value("file"))
+            ("cache-order", "keep the splat order in <file>.order for the next load")
+            ("positional", "", cxxopts::value<std::vector<std::string>>());
+    // clang-format on
+
+    options.parse_positional({"positional"});
+    auto parsed_options = options.parse(argc, argv);
+
+    if (parsed_options.count("help") || parsed_options.count("positional") == 0 ||
+        parsed_options["positional"].as<std::vector<std::string>>().size() != 1) {
+        std::cout << options.help() << std::endl;
+        return -1;
+    }
+
+    const std::string ply_file_name =
+        parsed_options["positional"].as<std::vector<std::string>>().at(0);
+    const std::optional<dataset::SplatOrder> splat_order =
+        dataset::parse_splat_order(parsed_options["splat-order"].as<std::string>());
+    if (!splat_order)
+        LOG_FATAL("unknown splat order, expected file, morton or hilbert");
+    const dataset::LoadOptions load_options{
+        .readahead = parsed_options.count("readahead") == 1,
+        .sh_degree = parsed_options["sh-degree"].as<int>(),
+        .order = *splat_order,
+        .cache_order = parsed_options.count("cache-order") == 1,
+    };
+    if (!glfwInit()) {
+        LOG_ERROR("GLFW init failed");
+        return -1;
+    }
+
+    // Only for the GL context, everything renders offscreen
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* window = glfwCreateWindow(64, 64, argv[0], NULL, NULL);
+    if (!window) {
+        LOG_ERROR("GLFW window creation failed");
+        glfwTerminate();
+        return -1;
+    }
+
+    glfwMakeContextCurrent(window);
+
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+        LOG_ERROR("GLAD init failed");
+        glfwTerminate();
+        return -1;
+    }
+
+    // Decoded straight into GPU memory, after the context exists
+    LOG_INFO("loading %s...", ply_file_name.c_str());
+    uint32_t ssbo_splats;
+    dataset::Dataset d = rendering::load_ply(ply_file_name, load_options, &ssbo_splats);
+    LOG_INFO("done");
+
+    rendering::Renderer renderer(d, ssbo_splats);
+    rendering::RendererConfig config;
+    // Every request is a still frame
+    config.predict_camera_motion = false;
+    renderer.use_program();
+    renderer.set_config(config);
+    rendering::Framebuffer target;
+
+    GLint max_texture_size;
+    GLint max_viewport_dims[2];
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+    glGetIntegerv(GL_MAX_VIEWPORT_DIMS, max_viewport_dims);
+    const int max_framebuffer_width = std::min(max_texture_size, max_viewport_dims[0]);
+
+    const int port = parsed_options["port"].as<int>();
+    const std::string socket_path = parsed_options["socket"].as<std::string>();
+    const int listen_fd = net::listen_on(socket_path, port);
+    if (port > 0)
+        LOG_INFO("listening on localhost:%d", port);
+    else
+        LOG_INFO("listening on %s", socket_path.c_str());
+
+    RequestQueue queue;
+    std::jthread acceptor([&] {
+        while (true) {
+            const int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) {
+                LOG_ERROR("accept: %s", strerror(errno));
+                continue;
+            }
+            std::thread(serve_connection, fd, &queue).detach();
+        }
+    });
+
+    const size_t max_batch = std::max(1, parsed_options["max-batch"].as<int>());
+    while (true) {
+        std::vector<Request> batch = queue.pop_batch(max_batch);
+        render_batch(renderer, &target, &batch, max_framebuffer_width);
+    }
+}
@@ -0,0 +1,31 @@
+#include "resolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace viewer::rendering {
+
+namespace {
+
+// Scales are multiples of this, so that render targets are only reallocated
+// when the scale changes noticeably
+constexpr float SCALE_STEP = 1.f / 32.f;
+
+}
+
+float ResolutionController::update(const ResolutionScaling& s, double ms, float scale) {
+    const double full_ms = ms / (static_cast<double>(scale) * scale);
+    full_ms_ = full_ms_ == 0.0 ? full_ms : 0.8 * full_ms_ + 0.2 * full_ms;
+
+    const float min_scale = std::min(s.min_scale, s.max_scale);
+    const float desired = std::clamp(
+        static_cast<float>(std::sqrt(s.target_ms / full_ms_)), min_scale, s.max_scale);
+    // Drop immediately when missing the target, but only go up again with
+    // a step of headroom to avoid oscillating between two scales
+    if (desired < scale_ || desired >= scale_ + SCALE_STEP)
+        scale_ = std::floor(desired / SCALE_STEP) * SCALE_STEP;
+    scale_ = std::clamp(scale_, min_scale, s.max_scale);
+    return scale_;
+}
+
+}
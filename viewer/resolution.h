@@ -0,0 +1,33 @@
+#pragma once
+
+namespace viewer::rendering {
+
+struct ResolutionScaling {
+    // Render at a lower resolution when needed to hold `target_ms`, and
+    // upscale to the window
+    bool enabled = false;
+    // GPU time per frame to aim for
+    float target_ms = 16.6f;
+    // Per axis
+    float min_scale = 0.25f;
+    float max_scale = 1.f;
+
+    bool operator==(const ResolutionScaling&) const = default;
+};
+
+// Picks the render resolution scale from measured GPU frame times, assuming
+// that the cost is proportional to the number of pixels
+class ResolutionController {
+public:
+    // `ms`: GPU time of a frame rendered at `scale`. Returns the scale for the
+    // following frames.
+    float update(const ResolutionScaling& s, double ms, float scale);
+    float scale() const { return scale_; }
+
+private:
+    float scale_ = 1.f;
+    // Smoothed GPU time at scale 1
+    double full_ms_ = 0.0;
+};
+
+}
@@ -0,0 +1,530 @@
+#include "sequence.h"
+#include "logging.h"
+#include "parallel.h"
+#include "render.h"
+#include "tracing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace viewer::sequence {
+
+namespace {
+
+constexpr char MAGIC[8] = {'S', 'P', 'L', 'A', 'T', 'S', 'E', 'Q'};
+constexpr uint32_t VERSION = 1;
+
+// Followed by a `FrameEntry` per frame
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t sh_degree;
+    uint64_t num_splats;
+    uint64_t num_frames;
+    float fps;
+    uint32_t block_size;
+};
+
+// A frame starts with the offsets of its blocks relative to the frame and
+// the end of the last one, `uint64_t` each
+struct FrameEntry {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t keyframe;
+    uint32_t reserved;
+};
+
+// The shown one, the next one being sorted and one being decoded
+constexpr size_t MIN_RING_SIZE = 3;
+
+// Splats decoded at once before they are written to the GPU buffer
+constexpr size_t DECODE_BATCH_SIZE = 256;
+
+size_t num_blocks(size_t num_splats) {
+    return (num_splats + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+// Change masks of a delta block, padded so that the values are aligned
+size_t masks_bytes(size_t num_splats) {
+    return (num_splats + 3) / 4 * 4;
+}
+
+// Copies the values of `attribute` at degree `from_degree` into the
+// parameters `to` of a splat at `to_degree`, keeping the coefficients both
+// have
+void copy_attribute(Attribute attribute, const float* from, int from_degree,
+                    float* to, int to_degree) {
+    const ParamRange to_range = param_range(attribute, to_degree);
+    if (attribute != Attribute::ViewDependentColor) {
+        std::copy_n(from, to_range.size, to + to_range.first);
+        return;
+    }
+    // Channel by channel
+    const int from_rest = param_range(attribute, from_degree).size / 3;
+    const int to_rest = to_range.size / 3;
+    for (int c = 0; c < 3; ++c) {
+        std::copy_n(from + c * from_rest, std::min(from_rest, to_rest),
+                    to + to_range.first + c * to_rest);
+    }
+}
+
+// Appends `block` for splats [begin, end) of `params`, updating `decoded`
+// (as the decoder holds them) and counting the changed attributes
+void encode_block(const std::vector<float>& params, size_t begin, size_t end,
+                  int sh_degree, bool keyframe, float tolerance,
+                  std::vector<float>* decoded, std::string* block,
+                  std::array<size_t, NUM_ATTRIBUTES>* changed) {
+    const size_t num_params = dataset::num_splat_params(sh_degree);
+    const auto append = [&](const float* values, size_t n) {
+        block->append(reinterpret_cast<const char*>(values), n * sizeof(float));
+    };
+    if (keyframe) {
+        append(&params[begin * num_params], (end - begin) * num_params);
+        std::copy(params.begin() + begin * num_params, params.begin() + end * num_params,
+                  decoded->begin() + begin * num_params);
+        return;
+    }
+
+    block->resize(masks_bytes(end - begin));
+    for (size_t i = begin; i < end; ++i) {
+        uint8_t mask = 0;
+        for (int a = 0; a < NUM_ATTRIBUTES; ++a) {
+            const ParamRange range = param_range(static_cast<Attribute>(a), sh_degree);
+            const float* value = &params[i * num_params + range.first];
+            float* previous = &(*decoded)[i * num_params + range.first];
+            bool same = true;
+            for (int k = 0; k < range.size; ++k)
+                same &= std::abs(value[k] - previous[k]) <= tolerance;
+            if (same) continue;
+            mask |= 1 << a;
+            ++(*changed)[a];
+            append(value, range.size);
+            std::copy_n(value, range.size, previous);
+        }
+        (*block)[i - begin] = static_cast<char>(mask);
+    }
+}
+
+}
+
+ParamRange param_range(Attribute attribute, int sh_degree) {
+    const int num_rest = 3 * (dataset::num_sh_coeffs(sh_degree) - 1);
+    switch (attribute) {
+    case Attribute::Position: return {0, 3};
+    case Attribute::BaseColor: return {3, 3};
+    case Attribute::ViewDependentColor: return {6, num_rest};
+    case Attribute::Opacity: return {6 + num_rest, 1};
+    case Attribute::Scale: return {7 + num_rest, 3};
+    case Attribute::Rotation: return {10 + num_rest, 4};
+    case Attribute::Count: break;
+    }
+    return {0, 0};
+}
+
+EncodeStats encode(const std::vector<std::string>& frames, const std::string& filename,
+                   const EncodeOptions& options) {
+    tracing::RecorderGuard tracing_guard("encode sequence");
+    if (frames.empty())
+        LOG_FATAL("no frames to encode");
+    std::ofstream out(filename, std::ios::binary);
+    if (!out)
+        LOG_FATAL("could not open %s", filename.c_str());
+
+    // Filled in once the frames are written
+    FileHeader header = {};
+    std::vector<FrameEntry> table(frames.size());
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(FrameEntry));
+
+    EncodeStats stats;
+    stats.num_frames = frames.size();
+    int sh_degree = 0;
+    // The parameters of the previous frame as the decoder holds them
+    std::vector<float> decoded;
+    std::array<size_t, NUM_ATTRIBUTES> changed = {};
+    size_t num_delta_frames = 0;
+    for (size_t f = 0; f < frames.size(); ++f) {
+        int frame_sh_degree;
+        const std::vector<float> params = dataset::read_splat_params(frames[f], &frame_sh_degree);
+        const size_t num_params = dataset::num_splat_params(frame_sh_degree);
+        if (f == 0) {
+            sh_degree = frame_sh_degree;
+            stats.num_splats = params.size() / num_params;
+            if (stats.num_splats == 0)
+                LOG_FATAL("%s: no splats", frames[f].c_str());
+            decoded.resize(params.size());
+        } else if (frame_sh_degree != sh_degree || params.size() != decoded.size()) {
+            LOG_FATAL("%s: %zu splats of SH degree %d, expected %zu of degree %d",
+                      frames[f].c_str(), params.size() / num_params, frame_sh_degree,
+                      stats.num_splats, sh_degree);
+        }
+        stats.input_bytes += std::filesystem::file_size(frames[f]);
+
+        const bool keyframe = f % std::max(options.keyframe_interval, 1) == 0;
+        const size_t N = stats.num_splats;
+        std::vector<std::string> blocks(num_blocks(N));
+        std::vector<std::array<size_t, NUM_ATTRIBUTES>> block_changed(blocks.size());
+        parallel_for(blocks.size(), [&](size_t first_block, size_t end_block) {
+            for (size_t b = first_block; b < end_block; ++b) {
+                block_changed[b] = {};
+                encode_block(params, b * BLOCK_SIZE, std::min((b + 1) * BLOCK_SIZE, N),
+                             sh_degree, keyframe, options.tolerance, &decoded,
+                             &blocks[b], &block_changed[b]);
+            }
+        });
+
+        std::vector<uint64_t> block_offsets = {(blocks.size() + 1) * sizeof(uint64_t)};
+        for (const std::string& block : blocks)
+            block_offsets.push_back(block_offsets.back() + block.size());
+        table[f] = {
+            .offset = static_cast<uint64_t>(out.tellp()),
+            .size = block_offsets.back(),
+            .keyframe = keyframe,
+            .reserved = 0,
+        };
+        out.write(reinterpret_cast<const char*>(block_offsets.data()),
+                  block_offsets.size() * sizeof(uint64_t));
+        for (const std::string& block : blocks)
+            out.write(block.data(), block.size());
+        // Keeps the next frame's offsets aligned
+        const size_t padding = (8 - table[f].size % 8) % 8;
+        out.write("\0\0\0\0\0\0\0", padding);
+
+        (keyframe ? stats.keyframe_bytes : stats.delta_bytes) += table[f].size;
+        if (!keyframe) {
+            ++num_delta_frames;
+            for (const auto& counts : block_changed) {
+                for (int a = 0; a < NUM_ATTRIBUTES; ++a)
+                    changed[a] += counts[a];
+            }
+        }
+        LOG_INFO("frame %zu/%zu %s: %.1f MB", f + 1, frames.size(),
+                 keyframe ? "(keyframe)" : "(delta)", table[f].size / 1e6);
+    }
+    for (int a = 0; a < NUM_ATTRIBUTES; ++a) {
+        stats.changed_fraction[a] = num_delta_frames == 0 ? 0.0
+            : static_cast<double>(changed[a]) / (num_delta_frames * stats.num_splats);
+    }
+
+    std::copy_n(MAGIC, sizeof(MAGIC), header.magic);
+    header.version = VERSION;
+    header.sh_degree = sh_degree;
+    header.num_splats = stats.num_splats;
+    header.num_frames = frames.size();
+    header.fps = options.fps;
+    header.block_size = BLOCK_SIZE;
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(FrameEntry));
+    if (!out)
+        LOG_FATAL("could not write %s", filename.c_str());
+    return stats;
+}
+
+Reader::Reader(const std::string& filename)
+    : file_(llfio::mapped_file({}, filename).value()) {
+    const size_t file_size = file_.maximum_extent().value();
+    FileHeader header;
+    if (file_size < sizeof(header))
+        LOG_FATAL("%s is not a splat sequence", filename.c_str());
+    std::memcpy(&header, data(0), sizeof(header));
+    if (!std::equal(MAGIC, MAGIC + sizeof(MAGIC), header.magic))
+        LOG_FATAL("%s is not a splat sequence", filename.c_str());
+    if (header.version != VERSION || header.block_size != BLOCK_SIZE || header.sh_degree > 3)
+        LOG_FATAL("%s: unsupported version %u", filename.c_str(), header.version);
+    if (sizeof(header) + header.num_frames * sizeof(FrameEntry) > file_size)
+        LOG_FATAL("%s is truncated", filename.c_str());
+    num_splats_ = header.num_splats;
+    sh_degree_ = header.sh_degree;
+    fps_ = header.fps;
+
+    const auto* table = reinterpret_cast<const FrameEntry*>(data(sizeof(header)));
+    for (size_t f = 0; f < header.num_frames; ++f) {
+        const FrameEntry& entry = table[f];
+        if (entry.offset % 8 != 0 || entry.offset + entry.size > file_size
+            || entry.size < (num_blocks(num_splats_) + 1) * sizeof(uint64_t))
+            LOG_FATAL("%s: frame %zu is truncated", filename.c_str(), f);
+        frames_.push_back({.offset = entry.offset, .size = entry.size,
+                           .keyframe = entry.keyframe != 0});
+    }
+    if (frames_.empty() || !frames_[0].keyframe)
+        LOG_FATAL("%s does not start with a keyframe", filename.c_str());
+}
+
+void Reader::decode(size_t frame, int sh_degree, std::vector<float>* params,
+                    void* destination, dataset::Centers* centers, dataset::Radii* radii,
+                    int num_threads) const {
+    tracing::RecorderGuard tracing_guard(destination ? "decode frame" : "apply frame");
+    const Frame& f = frames_.at(frame);
+    const char* const base = data(f.offset);
+    const auto* block_offsets = reinterpret_cast<const uint64_t*>(base);
+    const size_t num_block_offsets = num_blocks(num_splats_) + 1;
+    for (size_t b = 1; b < num_block_offsets; ++b) {
+        if (block_offsets[b] < block_offsets[b - 1] || block_offsets[b] > f.size)
+            LOG_FATAL("frame %zu is corrupted", frame);
+    }
+
+    const size_t file_params = dataset::num_splat_params(sh_degree_);
+    const size_t num_params = dataset::num_splat_params(sh_degree);
+    params->resize(num_splats_ * num_params);
+    if (destination) {
+        centers->resize(num_splats_);
+        radii->resize(num_splats_);
+    }
+    const size_t splat_bytes = dataset::splat_size(sh_degree);
+
+    const auto decode_blocks = [&](size_t first_block, size_t end_block) {
+        dataset::SplatBuffer splats;
+        splats.reserve(DECODE_BATCH_SIZE);
+        for (size_t b = first_block; b < end_block; ++b) {
+            const size_t begin = b * BLOCK_SIZE;
+            const size_t end = std::min(begin + BLOCK_SIZE, num_splats_);
+            const char* const block = base + block_offsets[b];
+            const float* values = reinterpret_cast<const float*>(
+                f.keyframe ? block : block + masks_bytes(end - begin));
+            const float* const values_end = reinterpret_cast<const float*>(base + block_offsets[b + 1]);
+            for (size_t i = begin; i < end; ++i) {
+                const uint8_t mask = f.keyframe ? 0xff : block[i - begin];
+                float* const splat_params = &(*params)[i * num_params];
+                const float* const from = values;
+                for (int a = 0; a < NUM_ATTRIBUTES; ++a) {
+                    if (!(mask & (1 << a))) continue;
+                    const auto attribute = static_cast<Attribute>(a);
+                    const ParamRange range = param_range(attribute, sh_degree_);
+                    if (values + range.size > values_end)
+                        LOG_FATAL("frame %zu is corrupted", frame);
+                    copy_attribute(attribute, values, sh_degree_, splat_params, sh_degree);
+                    values += range.size;
+                }
+                if (f.keyframe && values != from + file_params)
+                    LOG_FATAL("frame %zu is corrupted", frame);
+            }
+            if (!destination) continue;
+
+            for (size_t i = begin; i < end; i += DECODE_BATCH_SIZE) {
+                const size_t n = std::min(DECODE_BATCH_SIZE, end - i);
+                splats.clear();
+                for (size_t k = i; k < i + n; ++k) {
+                    const dataset::Splat& splat =
+                        splats.emplace_back(dataset::decode_splat(&(*params)[k * num_params], sh_degree));
+                    (*centers)[k] = Eigen::Vector3f(splat.center[0], splat.center[1], splat.center[2]);
+                    (*radii)[k] = dataset::bounding_radius(splat.covA, splat.covB);
+                }
+                dataset::copy_splats(splats.data(), n, sh_degree,
+                                     static_cast<char*>(destination) + i * splat_bytes);
+            }
+        }
+    };
+    parallel_for(num_block_offsets - 1, num_threads, decode_blocks);
+}
+
+void Reader::release(size_t frame) const {
+    // madvise requires a page-aligned address, the mapping itself is
+    // page-aligned
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+    const Frame& f = frames_.at(frame);
+    const size_t aligned_offset = f.offset - f.offset % page_size;
+    char* const addr = reinterpret_cast<char*>(file_.address()) + aligned_offset;
+    if (madvise(addr, f.size + f.offset - aligned_offset, MADV_DONTNEED) != 0)
+        LOG_ERROR("madvise failed for sequence frame %zu", frame);
+}
+
+Player::Player(const std::string& filename, const PlayerOptions& options,
+               GLFWwindow* decoder_window)
+    : reader_(filename)
+    , sh_degree_(std::clamp(options.sh_degree, 0, reader_.sh_degree()))
+    , num_threads_(options.num_threads > 0
+                   ? options.num_threads
+                   : static_cast<int>(std::max(1u, std::thread::hardware_concurrency())))
+    , decoder_window_(decoder_window)
+    , frame_bytes_(dataset::splat_size(sh_degree_) * reader_.num_splats()) {
+    // Splats on the GPU, centers, radii, source rows and deleted mask on the
+    // host, and the decoder's parameters once
+    const size_t N = reader_.num_splats();
+    const size_t frame_bytes = frame_bytes_
+        + N * (sizeof(Eigen::Vector3f) + sizeof(float) + sizeof(uint32_t) + 1);
+    const size_t params_bytes = N * dataset::num_splat_params(sh_degree_) * sizeof(float);
+    ring_size_ = options.budget_bytes > params_bytes
+        ? (options.budget_bytes - params_bytes) / frame_bytes
+        : 0;
+    if (ring_size_ < MIN_RING_SIZE) {
+        LOG_ERROR("%s needs %.1f MB for %zu frames, more than the budget", filename.c_str(),
+                  (params_bytes + MIN_RING_SIZE * frame_bytes) / 1e6, MIN_RING_SIZE);
+        ring_size_ = MIN_RING_SIZE;
+    }
+    LOG_INFO("%s: %zu frames of %zu splats at %.1f fps, ring of %zu frames (%.1f MB each)",
+             filename.c_str(), num_frames(), N, fps(), ring_size_, frame_bytes / 1e6);
+    thread_ = std::jthread(std::bind_front(&Player::decoder, this));
+}
+
+std::optional<Frame> Player::try_take(uint64_t position) {
+    std::lock_guard lg(mutex_);
+    return take_locked(position);
+}
+
+Frame Player::take(uint64_t position) {
+    std::unique_lock lock(mutex_);
+    std::optional<Frame> frame;
+    decoded_cv_.wait(lock, [&] {
+        frame = take_locked(position);
+        return frame.has_value();
+    });
+    return std::move(*frame);
+}
+
+size_t Player::num_ahead() {
+    std::lock_guard lg(mutex_);
+    return decoded_.size();
+}
+
+void Player::recycle(uint32_t ssbo_splats) {
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // The decoder's context waits for it, which needs it flushed
+    glFlush();
+    std::lock_guard lg(mutex_);
+    free_slots_.push_back({.ssbo = ssbo_splats, .fence = fence});
+    --num_taken_;
+    update_memory();
+    request_cv_.notify_all();
+}
+
+std::optional<Frame> Player::take_locked(uint64_t position) {
+    if (taken_ && position < *taken_) {
+        // Seeking back, the frames decoded ahead are of no use
+        for (const Frame& frame : decoded_)
+            free_slots_.push_back({.ssbo = frame.ssbo_splats, .fence = nullptr});
+        decoded_.clear();
+        taken_.reset();
+        ++generation_;
+    }
+    wanted_ = position;
+    std::optional<Frame> frame;
+    while (!decoded_.empty() && decoded_.front().position <= position) {
+        if (frame)
+            free_slots_.push_back({.ssbo = frame->ssbo_splats, .fence = nullptr});
+        frame = std::move(decoded_.front());
+        decoded_.pop_front();
+    }
+    if (frame) {
+        taken_ = frame->position;
+        ++num_taken_;
+        update_memory();
+    }
+    request_cv_.notify_all();
+    return frame;
+}
+
+void Player::update_memory() {
+    ring_memory_.resize((num_slots_ - num_taken_) * frame_bytes_);
+}
+
+void Player::decode(size_t frame, uint32_t ssbo, dataset::Centers* centers,
+                    dataset::Radii* radii) {
+    // From the last keyframe, or on from the decoded frame if it is closer
+    size_t first = frame;
+    while (!reader_.keyframe(first))
+        --first;
+    if (params_frame_ && *params_frame_ >= first && *params_frame_ <= frame)
+        first = std::min(*params_frame_ + 1, frame);
+    // Frames in between only update the parameters
+    for (size_t f = first; f < frame; ++f) {
+        reader_.decode(f, sh_degree_, &params_, nullptr, nullptr, nullptr, num_threads_);
+        reader_.release(f);
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    void* splats = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, frame_bytes_,
+                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (!splats)
+        LOG_FATAL("could not map the splat buffer");
+    reader_.decode(frame, sh_degree_, &params_, splats, centers, radii, num_threads_);
+    // The contents are undefined if the mapping was lost, e.g. on a mode switch
+    if (glUnmapBuffer(GL_SHADER_STORAGE_BUFFER) != GL_TRUE)
+        LOG_FATAL("splat buffer corrupted during upload");
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    reader_.release(frame);
+    params_frame_ = frame;
+    params_memory_.resize(params_.capacity() * sizeof(float));
+}
+
+void Player::decoder(std::stop_token stop) {
+    glfwMakeContextCurrent(decoder_window_);
+    while (!stop.stop_requested()) {
+        uint64_t position;
+        uint64_t generation;
+        Slot slot = {.ssbo = 0, .fence = nullptr};
+        {
+            std::unique_lock lock(mutex_);
+            const bool woken = request_cv_.wait(lock, stop, [&] {
+                return !free_slots_.empty() || num_slots_ < ring_size_;
+            });
+            if (!woken) break;
+            // Ahead of the frames decoded and taken, never behind the
+            // requested one
+            position = wanted_;
+            if (taken_)
+                position = std::max(position, *taken_ + 1);
+            if (!decoded_.empty())
+                position = std::max(position, decoded_.back().position + 1);
+            generation = generation_;
+            if (!free_slots_.empty()) {
+                slot = free_slots_.back();
+                free_slots_.pop_back();
+            } else {
+                ++num_slots_;
+            }
+        }
+
+        tracing::RecorderGuard tracing_guard("decode sequence frame");
+        if (!slot.ssbo)
+            slot.ssbo = rendering::splat_buffer(reader_.num_splats(), sh_degree_);
+        if (slot.fence) {
+            const auto fence = static_cast<GLsync>(slot.fence);
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100'000'000)
+                   == GL_TIMEOUT_EXPIRED) {}
+            glDeleteSync(fence);
+        }
+        dataset::Centers centers;
+        dataset::Radii radii;
+        decode(position % num_frames(), slot.ssbo, &centers, &radii);
+        // Complete before another context uses the buffer
+        glFinish();
+
+        {
+            std::lock_guard lg(mutex_);
+            if (generation == generation_ && (!taken_ || position > *taken_)) {
+                decoded_.push_back({
+                    .position = position,
+                    .dataset = dataset::Dataset(std::move(centers), std::move(radii), sh_degree_),
+                    .ssbo_splats = slot.ssbo,
+                });
+            } else {
+                free_slots_.push_back({.ssbo = slot.ssbo, .fence = nullptr});
+            }
+            update_memory();
+        }
+        decoded_cv_.notify_all();
+    }
+
+    {
+        std::lock_guard lg(mutex_);
+        for (const Slot& slot : free_slots_) {
+            if (slot.fence)
+                glDeleteSync(static_cast<GLsync>(slot.fence));
+            glDeleteBuffers(1, &slot.ssbo);
+        }
+        for (const Frame& frame : decoded_)
+            glDeleteBuffers(1, &frame.ssbo_splats);
+    }
+    glfwMakeContextCurrent(nullptr);
+}
+
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+#include "dataset.h"
+#include "memory.h"
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <llfio.hpp>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct GLFWwindow;
+
+// Sequences of scenes with the same splats, e.g. the timesteps of a dynamic
+// capture, played back at a fixed frame rate.
+//
+// They are stored in a container (`.splatseq`) made for streaming: a header
+// and a table of the frames, then the frames, each split into blocks of
+// `BLOCK_SIZE` splats that are decoded in parallel. Keyframes hold all
+// parameters of each splat (see `dataset::decode_splat`). The other frames
+// hold per splat a byte with a bit per `Attribute` that changed since the
+// previous frame, followed by the new values of those attributes only, so
+// that splats which stay in place cost one byte. The file is memory-mapped
+// and read front to back.
+//
+// A `Player` decodes the frames ahead of the one shown on a background
+// thread, straight into a ring of GPU buffers, within a memory budget that
+// does not depend on the length of the sequence.
+
+namespace viewer::sequence {
+
+namespace llfio = LLFIO_V2_NAMESPACE;
+
+// Splats per block of a frame
+constexpr size_t BLOCK_SIZE = 1 << 14;
+
+// Groups of parameters that change together, in the order of the parameters
+enum class Attribute {
+    Position,
+    BaseColor,
+    // The higher spherical harmonics coefficients
+    ViewDependentColor,
+    Opacity,
+    Scale,
+    Rotation,
+    Count,
+};
+
+constexpr int NUM_ATTRIBUTES = static_cast<int>(Attribute::Count);
+
+// First parameter and number of parameters of an attribute, out of
+// `dataset::num_splat_params(sh_degree)`
+struct ParamRange {
+    int first;
+    int size;
+};
+
+ParamRange param_range(Attribute attribute, int sh_degree);
+
+struct EncodeOptions {
+    float fps = 30.f;
+    // Frames from one keyframe to the next. Playback starts, loops and seeks
+    // from keyframes.
+    int keyframe_interval = 30;
+    // Largest difference of a parameter that does not count as a change.
+    // Errors do not accumulate: the difference is taken to the value the
+    // decoder holds. 0 is lossless.
+    float tolerance = 0.f;
+};
+
+struct EncodeStats {
+    size_t num_splats = 0;
+    size_t num_frames = 0;
+    size_t input_bytes = 0;
+    size_t keyframe_bytes = 0;
+    size_t delta_bytes = 0;
+    // Over the delta frames
+    std::array<double, NUM_ATTRIBUTES> changed_fraction = {};
+};
+
+// Encodes PLY files with the same number of splats, one per frame, into
+// `filename`
+EncodeStats encode(const std::vector<std::string>& frames, const std::string& filename,
+                   const EncodeOptions& options = {});
+
+// A memory-mapped `.splatseq` file
+class Reader {
+public:
+    explicit Reader(const std::string& filename);
+
+    size_t num_frames() const { return frames_.size(); }
+    size_t num_splats() const { return num_splats_; }
+    int sh_degree() const { return sh_degree_; }
+    float fps() const { return fps_; }
+    bool keyframe(size_t frame) const { return frames_.at(frame).keyframe; }
+    // Bytes of a frame in the file
+    size_t frame_bytes(size_t frame) const { return frames_.at(frame).size; }
+
+    // Applies a frame to `params`, which hold those of the previous frame
+    // unless it is a keyframe, `dataset::num_splat_params(sh_degree)` per
+    // splat for a degree up to that of the file. Also writes the splats as
+    // `SplatT<sh_degree>` to `destination`, and their centers and radii,
+    // unless `destination` is null. On `num_threads` threads.
+    void decode(size_t frame, int sh_degree, std::vector<float>* params,
+                void* destination, dataset::Centers* centers, dataset::Radii* radii,
+                int num_threads) const;
+    // Drops a decoded frame from the mapping
+    void release(size_t frame) const;
+
+private:
+    struct Frame {
+        uint64_t offset;
+        uint64_t size;
+        bool keyframe;
+    };
+
+    const char* data(size_t offset) const {
+        return reinterpret_cast<const char*>(file_.address()) + offset;
+    }
+
+private:
+    llfio::mapped_file_handle file_;
+    size_t num_splats_;
+    int sh_degree_;
+    float fps_;
+    std::vector<Frame> frames_;
+};
+
+struct PlayerOptions {
+    // Highest spherical harmonics degree to decode, clamped to that of the
+    // file
+    int sh_degree = 3;
+    // Bound on the host and GPU memory of the decoded frames and the
+    // decoder. At least three frames are decoded regardless: the one shown,
+    // the next one while it is sorted, and one being decoded.
+    size_t budget_bytes = size_t{2} << 30;
+    int num_threads = 0;
+};
+
+// Ready for `rendering::Renderer::set_scene` with `recycle`
+struct Frame {
+    // Position in the playback, counting on across loops: the frame of the
+    // sequence is `position % num_frames()`
+    uint64_t position;
+    dataset::Dataset dataset;
+    uint32_t ssbo_splats;
+};
+
+class Player {
+public:
+    // Decodes into the context of `decoder_window`, which must share objects
+    // with the renderer's context and is made current on the decoding thread
+    Player(const std::string& filename, const PlayerOptions& options,
+           GLFWwindow* decoder_window);
+
+    size_t num_frames() const { return reader_.num_frames(); }
+    float fps() const { return reader_.fps(); }
+    // Frames the ring holds, including those handed out
+    size_t ring_size() const { return ring_size_; }
+
+    // The latest decoded frame up to `position`, dropping those before it,
+    // if there is one after the last one taken. Decodes ahead from
+    // `position` on. Going back to an earlier position drops the frames
+    // decoded ahead.
+    std::optional<Frame> try_take(uint64_t position);
+    // Blocks until the frame at `position` is decoded
+    Frame take(uint64_t position);
+    // Frames decoded ahead of the last one taken
+    size_t num_ahead();
+    // Returns the buffer of a taken frame to the ring, see
+    // `rendering::Renderer::recycled_buffers`. Called in the context that
+    // used it last, so that it is not overwritten before that is done.
+    void recycle(uint32_t ssbo_splats);
+
+private:
+    struct Slot {
+        uint32_t ssbo;
+        // Signaled once the buffer is not used anymore, null if unused
+        void* fence;
+    };
+
+    void decoder(std::stop_token stop);
+    // With `mutex_` held
+    std::optional<Frame> take_locked(uint64_t position);
+    void update_memory();
+    // Brings `params_` to `frame` and decodes it into `ssbo`
+    void decode(size_t frame, uint32_t ssbo, dataset::Centers* centers,
+                dataset::Radii* radii);
+
+private:
+    const Reader reader_;
+    const int sh_degree_;
+    const int num_threads_;
+    GLFWwindow* const decoder_window_;
+    // GPU memory of a frame
+    const size_t frame_bytes_;
+    size_t ring_size_;
+    // Parameters of the frame `params_frame_`, on the decoding thread
+    std::vector<float> params_;
+    std::optional<size_t> params_frame_;
+    memory::Allocation params_memory_{memory::Subsystem::SequenceState};
+
+    std::mutex mutex_;
+    // Signals the decoder that a position was requested or a slot recycled
+    std::condition_variable_any request_cv_;
+    // Signals `take` that a frame was decoded
+    std::condition_variable_any decoded_cv_;
+    uint64_t wanted_ = 0;
+    std::optional<uint64_t> taken_;
+    // Incremented when the decoded frames are dropped, so that the decoder
+    // drops the one in flight too
+    uint64_t generation_ = 0;
+    std::deque<Frame> decoded_;
+    std::vector<Slot> free_slots_;
+    // Buffers created, at most `ring_size_`, and those handed out
+    size_t num_slots_ = 0;
+    size_t num_taken_ = 0;
+    memory::Allocation ring_memory_{memory::Subsystem::GpuSequenceFrames};
+    std::jthread thread_;
+};
+
+}
@@ -0,0 +1,69 @@
+#include "logging.h"
+#include "sequence.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <cxxopts.hpp>
+
+// Encodes the PLY files of a dynamic scene, one per timestep, into a
+// `.splatseq` container for playback in the viewer (see `sequence.h`), and
+// reports how much of each attribute changes from frame to frame.
+
+int main(int argc, char** argv) {
+    using namespace viewer;
+
+    cxxopts::Options options(argv[0], "Splat sequence encoder");
+    // clang-format off
+    options
+        .positional_help("out.splatseq frame.ply...")
+        .add_options()
+            ("h,help", "print this help message")
+            ("fps", "playback frame rate",
+             cxxopts::value<float>()->default_value("30"))
+            ("keyframe-interval", "frames from one keyframe to the next (seeking and looping start at keyframes)",
+             cxxopts::value<int>()->default_value("30"))
+            ("tolerance", "largest parameter difference not stored as a change, 0 is lossless",
+             cxxopts::value<float>()->default_value("0"))
+            ("positional", "", cxxopts::value<std::vector<std::string>>());
+    // clang-format on
+
+    options.parse_positional({"positional"});
+    auto parsed_options = options.parse(argc, argv);
+
+    if (parsed_options.count("help") || parsed_options.count("positional") == 0 ||
+        parsed_options["positional"].as<std::vector<std::string>>().size() < 2) {
+        std::cout << options.help() << std::endl;
+        return -1;
+    }
+
+    const auto& files = parsed_options["positional"].as<std::vector<std::string>>();
+    const std::string& out_file_name = files.front();
+    const std::vector<std::string> frames(files.begin() + 1, files.end());
+    const sequence::EncodeOptions encode_options = {
+        .fps = parsed_options["fps"].as<float>(),
+        .keyframe_interval = parsed_options["keyframe-interval"].as<int>(),
+        .tolerance = parsed_options["tolerance"].as<float>(),
+    };
+
+    const sequence::EncodeStats stats = sequence::encode(frames, out_file_name, encode_options);
+
+    static const char* ATTRIBUTES[] = {
+        "position", "base color", "view-dependent color", "opacity", "scale", "rotation",
+    };
+    const size_t out_bytes = std::filesystem::file_size(out_file_name);
+    // clang-format off
+    std::printf("%-28s %12zu\n", "frames", stats.num_frames);
+    std::printf("%-28s %12zu\n", "splats", stats.num_splats);
+    std::printf("%-28s %12.1f -> %.1f MB (%.1f%%)\n", "size", stats.input_bytes / 1e6,
+                out_bytes / 1e6, 100.0 * out_bytes / stats.input_bytes);
+    std::printf("%-28s %12.1f MB\n", "keyframes", stats.keyframe_bytes / 1e6);
+    std::printf("%-28s %12.1f MB\n", "deltas", stats.delta_bytes / 1e6);
+    for (int a = 0; a < sequence::NUM_ATTRIBUTES; ++a) {
+        std::printf("%-28s %12.2f%%\n", (std::string("changed, ") + ATTRIBUTES[a]).c_str(),
+                    100.0 * stats.changed_fraction[a]);
+    }
+    // clang-format on
+
+    return 0;
+}
@@ -0,0 +1,229 @@
+#include "session.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <type_traits>
+
+namespace viewer::session {
+
+namespace {
+
+constexpr const char* MAGIC = "splatview-session";
+constexpr int VERSION = 1;
+
+template <typename Visitor>
+void visit(const std::string& prefix, dataset::SortOptions& o, Visitor&& v) {
+    v(prefix + "fast_sort", o.fast_sort);
+    v(prefix + "key_bits", o.key_bits);
+    v(prefix + "binning", o.binning);
+    v(prefix + "visible_range", o.visible_range);
+    v(prefix + "fraction", o.fraction);
+}
+
+template <typename Visitor>
+void visit(const std::string& prefix, Eigen::Vector3f& p, Visitor&& v) {
+    v(prefix + "x", p.x());
+    v(prefix + "y", p.y());
+    v(prefix + "z", p.z());
+}
+
+// Calls `v(name, field)` for every field of the config
+template <typename Visitor>
+void visit(rendering::RendererConfig& c, Visitor&& v) {
+    v("backend", c.backend);
+    v("early_termination", c.early_termination);
+    v("early_termination_batch_size", c.early_termination_batch_size);
+    v("unsorted_preview", c.unsorted_preview);
+    v("occlusion_culling", c.occlusion_culling);
+    v("chunked_indices", c.chunked_indices);
+    v("show_overdraw", c.show_overdraw);
+    v("resolution.enabled", c.resolution.enabled);
+    v("resolution.target_ms", c.resolution.target_ms);
+    v("resolution.min_scale", c.resolution.min_scale);
+    v("resolution.max_scale", c.resolution.max_scale);
+    visit("sort_options.", c.sort_options, v);
+    v("sh_degree", c.sh_degree);
+    v("predict_camera_motion", c.predict_camera_motion);
+    v("sort_cpu_budget", c.sort_cpu_budget);
+    v("progressive.enabled", c.progressive.enabled);
+    v("progressive.still_frames", c.progressive.still_frames);
+    v("progressive.sh_degree", c.progressive.sh_degree);
+    visit("progressive.sort_options.", c.progressive.sort_options, v);
+    v("max_shared_sort_angle_deg", c.max_shared_sort_angle_deg);
+    v("box_edit.preview", c.box_edit.preview);
+    v("box_edit.inside", c.box_edit.inside);
+    visit("box_edit.box.min.", c.box_edit.box.min, v);
+    visit("box_edit.box.max.", c.box_edit.box.max, v);
+}
+
+template <typename T>
+void write_value(std::ostream& out, const T& value) {
+    if constexpr (std::is_enum_v<T>)
+        out << static_cast<int>(value);
+    else
+        out << value;
+}
+
+template <typename T>
+bool read_value(std::istream& in, T* value) {
+    if constexpr (std::is_enum_v<T>) {
+        int v;
+        if (!(in >> v)) return false;
+        *value = static_cast<T>(v);
+        return true;
+    } else {
+        return static_cast<bool>(in >> *value);
+    }
+}
+
+struct Summary {
+    double mean;
+    double p50;
+    double p95;
+    double p99;
+    double max;
+};
+
+Summary summarize(std::vector<double> values) {
+    if (values.empty())
+        return {};
+    std::sort(values.begin(), values.end());
+    double sum = 0.0;
+    for (const double v : values)
+        sum += v;
+    const auto percentile = [&](double p) {
+        return values[static_cast<size_t>(p * (values.size() - 1) + 0.5)];
+    };
+    return {
+        .mean = sum / values.size(),
+        .p50 = percentile(0.5),
+        .p95 = percentile(0.95),
+        .p99 = percentile(0.99),
+        .max = values.back(),
+    };
+}
+
+}
+
+Recorder::Recorder(const std::string& filename)
+    : out_(filename) {
+    if (!out_)
+        LOG_FATAL("could not open %s", filename.c_str());
+    out_.precision(std::numeric_limits<float>::max_digits10);
+    out_ << MAGIC << " " << VERSION << "\n";
+}
+
+void Recorder::record(const Frame& frame) {
+    if (!config_ || !(*config_ == frame.config)) {
+        config_ = frame.config;
+        out_ << "config";
+        visit(*config_, [&](const std::string& name, const auto& value) {
+            out_ << " " << name << "=";
+            write_value(out_, value);
+        });
+        out_ << "\n";
+    }
+
+    out_ << "frame " << frame.time << " " << frame.fov_deg << " "
+         << frame.width << " " << frame.height << " " << frame.views.size();
+    for (const Eigen::Matrix4f& view : frame.views) {
+        for (int i = 0; i < 16; ++i)
+            out_ << " " << view(i / 4, i % 4);
+    }
+    out_ << "\n";
+    // Flushed, so that a crash keeps the frames leading up to it
+    out_.flush();
+}
+
+std::vector<Frame> load(const std::string& filename) {
+    std::ifstream in(filename);
+    if (!in)
+        LOG_FATAL("could not open %s", filename.c_str());
+
+    std::string magic;
+    int version;
+    if (!(in >> magic >> version) || magic != MAGIC || version != VERSION)
+        LOG_FATAL("%s is not a session file of version %d", filename.c_str(), VERSION);
+
+    std::vector<Frame> frames;
+    rendering::RendererConfig config;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream tokens(line);
+        std::string type;
+        if (!(tokens >> type)) continue;
+
+        if (type == "config") {
+            // Fields missing from the file keep their defaults, unknown
+            // fields are skipped
+            config = {};
+            std::string token;
+            while (tokens >> token) {
+                const size_t eq = token.find('=');
+                if (eq == std::string::npos) continue;
+                const std::string name = token.substr(0, eq);
+                std::istringstream value(token.substr(eq + 1));
+                visit(config, [&](const std::string& field, auto& v) {
+                    if (field == name && !read_value(value, &v))
+                        LOG_ERROR("invalid value for %s in %s", name.c_str(), filename.c_str());
+                });
+            }
+        } else if (type == "frame") {
+            Frame frame;
+            frame.config = config;
+            size_t num_views = 0;
+            tokens >> frame.time >> frame.fov_deg >> frame.width >> frame.height >> num_views;
+            frame.views.resize(num_views);
+            for (Eigen::Matrix4f& view : frame.views) {
+                for (int i = 0; i < 16; ++i)
+                    tokens >> view(i / 4, i % 4);
+            }
+            if (!tokens || num_views == 0)
+                LOG_FATAL("invalid frame %zu in %s", frames.size(), filename.c_str());
+            frames.push_back(std::move(frame));
+        }
+    }
+    return frames;
+}
+
+void report(const std::vector<FrameTiming>& timings, const std::string& csv_filename) {
+    const std::pair<const char*, double FrameTiming::*> COLUMNS[] = {
+        {"frame_ms", &FrameTiming::frame_ms},
+        {"sort_wait_ms", &FrameTiming::sort_wait_ms},
+        {"gpu_ms", &FrameTiming::gpu_ms},
+        {"sort_ms", &FrameTiming::sort_ms},
+        {"sort_latency_ms", &FrameTiming::sort_latency_ms},
+    };
+
+    // clang-format off
+    std::printf("%zu frames\n", timings.size());
+    std::printf("%-18s %10s %10s %10s %10s %10s\n", "", "mean", "p50", "p95", "p99", "max");
+    for (const auto& [name, member] : COLUMNS) {
+        std::vector<double> values;
+        for (const FrameTiming& t : timings)
+            values.push_back(t.*member);
+        const Summary s = summarize(std::move(values));
+        std::printf("%-18s %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+                    name, s.mean, s.p50, s.p95, s.p99, s.max);
+    }
+    // clang-format on
+
+    if (csv_filename.empty()) return;
+    std::ofstream csv(csv_filename);
+    csv << "frame";
+    for (const auto& [name, member] : COLUMNS)
+        csv << "," << name;
+    csv << "\n";
+    for (size_t i = 0; i < timings.size(); ++i) {
+        csv << i;
+        for (const auto& [name, member] : COLUMNS)
+            csv << "," << timings[i].*member;
+        csv << "\n";
+    }
+    if (!csv)
+        LOG_ERROR("could not write %s", csv_filename.c_str());
+}
+
+}
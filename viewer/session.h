@@ -0,0 +1,58 @@
+#pragma once
+
+#include "render.h"
+
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+
+// Recording of the camera and renderer settings of every frame to a text
+// file, for replaying user sessions as a benchmark. The renderer config is
+// stored by field name, so sessions stay readable when fields are added.
+
+namespace viewer::session {
+
+// Everything the viewer passes to the renderer in one frame
+struct Frame {
+    // Seconds since the start of the recording, informational
+    double time = 0.0;
+    float fov_deg = 60.f;
+    // Of each view, the views are side by side
+    int width = 0;
+    int height = 0;
+    std::vector<Eigen::Matrix4f> views;
+    rendering::RendererConfig config;
+};
+
+class Recorder {
+public:
+    explicit Recorder(const std::string& filename);
+    // Writes the config only when it changed
+    void record(const Frame& frame);
+
+private:
+    std::ofstream out_;
+    std::optional<rendering::RendererConfig> config_;
+};
+
+std::vector<Frame> load(const std::string& filename);
+
+// Measurements of one replayed frame
+struct FrameTiming {
+    // Wall time from the start of the frame to the start of the next one
+    double frame_ms = 0.0;
+    // Blocked on the sort of the frame's views
+    double sort_wait_ms = 0.0;
+    // See `rendering::FrameStats`
+    double gpu_ms = 0.0;
+    double sort_ms = 0.0;
+    double sort_latency_ms = 0.0;
+};
+
+// Prints the mean, percentiles and maximum of each measurement, and writes
+// the measurements of every frame as CSV if `csv_filename` is not empty
+void report(const std::vector<FrameTiming>& timings, const std::string& csv_filename);
+
+}
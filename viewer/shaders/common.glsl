@@ -0,0 +1,213 @@
+R""(
+// Splat storage and view-dependent color, shared by the quad and tile
+// renderers. Adapted from https://github.com/antimatter15/splat
+
+// Programs are specialized by defining these in front, see
+// `sh_variant_defines`. SPLAT_SH_DEGREE is the degree of the splat layout,
+// SH_DEGREE the one shaded with, at most SPLAT_SH_DEGREE.
+#ifndef SPLAT_SH_DEGREE
+#define SPLAT_SH_DEGREE 3
+#endif
+#ifndef SH_DEGREE
+#define SH_DEGREE SPLAT_SH_DEGREE
+#endif
+
+struct Splat {
+  vec3 center;
+  float alpha;
+  vec3 covA;
+  vec3 covB;
+  vec3 sh[(SPLAT_SH_DEGREE + 1) * (SPLAT_SH_DEGREE + 1)];
+};
+
+layout(std430, binding=2) readonly buffer splat_buffer {
+  Splat splats[];
+};
+
+// 1 / fraction of the splats drawn. A random subset of a fraction f keeps the
+// expected transmittance of the full set if each opacity is raised to
+// 1 - (1 - alpha)^(1 / f).
+uniform float opacity_exponent;
+
+// Preview of a box edit: 1 hides the splats inside of the box, 2 those
+// outside, 0 none
+uniform int crop_mode;
+uniform vec3 crop_min;
+uniform vec3 crop_max;
+
+bool cropped(uint idx) {
+  if (crop_mode == 0) return false;
+  vec3 c = splats[idx].center;
+  bool inside = all(greaterThanEqual(c, crop_min)) && all(lessThanEqual(c, crop_max));
+  return inside == (crop_mode == 1);
+}
+
+// Zero for cropped splats, which culls them
+float splat_alpha(uint idx) {
+  if (cropped(idx)) return 0.0;
+  float alpha = splats[idx].alpha;
+  return opacity_exponent == 1.0 ? alpha : 1.0 - pow(1.0 - alpha, opacity_exponent);
+}
+
+// Number of splat evaluations per pixel, for the overdraw visualization
+layout(std430, binding=8) buffer fragment_count_buffer {
+  uint fragment_counts[];
+};
+
+uniform bool count_fragments;
+// Window coordinates of the lower left corner of the viewport, the counts are
+// stored relative to it
+uniform vec2 viewport_origin;
+
+// Per pixel while recording occlusion, see `occlusion.h`: the optical depth
+// -log(transmittance) of the splats blended so far in fixed point, the
+// largest camera-space depth among them until the pixel became opaque, as
+// float bits (which order like the positive depths), and the smallest depth
+// of all splats blended, as inverted float bits so that the cleared value
+// means none. The last component pads. Stored like the counts.
+layout(std430, binding=9) buffer occlusion_pixel_buffer {
+  uvec4 occlusion_pixels[];
+};
+
+uniform bool record_occlusion;
+
+const float OPTICAL_DEPTH_SCALE = 1024.0;
+// Transmittance 1 / 255, later splats change the pixel by less than an 8 bit
+// step
+const uint OPAQUE_OPTICAL_DEPTH = uint(5.541264 * OPTICAL_DEPTH_SCALE);
+
+// Contributions below this are invisible in 8 bit output
+const float MIN_ALPHA = 1.0 / 255.0;
+
+// Radius in units of the quad corner vectors v1, v2 beyond which a splat's
+// contribution alpha * exp(-r^2) drops below MIN_ALPHA, at most 2. Zero if
+// the splat is invisible.
+float cutoff_radius(float alpha) {
+  return sqrt(clamp(log(alpha / MIN_ALPHA), 0.0, 4.0));
+}
+
+const float SH_C0 = 0.28209479177387814;
+const float SH_C1 = 0.4886025119029199;
+const float SH_C2[5] = float[5](
+  1.0925484305920792,
+  -1.0925484305920792,
+  0.31539156525252005,
+  -1.0925484305920792,
+  0.5462742152960396
+);
+const float SH_C3[7] = float[7](
+  -0.5900435899266435,
+  2.890611442640554,
+  -0.4570457994644658,
+  0.3731763325901154,
+  -0.4570457994644658,
+  1.445305721320277,
+  -0.5900435899266435
+);
+
+mat3 transpose(mat3 m) {
+  return mat3(
+      m[0][0], m[1][0], m[2][0],
+      m[0][1], m[1][1], m[2][1],
+      m[0][2], m[1][2], m[2][2]
+  );
+}
+
+vec3 get_rgb(uint idx, vec3 d) {
+    vec3 rgb = vec3(0.5);
+
+    rgb += SH_C0 * splats[idx].sh[0];
+
+#if SH_DEGREE >= 1
+    rgb +=
+        - SH_C1 * d.y * splats[idx].sh[1]
+        + SH_C1 * d.z * splats[idx].sh[2]
+        - SH_C1 * d.x * splats[idx].sh[3];
+#endif
+
+#if SH_DEGREE >= 2
+    {
+        float xx = d.x * d.x;
+        float yy = d.y * d.y;
+        float zz = d.z * d.z;
+        float xy = d.x * d.y;
+        float yz = d.y * d.z;
+        float xz = d.x * d.z;
+        rgb +=
+            SH_C2[0] * xy * splats[idx].sh[4] +
+            SH_C2[1] * yz * splats[idx].sh[5] +
+            SH_C2[2] * (2.0 * zz - xx - yy) * splats[idx].sh[6] +
+            SH_C2[3] * xz * splats[idx].sh[7] +
+            SH_C2[4] * (xx - yy) * splats[idx].sh[8];
+
+#if SH_DEGREE >= 3
+        rgb +=
+            SH_C3[0] * d.y * (3.0 * xx - yy) * splats[idx].sh[9] +
+            SH_C3[1] * d.z * xy * splats[idx].sh[10] +
+            SH_C3[2] * d.y * (4.0 * zz - xx - yy) * splats[idx].sh[11] +
+            SH_C3[3] * d.z * (2.0 * zz - 3.0 * xx - 3.0 * yy) * splats[idx].sh[12] +
+            SH_C3[4] * d.x * (4.0 * zz - xx - yy) * splats[idx].sh[13] +
+            SH_C3[5] * d.z * (xx - yy) * splats[idx].sh[14] +
+            SH_C3[6] * d.x * (xx - 3.0 * yy) * splats[idx].sh[15];
+#endif
+    }
+#endif
+
+    return clamp(rgb, 0.0, 1.0);
+}
+
+// Screen-space footprint of a splat, see `project`
+struct Footprint {
+  vec4 pos2d;
+  // Pixel offsets of the quad corners at +-1
+  vec2 v1;
+  vec2 v2;
+};
+
+// Projects the splat's covariance to screen space (EWA splatting). Returns
+// false if the splat is outside of the view frustum.
+bool project(uint idx, mat4 projection, mat4 view, vec2 focal, out Footprint f) {
+  vec4 camspace = view * vec4(splats[idx].center, 1);
+  f.pos2d = projection * camspace;
+
+  float bounds = 1.2 * f.pos2d.w;
+  if (f.pos2d.z < -f.pos2d.w
+      || f.pos2d.x < -bounds
+      || f.pos2d.x > bounds
+      || f.pos2d.y < -bounds
+      || f.pos2d.y > bounds) {
+      return false;
+  }
+
+  vec3 covA = splats[idx].covA;
+  vec3 covB = splats[idx].covB;
+  mat3 Vrk = mat3(
+      covA.x, covA.y, covA.z,
+      covA.y, covB.x, covB.y,
+      covA.z, covB.y, covB.z
+  );
+
+  mat3 J = mat3(
+      focal.x / camspace.z, 0., -(focal.x * camspace.x) / (camspace.z * camspace.z),
+      0., -focal.y / camspace.z, (focal.y * camspace.y) / (camspace.z * camspace.z),
+      0., 0., 0.
+  );
+
+  mat3 W = transpose(mat3(view));
+  mat3 T = W * J;
+  mat3 cov = transpose(T) * Vrk * T;
+
+  float diagonal1 = cov[0][0] + 0.3;
+  float offDiagonal = cov[0][1];
+  float diagonal2 = cov[1][1] + 0.3;
+
+  float mid = 0.5 * (diagonal1 + diagonal2);
+  float radius = length(vec2((diagonal1 - diagonal2) / 2.0, offDiagonal));
+  float lambda1 = mid + radius;
+  float lambda2 = max(mid - radius, 0.1);
+  vec2 diagonalVector = normalize(vec2(offDiagonal, lambda1 - diagonal1));
+  f.v1 = min(sqrt(2.0 * lambda1), 1024.0) * diagonalVector;
+  f.v2 = min(sqrt(2.0 * lambda2), 1024.0) * vec2(diagonalVector.y, -diagonalVector.x);
+  return true;
+}
+)""
@@ -0,0 +1,7 @@
+R""(
+// Full screen triangle at the near plane
+void main () {
+  vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+  gl_Position = vec4(corner * 2.0 - 1.0, -1.0, 1.0);
+}
+)""
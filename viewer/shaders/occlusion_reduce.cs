@@ -0,0 +1,36 @@
+R""(
+// Largest opaque depth and smallest depth drawn per cell of `CELL_SIZE`
+// pixels, see `occlusion.h`. One invocation per cell.
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(std430, binding=10) writeonly buffer occlusion_cell_buffer {
+  vec2 occlusion_cells[];
+};
+
+uniform ivec2 size;
+uniform ivec2 num_cells;
+
+const int CELL_SIZE = 16;
+
+void main() {
+  ivec2 cell = ivec2(gl_GlobalInvocationID.xy);
+  if (any(greaterThanEqual(cell, num_cells))) return;
+
+  ivec2 begin = cell * CELL_SIZE;
+  ivec2 end = min(begin + CELL_SIZE, size);
+  float infinity = uintBitsToFloat(0x7f800000u);
+  float depth = 0.0;
+  float nearest = infinity;
+  for (int y = begin.y; y < end.y; ++y) {
+    for (int x = begin.x; x < end.x; ++x) {
+      uvec4 p = occlusion_pixels[y * size.x + x];
+      // A pixel that is not opaque occludes nothing
+      depth = p.x >= OPAQUE_OPTICAL_DEPTH ? max(depth, uintBitsToFloat(p.y)) : infinity;
+      if (isinf(depth)) break;
+      nearest = min(nearest, uintBitsToFloat(~p.z));
+    }
+    if (isinf(depth)) break;
+  }
+  occlusion_cells[cell.y * num_cells.x + cell.x] = vec2(depth, nearest);
+}
+)""
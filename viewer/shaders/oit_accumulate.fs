@@ -0,0 +1,35 @@
+R""(
+// Weighted blended order-independent transparency (McGuire and Bavoil 2013).
+// Accumulates the premultiplied colors weighted by a falloff with depth, and
+// the product of the transmittances. `oit_composite.fs` resolves them.
+precision mediump float;
+
+in vec4 vColor;
+in vec2 vPosition;
+in float vDepth;
+layout(location = 0) out vec4 outAccum;
+layout(location = 1) out float outRevealage;
+
+uniform vec2 viewport;
+
+// One of the depth weights proposed in the paper, favors near splats.
+// Mirrored in `cpu_render.cc`.
+float oit_weight(float alpha, float depth) {
+  float z = abs(depth);
+  return alpha * clamp(10.0 / (1e-5 + pow(z / 5.0, 2.0) + pow(z / 200.0, 6.0)), 1e-2, 3e3);
+}
+
+void main () {
+  if (count_fragments)
+    atomicAdd(fragment_counts[uint(gl_FragCoord.y - viewport_origin.y) * uint(viewport.x)
+                       + uint(gl_FragCoord.x - viewport_origin.x)], 1);
+
+  float A = -dot(vPosition, vPosition);
+  if (A < -4.0) discard;
+  float B = exp(A) * vColor.a;
+  if (B < MIN_ALPHA) discard;
+  outAccum = vec4(B * vColor.rgb, B) * oit_weight(B, vDepth);
+  // Blended with (0, 1 - src), the product of (1 - B)
+  outRevealage = B;
+}
+)""
@@ -0,0 +1,16 @@
+R""(
+// Resolves the targets of `oit_accumulate.fs` into a premultiplied color
+uniform sampler2D accum;
+uniform sampler2D revealage;
+// Window coordinates of the target's origin
+uniform ivec2 origin;
+
+layout(location = 0) out vec4 outColor;
+
+void main () {
+  ivec2 p = ivec2(gl_FragCoord.xy) - origin;
+  vec4 sum = texelFetch(accum, p, 0);
+  float alpha = 1.0 - texelFetch(revealage, p, 0).r;
+  outColor = vec4(sum.rgb / max(sum.a, 1e-5) * alpha, alpha);
+}
+)""
@@ -0,0 +1,21 @@
+R""(
+// Heatmap of the number of splat evaluations per pixel, log scale from black
+// (none) over blue (1) to red (MAX_COUNT or more)
+uniform vec2 viewport;
+
+out vec4 outColor;
+
+const float MAX_COUNT = 1024.0;
+
+void main () {
+  uint count = fragment_counts[uint(gl_FragCoord.y - viewport_origin.y) * uint(viewport.x)
+                       + uint(gl_FragCoord.x - viewport_origin.x)];
+  if (count == 0) {
+    outColor = vec4(0.0, 0.0, 0.0, 1.0);
+    return;
+  }
+  float t = clamp(log2(float(count)) / log2(MAX_COUNT), 0.0, 1.0);
+  vec3 jet = clamp(1.5 - abs(4.0 * t - vec3(3.0, 2.0, 1.0)), 0.0, 1.0);
+  outColor = vec4(jet, 1.0);
+}
+)""
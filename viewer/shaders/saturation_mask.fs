@@ -0,0 +1,11 @@
+R""(
+// Writes depth for pixels whose accumulated alpha is saturated, later splat
+// fragments there fail the early depth test
+uniform sampler2D color;
+
+void main () {
+  // Under-compositing adds (1 - dst alpha) * src, nothing once the 8 bit
+  // alpha is at its maximum
+  if (texelFetch(color, ivec2(gl_FragCoord.xy), 0).a < 254.5 / 255.0) discard;
+}
+)""
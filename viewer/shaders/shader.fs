@@ -1,16 +1,42 @@
 R""(
 // Adapted from https://github.com/antimatter15/splat
-#version 430
 precision mediump float;
 
+// Depth is only used to mask saturated pixels, test it before shading
+layout(early_fragment_tests) in;
+
 in vec4 vColor;
 in vec2 vPosition;
+in float vDepth;
 layout(location = 0) out vec4 outColor;
 
+uniform vec2 viewport;
+
 void main () {    
+  if (count_fragments)
+    atomicAdd(fragment_counts[uint(gl_FragCoord.y - viewport_origin.y) * uint(viewport.x)
+                       + uint(gl_FragCoord.x - viewport_origin.x)], 1);
+
   float A = -dot(vPosition, vPosition);
   if (A < -4.0) discard;
   float B = exp(A) * vColor.a;
+  if (B < MIN_ALPHA) discard;
   outColor = vec4(B * vColor.rgb, B);
+
+  if (record_occlusion) {
+    uint pixel = uint(gl_FragCoord.y - viewport_origin.y) * uint(viewport.x)
+        + uint(gl_FragCoord.x - viewport_origin.x);
+    // Shifts the furthest on screen when the camera moves, see `cull`
+    atomicMax(occlusion_pixels[pixel].z, ~floatBitsToUint(vDepth));
+    // Fragments run in any order, but those up to the one that makes the
+    // pixel opaque have an optical depth of at least the threshold. The
+    // largest depth among them is not closer than where the sorted splats
+    // made it opaque.
+    if (occlusion_pixels[pixel].x < OPAQUE_OPTICAL_DEPTH) {
+      uint optical_depth = uint(-log(1.0 - min(B, 0.999)) * OPTICAL_DEPTH_SCALE);
+      if (atomicAdd(occlusion_pixels[pixel].x, optical_depth) < OPAQUE_OPTICAL_DEPTH)
+        atomicMax(occlusion_pixels[pixel].y, floatBitsToUint(vDepth));
+    }
+  }
 }
 )""
@@ -0,0 +1,44 @@
+R""(
+// Buffers shared by the passes of the tile renderer, see `tile_render.h`.
+// Splats are referred to by their rank in the depth order, so sorting the
+// splats of a tile by rank sorts them front to back.
+
+const uint TILE_SIZE = 16;
+
+struct Projected {
+  // xyz: conic (inverse 2D covariance), w: opacity
+  vec4 conic_opacity;
+  vec4 color;
+  // Pixels
+  vec2 center;
+  // Touched tiles, [tile_min, tile_max)
+  uvec2 tile_min;
+  uvec2 tile_max;
+};
+
+layout(std430, binding=3) readonly buffer index_buffer {
+  uint depth_index[];
+};
+
+layout(std430, binding=4) coherent buffer projected_buffer {
+  Projected projected[];
+};
+
+layout(std430, binding=5) coherent buffer tile_count_buffer {
+  uint tile_counts[];
+};
+
+// [start, end) into `tile_entries` per tile
+layout(std430, binding=6) coherent buffer tile_range_buffer {
+  uvec2 tile_ranges[];
+};
+
+layout(std430, binding=7) coherent buffer tile_entry_buffer {
+  uint num_entries;
+  uint tile_entries[];
+};
+
+uniform uint num_splats;
+uniform uvec2 num_tiles;
+uniform uint entry_capacity;
+)""
@@ -0,0 +1,20 @@
+R""(
+// Writes the rank of every splat into the entry lists of the tiles it touches
+layout(local_size_x = 256) in;
+
+void main() {
+  uint rank = gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x
+      + gl_GlobalInvocationID.x;
+  if (rank >= num_splats) return;
+
+  uvec2 tile_min = projected[rank].tile_min;
+  uvec2 tile_max = projected[rank].tile_max;
+  for (uint y = tile_min.y; y < tile_max.y; ++y) {
+    for (uint x = tile_min.x; x < tile_max.x; ++x) {
+      uint pos = atomicAdd(tile_counts[y * num_tiles.x + x], 1);
+      if (pos < entry_capacity)
+        tile_entries[pos] = rank;
+    }
+  }
+}
+)""
@@ -0,0 +1,51 @@
+R""(
+// Projects every splat once and counts the splats per tile
+layout(local_size_x = 256) in;
+
+uniform mat4 projection, view;
+uniform vec2 focal;
+uniform vec2 viewport;
+uniform vec3 cam_pos;
+
+void main() {
+  // 2D dispatch for more than 65535 work groups
+  uint rank = gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x
+      + gl_GlobalInvocationID.x;
+  if (rank >= num_splats) return;
+
+  uint idx = depth_index[rank];
+  projected[rank].tile_min = uvec2(0);
+  projected[rank].tile_max = uvec2(0);
+
+  Footprint f;
+  float alpha = splat_alpha(idx);
+  float radius = cutoff_radius(alpha);
+  if (radius == 0.0 || !project(idx, projection, view, focal, f)) return;
+
+  // The quad shader's Gaussian is exp(-dot(p, p)) in coordinates of the
+  // corner vectors v1, v2, i.e. exp(-0.5 d^T Q d) for a pixel offset d with
+  // Q = 2 (v1 v1^T / |v1|^4 + v2 v2^T / |v2|^4)
+  vec2 a1 = f.v1 / dot(f.v1, f.v1);
+  vec2 a2 = f.v2 / dot(f.v2, f.v2);
+  vec3 conic = 2.0 * vec3(a1.x * a1.x + a2.x * a2.x,
+                          a1.x * a1.y + a2.x * a2.y,
+                          a1.y * a1.y + a2.y * a2.y);
+
+  vec2 center = (f.pos2d.xy / f.pos2d.w + 1.0) * 0.5 * viewport;
+  vec2 extent = radius * sqrt(f.v1 * f.v1 + f.v2 * f.v2);
+
+  uvec2 tile_min = uvec2(clamp(floor((center - extent) / TILE_SIZE), vec2(0), vec2(num_tiles)));
+  uvec2 tile_max = uvec2(clamp(ceil((center + extent) / TILE_SIZE), vec2(0), vec2(num_tiles)));
+
+  vec3 ray_direction = normalize(splats[idx].center - cam_pos);
+  projected[rank].conic_opacity = vec4(conic, alpha);
+  projected[rank].color = vec4(get_rgb(idx, ray_direction), 1.0);
+  projected[rank].center = center;
+  projected[rank].tile_min = tile_min;
+  projected[rank].tile_max = tile_max;
+
+  for (uint y = tile_min.y; y < tile_max.y; ++y)
+    for (uint x = tile_min.x; x < tile_max.x; ++x)
+      atomicAdd(tile_counts[y * num_tiles.x + x], 1);
+}
+)""
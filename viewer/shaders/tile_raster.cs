@@ -0,0 +1,69 @@
+R""(
+// Blends the splats of a tile front to back, one thread per pixel. Splats
+// are loaded into shared memory in batches, the work group stops once every
+// pixel is saturated.
+layout(local_size_x = 16, local_size_y = 16) in;
+
+layout(rgba8, binding = 0) writeonly uniform image2D out_image;
+
+uniform vec2 viewport;
+
+const uint BATCH_SIZE = 256;
+const float MIN_TRANSMITTANCE = 1.0 / 4096.0;
+
+shared vec4 batch_conic_opacity[BATCH_SIZE];
+shared vec3 batch_color[BATCH_SIZE];
+shared vec2 batch_center[BATCH_SIZE];
+shared uint num_done;
+
+void main() {
+  uint tile = gl_WorkGroupID.y * num_tiles.x + gl_WorkGroupID.x;
+  uvec2 range = min(tile_ranges[tile], uvec2(entry_capacity));
+  uvec2 pixel = gl_GlobalInvocationID.xy;
+  bool inside = pixel.x < uint(viewport.x) && pixel.y < uint(viewport.y);
+  vec2 p = vec2(pixel) + 0.5;
+
+  vec3 C = vec3(0.0);
+  float T = 1.0;
+  bool done = !inside;
+  uint evaluated = 0;
+
+  for (uint batch = range.x; batch < range.y; batch += BATCH_SIZE) {
+    if (gl_LocalInvocationIndex == 0) num_done = 0;
+    barrier();
+    if (done) atomicAdd(num_done, 1);
+    barrier();
+    if (num_done == gl_WorkGroupSize.x * gl_WorkGroupSize.y) break;
+
+    uint entry = batch + gl_LocalInvocationIndex;
+    if (entry < range.y) {
+      uint rank = tile_entries[entry];
+      batch_conic_opacity[gl_LocalInvocationIndex] = projected[rank].conic_opacity;
+      batch_color[gl_LocalInvocationIndex] = projected[rank].color.rgb;
+      batch_center[gl_LocalInvocationIndex] = projected[rank].center;
+    }
+    barrier();
+
+    uint count = min(BATCH_SIZE, range.y - batch);
+    for (uint k = 0; k < count && !done; ++k) {
+      ++evaluated;
+      vec2 d = p - batch_center[k];
+      vec4 co = batch_conic_opacity[k];
+      float A = -0.5 * (co.x * d.x * d.x + 2.0 * co.y * d.x * d.y + co.z * d.y * d.y);
+      if (A < -4.0) continue;
+      float alpha = exp(A) * co.w;
+      if (alpha < MIN_ALPHA) continue;
+      C += T * alpha * batch_color[k];
+      T *= 1.0 - alpha;
+      done = T < MIN_TRANSMITTANCE;
+    }
+    barrier();
+  }
+
+  if (inside) {
+    imageStore(out_image, ivec2(pixel), vec4(C, 1.0 - T));
+    if (count_fragments)
+      fragment_counts[pixel.y * uint(viewport.x) + pixel.x] = evaluated;
+  }
+}
+)""
@@ -0,0 +1,39 @@
+R""(
+// Exclusive prefix sum over the tile counts, in a single work group
+layout(local_size_x = 1024) in;
+
+shared uint sums[1024];
+
+void main() {
+  uint tid = gl_LocalInvocationID.x;
+  uint total_tiles = num_tiles.x * num_tiles.y;
+  uint chunk = (total_tiles + 1023) / 1024;
+  uint begin = min(tid * chunk, total_tiles);
+  uint end = min(begin + chunk, total_tiles);
+
+  uint sum = 0;
+  for (uint t = begin; t < end; ++t)
+    sum += tile_counts[t];
+  sums[tid] = sum;
+  barrier();
+
+  for (uint offset = 1; offset < 1024; offset <<= 1) {
+    uint v = tid >= offset ? sums[tid - offset] : 0;
+    barrier();
+    sums[tid] += v;
+    barrier();
+  }
+
+  // `tile_counts` becomes the write cursor of each tile for the emit pass
+  uint start = tid == 0 ? 0 : sums[tid - 1];
+  for (uint t = begin; t < end; ++t) {
+    uint count = tile_counts[t];
+    tile_ranges[t] = uvec2(start, start + count);
+    tile_counts[t] = start;
+    start += count;
+  }
+
+  if (tid == 1023)
+    num_entries = sums[1023];
+}
+)""
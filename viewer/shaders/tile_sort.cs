@@ -0,0 +1,46 @@
+R""(
+// Sorts the entries of one tile by rank (front to back), one work group per
+// tile. Bitonic sort in the variant that only ever moves the smaller element
+// to the lower index, so the list can be padded to a power of two with
+// virtual elements at +infinity that are never written.
+layout(local_size_x = 256) in;
+
+void main() {
+  uint tile = gl_WorkGroupID.y * num_tiles.x + gl_WorkGroupID.x;
+  uvec2 range = tile_ranges[tile];
+  uint start = range.x;
+  uint len = min(range.y, entry_capacity) - min(range.x, entry_capacity);
+  if (len < 2) return;
+
+  uint n = 1;
+  while (n < len) n <<= 1;
+
+  for (uint k = 2; k <= n; k <<= 1) {
+    for (uint j = k >> 1; j > 0; j >>= 1) {
+      for (uint x = gl_LocalInvocationID.x; x < n / 2; x += gl_WorkGroupSize.x) {
+        uint lo, hi;
+        if (j == k >> 1) {
+          // Compare against the mirrored element of the block
+          uint block = x / j;
+          uint offset = x % j;
+          lo = block * k + offset;
+          hi = block * k + k - 1 - offset;
+        } else {
+          lo = (x / j) * 2 * j + x % j;
+          hi = lo + j;
+        }
+        if (hi < len) {
+          uint a = tile_entries[start + lo];
+          uint b = tile_entries[start + hi];
+          if (a > b) {
+            tile_entries[start + lo] = b;
+            tile_entries[start + hi] = a;
+          }
+        }
+      }
+      memoryBarrierBuffer();
+      barrier();
+    }
+  }
+}
+)""
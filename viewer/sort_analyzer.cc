@@ -0,0 +1,257 @@
+#include "camera.h"
+#include "cpu_render.h"
+#include "dataset.h"
+#include "logging.h"
+
+#include <chrono>
+#include <iostream>
+#include <cxxopts.hpp>
+
+// Measures how far the fast sort's depth key quantization deviates from the
+// exact `std::sort` ordering along a camera orbit: inversions of the
+// resulting order among the splats in the view frustum, pixels visibly
+// affected in a reference CPU rendering and time per sort, for a family of
+// key widths and depth binnings. Compares weighted blended order-independent
+// transparency, which needs no sort, in the same way.
+
+namespace {
+
+using namespace viewer;
+
+constexpr uint32_t CULLED = std::numeric_limits<uint32_t>::max();
+
+struct Variant {
+    std::string name;
+    dataset::SortOptions options;
+};
+
+struct Stats {
+    double sort_ms = 0.0;
+    double inversions = 0.0;
+    double affected_pixels = 0.0;
+    double mean_abs_error = 0.0;
+    float max_abs_error = 0.f;
+};
+
+std::vector<Variant> variants() {
+    const std::pair<const char*, dataset::DepthBinning> BINNINGS[] = {
+        {"float", dataset::DepthBinning::Float},
+        {"linear", dataset::DepthBinning::Linear},
+        {"reciprocal", dataset::DepthBinning::Reciprocal},
+        {"log", dataset::DepthBinning::Log},
+        {"equalized", dataset::DepthBinning::Equalized},
+    };
+
+    std::vector<Variant> v;
+    for (const auto& [binning_name, binning] : BINNINGS) {
+        for (const bool visible_range : {false, true}) {
+            // The float binning has no range
+            if (visible_range && binning == dataset::DepthBinning::Float) continue;
+            for (const int key_bits : {16, 24, 32}) {
+                v.push_back({
+                    .name = std::string(binning_name) + "/" + std::to_string(key_bits)
+                        + (visible_range ? "/visible" : ""),
+                    .options = {
+                        .fast_sort = true,
+                        .key_bits = key_bits,
+                        .binning = binning,
+                        .visible_range = visible_range,
+                    },
+                });
+            }
+        }
+    }
+    return v;
+}
+
+// Number of pairs in `ranks` that are out of order (merge sort)
+uint64_t count_inversions(std::vector<uint32_t>& ranks, std::vector<uint32_t>& tmp) {
+    const size_t N = ranks.size();
+    tmp.resize(N);
+    uint64_t inversions = 0;
+    for (size_t width = 1; width < N; width *= 2) {
+        for (size_t lo = 0; lo < N; lo += 2 * width) {
+            const size_t mid = std::min(lo + width, N);
+            const size_t hi = std::min(lo + 2 * width, N);
+            size_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) {
+                if (ranks[i] <= ranks[j]) {
+                    tmp[k++] = ranks[i++];
+                } else {
+                    inversions += mid - i;
+                    tmp[k++] = ranks[j++];
+                }
+            }
+            while (i < mid) tmp[k++] = ranks[i++];
+            while (j < hi) tmp[k++] = ranks[j++];
+        }
+        std::swap(ranks, tmp);
+    }
+    return inversions;
+}
+
+double time_sort(const dataset::Dataset& d, const Eigen::Matrix4f& P,
+                 const dataset::SortOptions& options, int repetitions,
+                 dataset::SortResult* out) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; ++i)
+        d.sort(P, out, options);
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / repetitions;
+}
+
+}
+
+int main(int argc, char** argv) {
+    cxxopts::Options options(argv[0], "Depth sort quality analyzer");
+    // clang-format off
+    options
+        .positional_help("file.ply")
+        .add_options()
+            ("h,help", "print this help message")
+            ("n,poses", "number of camera poses on the orbit",
+             cxxopts::value<int>()->default_value("8"))
+            ("r,radius", "orbit radius (default: twice the median distance to the centroid)",
+             cxxopts::value<float>())
+            ("width", "width of the reference rendering",
+             cxxopts::value<int>()->default_value("320"))
+            ("height", "height of the reference rendering",
+             cxxopts::value<int>()->default_value("180"))
+            ("fov", "horizontal field of view in degrees",
+             cxxopts::value<float>()->default_value("60"))
+            ("repetitions", "sorts per pose and variant for timing",
+             cxxopts::value<int>()->default_value("3"))
+            ("positional", "", cxxopts::value<std::vector<std::string>>());
+    // clang-format on
+
+    options.parse_positional({"positional"});
+    auto parsed_options = options.parse(argc, argv);
+
+    if (parsed_options.count("help") || parsed_options.count("positional") == 0 ||
+        parsed_options["positional"].as<std::vector<std::string>>().size() != 1) {
+        std::cout << options.help() << std::endl;
+        return -1;
+    }
+
+    const std::string ply_file_name =
+        parsed_options["positional"].as<std::vector<std::string>>().at(0);
+    const int num_poses = parsed_options["poses"].as<int>();
+    const int repetitions = parsed_options["repetitions"].as<int>();
+    const camera::CameraIntrinsics intrinsics = camera::from_fov(
+        parsed_options["fov"].as<float>(),
+        parsed_options["width"].as<int>(),
+        parsed_options["height"].as<int>());
+
+    LOG_INFO("loading %s...", ply_file_name.c_str());
+    const dataset::Dataset d(dataset::from_ply(ply_file_name));
+    const size_t N = d.centers().size();
+    if (N == 0)
+        LOG_FATAL("empty scene");
+
+    // Orbit around the centroid, robust against far away floaters
+    Eigen::Vector3f centroid = Eigen::Vector3f::Zero();
+    for (const auto& c : d.centers())
+        centroid += c;
+    centroid /= N;
+    float radius;
+    if (parsed_options.count("radius")) {
+        radius = parsed_options["radius"].as<float>();
+    } else {
+        std::vector<float> distances;
+        distances.reserve(N);
+        for (const auto& c : d.centers())
+            distances.push_back((c - centroid).norm());
+        std::nth_element(distances.begin(), distances.begin() + N / 2, distances.end());
+        radius = 2.f * distances.at(N / 2);
+    }
+
+    const std::vector<Variant> vs = variants();
+    std::vector<Stats> stats(vs.size());
+    Stats exact_stats;
+    Stats oit_stats;
+
+    dataset::SortResult exact, approx;
+    std::vector<uint32_t> rank(N), ranks, tmp;
+    for (int pose = 0; pose < num_poses; ++pose) {
+        const float angle = 2.f * M_PI * pose / num_poses;
+        const Eigen::Vector3f eye =
+            centroid + radius * Eigen::Vector3f(std::sin(angle), 0.f, std::cos(angle));
+        const Eigen::Matrix4f view =
+            camera::look_at(eye, centroid, -Eigen::Vector3f::UnitY());
+        const Eigen::Matrix4f P = camera::projection_matrix(intrinsics) * view;
+
+        exact_stats.sort_ms +=
+            time_sort(d, P, {.fast_sort = false}, repetitions, &exact);
+        const cpu_render::Image exact_image =
+            cpu_render::render(d.buffer(), exact.depth_index, view, intrinsics);
+
+        // Dense ranks in the exact order, splats at equal depth share a rank.
+        // Splats culled by the vertex shader are never drawn, their order
+        // does not matter.
+        float prev_depth = std::numeric_limits<float>::quiet_NaN();
+        uint32_t r = 0;
+        for (size_t i = 0; i < N; ++i) {
+            const uint32_t idx = exact.depth_index[i];
+            const float depth = P.block<1, 3>(2, 0).dot(d.centers()[idx]);
+            if (i > 0 && depth != prev_depth) ++r;
+            prev_depth = depth;
+
+            const Eigen::Vector4f pos2d = P * d.centers()[idx].homogeneous();
+            const float bounds = 1.2f * pos2d.w();
+            const bool visible = pos2d.z() >= -pos2d.w()
+                && std::abs(pos2d.x()) <= bounds
+                && std::abs(pos2d.y()) <= bounds;
+            rank[idx] = visible ? r : CULLED;
+        }
+
+        const cpu_render::ImageDiff oit_diff = cpu_render::compare(
+            exact_image,
+            cpu_render::render(d.buffer(), exact.depth_index, view, intrinsics, 3,
+                               cpu_render::Compositing::WeightedOit));
+        oit_stats.affected_pixels += oit_diff.affected_pixels;
+        oit_stats.mean_abs_error += oit_diff.mean_abs_error;
+        oit_stats.max_abs_error = std::max(oit_stats.max_abs_error, oit_diff.max_abs_error);
+
+        for (size_t v = 0; v < vs.size(); ++v) {
+            stats[v].sort_ms += time_sort(d, P, vs[v].options, repetitions, &approx);
+
+            ranks.clear();
+            for (size_t i = 0; i < N; ++i) {
+                if (rank[approx.depth_index[i]] != CULLED)
+                    ranks.push_back(rank[approx.depth_index[i]]);
+            }
+            stats[v].inversions += count_inversions(ranks, tmp);
+
+            const cpu_render::ImageDiff diff = cpu_render::compare(
+                exact_image,
+                cpu_render::render(d.buffer(), approx.depth_index, view, intrinsics));
+            stats[v].affected_pixels += diff.affected_pixels;
+            stats[v].mean_abs_error += diff.mean_abs_error;
+            stats[v].max_abs_error = std::max(stats[v].max_abs_error, diff.max_abs_error);
+        }
+        logging::print_progress(static_cast<double>(pose + 1) / num_poses);
+    }
+
+    // clang-format off
+    std::printf("%-22s %12s %16s %12s %12s %10s\n",
+                "variant", "ms/sort", "inversions", "affected %", "mean err", "max err");
+    std::printf("%-22s %12.2f %16s %12s %12s %10s\n",
+                "std::sort", exact_stats.sort_ms / num_poses, "-", "-", "-", "-");
+    for (size_t v = 0; v < vs.size(); ++v) {
+        std::printf("%-22s %12.2f %16.0f %12.4f %12.6f %10.4f\n",
+                    vs[v].name.c_str(),
+                    stats[v].sort_ms / num_poses,
+                    stats[v].inversions / num_poses,
+                    100.0 * stats[v].affected_pixels / num_poses,
+                    stats[v].mean_abs_error / num_poses,
+                    stats[v].max_abs_error);
+    }
+    std::printf("%-22s %12s %16s %12.4f %12.6f %10.4f\n",
+                "unsorted (OIT)", "-", "-",
+                100.0 * oit_stats.affected_pixels / num_poses,
+                oit_stats.mean_abs_error / num_poses,
+                oit_stats.max_abs_error);
+    // clang-format on
+
+    return 0;
+}
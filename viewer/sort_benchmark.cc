@@ -0,0 +1,129 @@
+#include "dataset.h"
+#include "logging.h"
+
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <cxxopts.hpp>
+
+// Sorts a synthetic scene with both sorting algorithms and checks that the
+// fast sort produces a valid front-to-back ordering. Large enough scenes
+// (> 2^24 splats) exercise the cases that need exact integer histograms.
+
+namespace {
+
+viewer::dataset::Centers random_centers(size_t n) {
+    std::mt19937 rng(0);
+    std::normal_distribution<float> dist(0.f, 10.f);
+    viewer::dataset::Centers centers(n);
+    for (auto& c : centers)
+        c = Eigen::Vector3f(dist(rng), dist(rng), dist(rng));
+    return centers;
+}
+
+bool check_order(const viewer::dataset::Centers& centers,
+                 const Eigen::Matrix4f& P,
+                 const viewer::dataset::SortResult& sr) {
+    const size_t N = centers.size();
+    if (sr.num_vertices() != N) {
+        LOG_ERROR("expected %lu indices, got %lu", N, sr.num_vertices());
+        return false;
+    }
+
+    std::vector<bool> seen(N, false);
+    float prev_depth = -std::numeric_limits<float>::infinity();
+    for (size_t i = 0; i < N; ++i) {
+        const uint32_t idx = sr.depth_index[i];
+        if (idx >= N || seen[idx]) {
+            LOG_ERROR("depth_index is not a permutation (at %lu)", i);
+            return false;
+        }
+        seen[idx] = true;
+
+        const float depth = P.block<1, 3>(2, 0).dot(centers[idx]);
+        if (depth < prev_depth) {
+            LOG_ERROR("depth_index is not sorted (at %lu)", i);
+            return false;
+        }
+        prev_depth = depth;
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+    using namespace viewer;
+
+    cxxopts::Options options(argv[0], "Depth sorting benchmark");
+    // clang-format off
+    options
+        .add_options()
+            ("h,help", "print this help message")
+            ("n,num-splats", "number of synthetic splats",
+             cxxopts::value<size_t>()->default_value("32000000"))
+            ("i,iterations", "number of sorts per algorithm",
+             cxxopts::value<int>()->default_value("5"))
+            ("skip-std", "do not run the std::sort baseline")
+            ("splat-order", "order of the synthetic splats in memory: file (random), morton or hilbert",
+             cxxopts::value<std::string>()->default_value("file"));
+    // clang-format on
+
+    auto parsed_options = options.parse(argc, argv);
+    if (parsed_options.count("help")) {
+        std::cout << options.help() << std::endl;
+        return -1;
+    }
+
+    const size_t num_splats = parsed_options["num-splats"].as<size_t>();
+    const int iterations = parsed_options["iterations"].as<int>();
+    const std::optional<dataset::SplatOrder> splat_order =
+        dataset::parse_splat_order(parsed_options["splat-order"].as<std::string>());
+    if (!splat_order)
+        LOG_FATAL("unknown splat order, expected file, morton or hilbert");
+
+    LOG_INFO("generating %lu splats...", num_splats);
+    dataset::Centers centers = random_centers(num_splats);
+    if (*splat_order != dataset::SplatOrder::File) {
+        const auto start = std::chrono::steady_clock::now();
+        const std::vector<uint32_t> order = dataset::spatial_order(centers, *splat_order);
+        dataset::Centers reordered(num_splats);
+        for (size_t i = 0; i < num_splats; ++i)
+            reordered[i] = centers[order[i]];
+        centers = std::move(reordered);
+        const auto end = std::chrono::steady_clock::now();
+        LOG_INFO("reordered in %.1f ms",
+                 std::chrono::duration<double, std::milli>(end - start).count());
+    }
+
+    bool ok = true;
+    dataset::SortResult sr;
+    for (const bool fast_sort : {true, false}) {
+        if (!fast_sort && parsed_options.count("skip-std")) continue;
+
+        double total_ms = 0.0;
+        for (int i = 0; i < iterations; ++i) {
+            // Orbit around the scene so every sort sees a different order
+            const float angle = 2.f * M_PI * i / iterations;
+            Eigen::Matrix4f P = Eigen::Matrix4f::Identity();
+            P.block<3, 3>(0, 0) =
+                Eigen::AngleAxisf(angle, Eigen::Vector3f::UnitY()).toRotationMatrix();
+
+            const auto start = std::chrono::steady_clock::now();
+            dataset::sort(centers, P, &sr, {.fast_sort = fast_sort});
+            const auto end = std::chrono::steady_clock::now();
+            total_ms += std::chrono::duration<double, std::milli>(end - start).count();
+
+            ok = check_order(centers, P, sr) && ok;
+        }
+        LOG_INFO("%s: mean %.1f ms per sort over %d sorts",
+                 fast_sort ? "radix sort" : "std::sort",
+                 total_ms / iterations, iterations);
+    }
+
+    if (!ok)
+        LOG_FATAL("invalid sort result");
+    LOG_INFO("all sort results valid");
+    return 0;
+}
@@ -0,0 +1,286 @@
+#include "tile_render.h"
+#include "logging.h"
+#include "program.h"
+#include "tracing.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <string>
+
+namespace viewer::rendering {
+
+namespace {
+
+static const char* COMMON_SHADER_SOURCE =
+#include "shaders/common.glsl"
+;
+static const char* TILE_COMMON_SHADER_SOURCE =
+#include "shaders/tile_common.glsl"
+;
+static const char* PREPROCESS_SHADER_SOURCE =
+#include "shaders/tile_preprocess.cs"
+;
+static const char* SCAN_SHADER_SOURCE =
+#include "shaders/tile_scan.cs"
+;
+static const char* EMIT_SHADER_SOURCE =
+#include "shaders/tile_emit.cs"
+;
+static const char* SORT_SHADER_SOURCE =
+#include "shaders/tile_sort.cs"
+;
+static const char* RASTER_SHADER_SOURCE =
+#include "shaders/tile_raster.cs"
+;
+
+constexpr int TILE_SIZE = 16;
+constexpr int WORK_GROUP_SIZE = 256;
+// std430 size of `Projected` in `shaders/tile_common.glsl`
+constexpr size_t PROJECTED_SIZE = 64;
+// Initial number of tile entries per splat, grown on demand
+constexpr size_t INITIAL_ENTRIES_PER_SPLAT = 4;
+
+uint32_t compute_program(std::initializer_list<const char*> sources) {
+    return create_program({{.type = GL_COMPUTE_SHADER, .sources = sources}});
+}
+
+GLuint create_buffer() {
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    return buffer;
+}
+
+void allocate(GLuint buffer, size_t num_bytes) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, num_bytes, nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// One invocation per splat, split over two dimensions for large scenes
+void dispatch_per_splat(size_t num_splats) {
+    constexpr size_t MAX_GROUPS = 65535;
+    const size_t groups = (num_splats + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE;
+    const size_t groups_x = std::min(groups, MAX_GROUPS);
+    const size_t groups_y = (groups + groups_x - 1) / groups_x;
+    glDispatchCompute(groups_x, groups_y, 1);
+}
+
+}
+
+TileRenderer::TileRenderer()
+    : programs_preprocess_({})
+    , program_scan_(compute_program({TILE_COMMON_SHADER_SOURCE, SCAN_SHADER_SOURCE}))
+    , program_emit_(compute_program({TILE_COMMON_SHADER_SOURCE, EMIT_SHADER_SOURCE}))
+    , program_sort_(compute_program({TILE_COMMON_SHADER_SOURCE, SORT_SHADER_SOURCE}))
+    , program_raster_(compute_program(
+          {COMMON_SHADER_SOURCE, TILE_COMMON_SHADER_SOURCE, RASTER_SHADER_SOURCE}))
+    , buf_projected_(create_buffer())
+    , buf_tile_counts_(create_buffer())
+    , buf_tile_ranges_(create_buffer())
+    , buf_tile_entries_(create_buffer())
+    , num_splats_(0)
+    , entry_capacity_(0)
+    , width_(0)
+    , height_(0)
+    , memory_(memory::Subsystem::GpuTileRenderer) {
+    for (CountReadback& r : count_readbacks_) {
+        r.buffer = create_buffer();
+        glBindBuffer(GL_COPY_WRITE_BUFFER, r.buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, sizeof(uint32_t), nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+TileRenderer::~TileRenderer() {
+    for (const GLuint program : programs_preprocess_) {
+        if (program)
+            glDeleteProgram(program);
+    }
+    for (const GLuint program : {program_scan_, program_emit_,
+                                 program_sort_, program_raster_})
+        glDeleteProgram(program);
+    for (const GLuint buffer : {buf_projected_, buf_tile_counts_,
+                                buf_tile_ranges_, buf_tile_entries_})
+        glDeleteBuffers(1, &buffer);
+    for (CountReadback& r : count_readbacks_) {
+        if (r.fence)
+            glDeleteSync(static_cast<GLsync>(r.fence));
+        glDeleteBuffers(1, &r.buffer);
+    }
+}
+
+uint32_t TileRenderer::program_preprocess(int splat_sh_degree, int sh_degree) {
+    sh_degree = std::clamp(sh_degree, 0, splat_sh_degree);
+    uint32_t& program = programs_preprocess_.at(splat_sh_degree * 4 + sh_degree);
+    if (!program) {
+        const std::string defines = sh_variant_defines(splat_sh_degree, sh_degree);
+        program = compute_program({defines.c_str(), COMMON_SHADER_SOURCE,
+                                   TILE_COMMON_SHADER_SOURCE, PREPROCESS_SHADER_SOURCE});
+    }
+    return program;
+}
+
+void TileRenderer::resize(size_t num_splats, int width, int height) {
+    if (num_splats != num_splats_) {
+        num_splats_ = num_splats;
+        allocate(buf_projected_, std::max<size_t>(1, num_splats) * PROJECTED_SIZE);
+        if (entry_capacity_ < num_splats * INITIAL_ENTRIES_PER_SPLAT) {
+            entry_capacity_ = num_splats * INITIAL_ENTRIES_PER_SPLAT;
+            allocate(buf_tile_entries_, (entry_capacity_ + 1) * sizeof(uint32_t));
+        }
+    }
+
+    if (width != width_ || height != height_) {
+        width_ = width;
+        height_ = height;
+        const size_t num_tiles =
+            ((width + TILE_SIZE - 1) / TILE_SIZE) * ((height + TILE_SIZE - 1) / TILE_SIZE);
+        allocate(buf_tile_counts_, num_tiles * sizeof(uint32_t));
+        allocate(buf_tile_ranges_, num_tiles * 2 * sizeof(uint32_t));
+        output_.resize(width, height);
+    }
+    update_memory();
+}
+
+void TileRenderer::update_memory() {
+    const size_t num_tiles =
+        ((width_ + TILE_SIZE - 1) / TILE_SIZE) * ((height_ + TILE_SIZE - 1) / TILE_SIZE);
+    memory_.resize(std::max<size_t>(1, num_splats_) * PROJECTED_SIZE
+                   + (entry_capacity_ + 1) * sizeof(uint32_t)
+                   + num_tiles * 3 * sizeof(uint32_t));
+}
+
+void TileRenderer::poll_entry_counts() {
+    GLuint max_entries = 0;
+    for (; num_counts_polled_ < num_counts_begun_; ++num_counts_polled_) {
+        CountReadback& r = count_readbacks_[num_counts_polled_ % NUM_COUNT_READBACKS];
+        const GLenum status = glClientWaitSync(static_cast<GLsync>(r.fence), 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        glDeleteSync(static_cast<GLsync>(r.fence));
+        r.fence = nullptr;
+        GLuint num_entries;
+        glBindBuffer(GL_COPY_READ_BUFFER, r.buffer);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(num_entries), &num_entries);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        max_entries = std::max(max_entries, num_entries);
+    }
+    if (max_entries > entry_capacity_) {
+        entry_capacity_ = max_entries + max_entries / 2;
+        allocate(buf_tile_entries_, (entry_capacity_ + 1) * sizeof(uint32_t));
+        update_memory();
+    }
+}
+
+void TileRenderer::render(const Frame& frame,
+                          uint32_t ssbo_splats,
+                          uint32_t buf_index,
+                          size_t num_splats) {
+    tracing::RecorderGuard tracing_guard("tile render");
+    const int width = static_cast<int>(frame.intrinsics.width);
+    const int height = static_cast<int>(frame.intrinsics.height);
+    if (width <= 0 || height <= 0 || num_splats == 0) return;
+    resize(num_splats, width, height);
+    poll_entry_counts();
+
+    const GLuint num_tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    const GLuint num_tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    auto set_common_uniforms = [&](GLuint program) {
+        glUseProgram(program);
+        glUniform1ui(glGetUniformLocation(program, "num_splats"), num_splats);
+        glUniform2ui(glGetUniformLocation(program, "num_tiles"), num_tiles_x, num_tiles_y);
+        glUniform1ui(glGetUniformLocation(program, "entry_capacity"), entry_capacity_);
+    };
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ssbo_splats);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, buf_index);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, buf_projected_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, buf_tile_counts_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, buf_tile_ranges_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, buf_tile_entries_);
+
+    {
+        tracing::RecorderGuard tracing_guard("preprocess");
+        const GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buf_tile_counts_);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+                          GL_UNSIGNED_INT, &zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        const GLuint p = program_preprocess(frame.splat_sh_degree, frame.sh_degree);
+        set_common_uniforms(p);
+        glUniformMatrix4fv(glGetUniformLocation(p, "projection"), 1, GL_FALSE,
+                           frame.projection.data());
+        glUniformMatrix4fv(glGetUniformLocation(p, "view"), 1, GL_FALSE,
+                           frame.view.data());
+        glUniform2f(glGetUniformLocation(p, "focal"),
+                    frame.intrinsics.fx, frame.intrinsics.fy);
+        glUniform2f(glGetUniformLocation(p, "viewport"),
+                    frame.intrinsics.width, frame.intrinsics.height);
+        const Eigen::Vector3f cam_pos(frame.view.inverse().block<3, 1>(0, 3));
+        glUniform3fv(glGetUniformLocation(p, "cam_pos"), 1, cam_pos.data());
+        glUniform1f(glGetUniformLocation(p, "opacity_exponent"), frame.opacity_exponent);
+        glUniform1i(glGetUniformLocation(p, "crop_mode"), frame.crop_mode);
+        glUniform3fv(glGetUniformLocation(p, "crop_min"), 1, frame.crop_min.data());
+        glUniform3fv(glGetUniformLocation(p, "crop_max"), 1, frame.crop_max.data());
+        dispatch_per_splat(num_splats);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    {
+        tracing::RecorderGuard tracing_guard("scan");
+        set_common_uniforms(program_scan_);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    }
+
+    if (num_counts_begun_ - num_counts_polled_ < NUM_COUNT_READBACKS) {
+        // Unlike the reference implementation, the emit pass does not wait
+        // for the count: it skips the entries past the capacity
+        CountReadback& r = count_readbacks_[num_counts_begun_ % NUM_COUNT_READBACKS];
+        glBindBuffer(GL_COPY_READ_BUFFER, buf_tile_entries_);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, r.buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(uint32_t));
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        ++num_counts_begun_;
+    }
+
+    {
+        tracing::RecorderGuard tracing_guard("emit");
+        set_common_uniforms(program_emit_);
+        dispatch_per_splat(num_splats);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    {
+        tracing::RecorderGuard tracing_guard("tile sort");
+        set_common_uniforms(program_sort_);
+        glDispatchCompute(num_tiles_x, num_tiles_y, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    {
+        tracing::RecorderGuard tracing_guard("raster");
+        set_common_uniforms(program_raster_);
+        glUniform2f(glGetUniformLocation(program_raster_, "viewport"),
+                    frame.intrinsics.width, frame.intrinsics.height);
+        glUniform1i(glGetUniformLocation(program_raster_, "count_fragments"),
+                    frame.count_fragments);
+        glBindImageTexture(0, output_.color_texture(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+        glDispatchCompute(num_tiles_x, num_tiles_y, 1);
+        glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+    }
+
+    for (GLuint binding = 2; binding <= 7; ++binding)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    output_.blit(viewport[0], viewport[1], width, height);
+}
+
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "memory.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <Eigen/Dense>
+
+// Compute shader rasterizer in the style of the reference 3D Gaussian
+// Splatting implementation: splats are projected once, binned into 16x16
+// pixel tiles, sorted per tile and blended front to back per pixel in shared
+// memory, stopping early once a pixel is saturated. Uses the global depth
+// order of the sort worker, so sorting a tile only needs to sort ranks.
+
+namespace viewer::rendering {
+
+class TileRenderer {
+public:
+    struct Frame {
+        Eigen::Matrix4f projection;
+        Eigen::Matrix4f view;
+        camera::CameraIntrinsics intrinsics;
+        // Of the layout of the splats, `dataset::SplatT<splat_sh_degree>`
+        int splat_sh_degree;
+        int sh_degree;
+        // See `shaders/common.glsl`
+        float opacity_exponent;
+        // See `shaders/common.glsl`
+        int crop_mode;
+        Eigen::Vector3f crop_min;
+        Eigen::Vector3f crop_max;
+        // Write the number of evaluated splats per pixel to the buffer bound
+        // at binding 8, see `shaders/common.glsl`
+        bool count_fragments;
+    };
+
+    TileRenderer();
+    ~TileRenderer();
+
+    // Renders `num_splats` splats from the SSBO `ssbo_splats` in the order of
+    // the index buffer `buf_index` into the current draw framebuffer, at the
+    // origin of the current viewport
+    void render(const Frame& frame,
+                uint32_t ssbo_splats,
+                uint32_t buf_index,
+                size_t num_splats);
+
+private:
+    void resize(size_t num_splats, int width, int height);
+    void update_memory();
+    // Grows the entry buffer to the largest entry count read back so far
+    void poll_entry_counts();
+    // Compiled on first use
+    uint32_t program_preprocess(int splat_sh_degree, int sh_degree);
+
+private:
+    // Specialized per splat layout and shading degree, indexed by
+    // `splat_sh_degree * 4 + sh_degree`
+    std::array<uint32_t, 16> programs_preprocess_;
+    uint32_t program_scan_;
+    uint32_t program_emit_;
+    uint32_t program_sort_;
+    uint32_t program_raster_;
+
+    uint32_t buf_projected_;
+    uint32_t buf_tile_counts_;
+    uint32_t buf_tile_ranges_;
+    uint32_t buf_tile_entries_;
+    Framebuffer output_;
+
+    // Entry counts of recent frames, read back without waiting for the GPU.
+    // A frame with more entries than `entry_capacity_` drops the excess,
+    // until the count arrives and the buffer is grown.
+    static constexpr size_t NUM_COUNT_READBACKS = 3;
+    struct CountReadback {
+        uint32_t buffer = 0;
+        // GLsync of the copy
+        void* fence = nullptr;
+    };
+    std::array<CountReadback, NUM_COUNT_READBACKS> count_readbacks_;
+    uint64_t num_counts_begun_ = 0;
+    uint64_t num_counts_polled_ = 0;
+
+    size_t num_splats_;
+    size_t entry_capacity_;
+    int width_;
+    int height_;
+    memory::Allocation memory_;
+};
+
+}
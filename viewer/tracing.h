@@ -5,11 +5,14 @@
 #include <algorithm>
 #include <chrono>
 #include <fstream>
+#include <functional>
 #include <optional>
 #include <source_location>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 // Tracing utility producing json files in the Chrome tracing format.
 // Tracing format spec:
@@ -30,6 +33,13 @@ struct TraceEntry {
     std::thread::id thread_id;
 };
 
+// Values of a counter track at one point in time, stacked in the viewer
+struct CounterEntry {
+    std::string name;
+    int64_t time;
+    std::vector<std::pair<std::string, int64_t>> values;
+};
+
 class Tracing {
     struct Session {
         Session(const std::string& filepath_) : filepath(filepath_) {}
@@ -57,12 +67,27 @@ public:
 
         thread_ids_.clear();
         thread_ids_[std::this_thread::get_id()] = 0;
+
+        std::vector<std::function<void()>> callbacks;
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            callbacks = begin_callbacks_;
+        }
+        for (const auto& callback : callbacks) callback();
+    }
+
+    // Called when a session begins, e.g. to record the initial value of
+    // counters that are otherwise only recorded when they change
+    void on_begin(std::function<void()> callback) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        begin_callbacks_.push_back(std::move(callback));
     }
 
     void end() {
         if (!session_.has_value()) return;
 
         for (const auto& entry : trace_) write_profile(entry);
+        for (const auto& entry : counters_) write_counter(entry);
 
         write_footer();
         out_.close();
@@ -71,6 +96,8 @@ public:
             "wrote %lu profile entries to %s", count_, session_->filepath.c_str());
 
         session_.reset();
+        trace_.clear();
+        counters_.clear();
         count_ = 0;
     }
 
@@ -81,7 +108,35 @@ public:
         trace_.emplace_back(std::forward<Args>(args)...);
     }
 
+    void record_counter(const std::string& name,
+                        std::vector<std::pair<std::string, int64_t>> values) {
+        const int64_t time_micros =
+            std::chrono::time_point_cast<std::chrono::microseconds>(
+                std::chrono::high_resolution_clock::now())
+            .time_since_epoch()
+            .count();
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (!session_.has_value()) return;
+        counters_.push_back({name, time_micros, std::move(values)});
+    }
+
 private:
+    void write_counter(const CounterEntry& entry) {
+        if (count_++ > 0) out_ << ",";
+
+        out_ << "{";
+        out_ << "\"name\":\"" << entry.name << "\",";
+        out_ << "\"ph\":\"C\",";
+        out_ << "\"pid\":0,";
+        out_ << "\"ts\":" << entry.time << ",";
+        out_ << "\"args\":{";
+        for (size_t i = 0; i < entry.values.size(); ++i) {
+            if (i > 0) out_ << ",";
+            out_ << "\"" << entry.values[i].first << "\":" << entry.values[i].second;
+        }
+        out_ << "}}";
+    }
+
     void write_profile(const TraceEntry& result) {
         if (count_++ > 0) out_ << ",";
 
@@ -117,9 +172,11 @@ private:
 private:
     std::optional<Session> session_;
     std::vector<TraceEntry> trace_;
+    std::vector<CounterEntry> counters_;
     std::ofstream out_;
     size_t count_;
     std::unordered_map<std::thread::id, size_t> thread_ids_;
+    std::vector<std::function<void()>> begin_callbacks_;
     std::mutex mutex_;
 };
 
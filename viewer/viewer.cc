@@ -2,7 +2,12 @@
 #include "dataset.h"
 #include "render.h"
 #include "gui.h"
+#include "live.h"
+#include "playlist.h"
+#include "sequence.h"
+#include "session.h"
 
+#include <chrono>
 #include <iostream>
 #include <cxxopts.hpp>
 
@@ -37,12 +42,35 @@ void render(const rendering::Renderer& r, gui::Gui& gui) {
     ImGui::NewFrame();
 
     r.render();
+    gui.frame_stats = r.frame_stats();
     gui.render();
 
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
+session::Frame frame_from_gui(const gui::Gui& gui, int width, int height, double time) {
+    session::Frame frame{
+        .time = time,
+        .fov_deg = gui.fov_deg,
+        .width = gui.stereo ? width / 2 : width,
+        .height = height,
+        .views = {},
+        .config = gui.renderer_config,
+    };
+    if (gui.stereo) {
+        // Eyes offset along the camera's x axis
+        Eigen::Matrix4f left = gui.mat_view;
+        Eigen::Matrix4f right = gui.mat_view;
+        left.block<3, 1>(0, 3).x() += 0.5f * gui.eye_separation;
+        right.block<3, 1>(0, 3).x() -= 0.5f * gui.eye_separation;
+        frame.views = {left, right};
+    } else {
+        frame.views = {gui.mat_view};
+    }
+    return frame;
+}
+
 void init_imgui(GLFWwindow* window)
 {
     // Setup Dear ImGui binding
@@ -65,11 +93,36 @@ int main(int argc, char** argv) {
     cxxopts::Options options(argv[0], "3D Gaussian Splat Viewer");
     // clang-format off
     options
-        .positional_help("file.ply")
+        .positional_help("file.ply|directory...")
         .add_options()
             ("h,help", "print this help message")
             ("disable-vsync", "disable vsync")
             ("gl-debug", "print OpenGL debug messages")
+            ("readahead", "read ahead sequentially while loading (for slow storage)")
+            ("sh-degree", "highest spherical harmonics degree to load (0-3, lower needs less memory)",
+             cxxopts::value<int>()->default_value("3"))
+            ("splat-order", "order of the splats in memory: file, morton or hilbert (spatially coherent, faster to draw)",
+             cxxopts::value<std::string>()->default_value("file"))
+            ("cache-order", "keep the splat order in <file>.order for the next load")
+            ("prefetch", "scenes to load ahead of the current one",
+             cxxopts::value<int>()->default_value("1"))
+            ("prefetch-budget-mb", "memory for the scenes loaded ahead",
+             cxxopts::value<size_t>()->default_value("4096"))
+            ("record", "record the camera and settings of every frame to a session file",
+             cxxopts::value<std::string>())
+            ("replay", "replay a session file with vsync off, print frame times and exit",
+             cxxopts::value<std::string>())
+            ("replay-async", "do not wait for the sort of each replayed frame (realistic, but not deterministic)")
+            ("report", "write the frame times of the replay to a CSV file",
+             cxxopts::value<std::string>())
+            ("live", "receive live splat updates on a Unix domain socket (see live.h)",
+             cxxopts::value<std::string>()->implicit_value("/tmp/splatview-live.sock"))
+            ("live-port", "receive live splat updates on a localhost TCP port instead",
+             cxxopts::value<int>()->default_value("0"))
+            ("fps", "playback frame rate of a .splatseq sequence (default: that of the file)",
+             cxxopts::value<float>())
+            ("sequence-budget-mb", "memory for the frames of a sequence decoded ahead",
+             cxxopts::value<size_t>()->default_value("2048"))
             ("positional", "", cxxopts::value<std::vector<std::string>>());
     // clang-format on
 
@@ -78,19 +131,46 @@ int main(int argc, char** argv) {
 
     bool enable_vsync = parsed_options.count("disable-vsync") == 0;
     const bool enable_gldebug = parsed_options.count("gl-debug") == 1;
+    const std::optional<dataset::SplatOrder> splat_order =
+        dataset::parse_splat_order(parsed_options["splat-order"].as<std::string>());
+    if (!splat_order)
+        LOG_FATAL("unknown splat order, expected file, morton or hilbert");
+    const dataset::LoadOptions load_options{
+        .readahead = parsed_options.count("readahead") == 1,
+        .sh_degree = parsed_options["sh-degree"].as<int>(),
+        .order = *splat_order,
+        .cache_order = parsed_options.count("cache-order") == 1,
+    };
+    std::optional<session::Recorder> recorder;
+    if (parsed_options.count("record"))
+        recorder.emplace(parsed_options["record"].as<std::string>());
+    std::vector<session::Frame> replay;
+    if (parsed_options.count("replay")) {
+        replay = session::load(parsed_options["replay"].as<std::string>());
+        enable_vsync = false;
+    }
+    const bool replay_async = parsed_options.count("replay-async") == 1;
 
-    if (parsed_options.count("help") || parsed_options.count("positional") == 0 ||
-        parsed_options["positional"].as<std::vector<std::string>>().size() != 1) {
+    if (parsed_options.count("help") || parsed_options.count("positional") == 0) {
         std::cout << options.help() << std::endl;
         return -1;
     }
 
-    const std::string ply_file_name =
-        parsed_options["positional"].as<std::vector<std::string>>().at(0);
-    LOG_INFO("loading %s...", ply_file_name.c_str());
-    const dataset::Dataset d(dataset::from_ply(ply_file_name));
-    LOG_INFO("done");
-
+    std::vector<std::string> ply_file_names =
+        playlist::expand(parsed_options["positional"].as<std::vector<std::string>>());
+    // A single sequence is played back instead of a playlist
+    std::optional<std::string> sequence_file;
+    if (ply_file_names.size() == 1 && ply_file_names[0].ends_with(".splatseq"))
+        sequence_file = ply_file_names[0];
+    const sequence::PlayerOptions player_options{
+        .sh_degree = load_options.sh_degree,
+        .budget_bytes = parsed_options["sequence-budget-mb"].as<size_t>() << 20,
+    };
+    const playlist::Options playlist_options{
+        .load = load_options,
+        .prefetch = parsed_options["prefetch"].as<int>(),
+        .budget_bytes = parsed_options["prefetch-budget-mb"].as<size_t>() << 20,
+    };
     if (!glfwInit()) {
         LOG_ERROR("GLFW init failed");
         return -1;
@@ -106,6 +186,15 @@ int main(int argc, char** argv) {
         return -1;
     }
 
+    // Scenes are loaded into a second context sharing the buffers
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* loader_window = glfwCreateWindow(1, 1, argv[0], NULL, window);
+    if (!loader_window) {
+        LOG_ERROR("GLFW window creation failed");
+        glfwTerminate();
+        return -1;
+    }
+
     glfwMakeContextCurrent(window);
 
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
@@ -117,37 +206,203 @@ int main(int argc, char** argv) {
     glDebugMessageCallback(gl_error_callback, 0);
     init_imgui(window);
 
-    rendering::Renderer renderer(d);
+    std::optional<playlist::Playlist> scenes;
+    std::optional<sequence::Player> player;
+    size_t scene_index = 0;
+    std::optional<size_t> requested_scene;
+    dataset::Dataset d{dataset::SplatBuffer{}};
+    uint32_t ssbo_splats;
+    if (sequence_file) {
+        player.emplace(*sequence_file, player_options, loader_window);
+        sequence::Frame frame = player->take(0);
+        d = std::move(frame.dataset);
+        ssbo_splats = frame.ssbo_splats;
+    } else {
+        scenes.emplace(std::move(ply_file_names), playlist_options, loader_window);
+        playlist::Scene scene = scenes->take(scene_index);
+        d = std::move(scene.dataset);
+        ssbo_splats = scene.ssbo_splats;
+    }
+
+    // The frames of a sequence go back to its ring once replaced
+    rendering::Renderer renderer(d, ssbo_splats, player.has_value());
+    std::optional<live::Server> live_server;
+    const int live_port = parsed_options["live-port"].as<int>();
+    if (parsed_options.count("live") || live_port > 0) {
+        // The updates index the splats of one scene
+        if (player || scenes->size() > 1)
+            LOG_FATAL("live updates need a single scene");
+        // In the order of the file
+        if (*splat_order != dataset::SplatOrder::File)
+            LOG_FATAL("live updates need --splat-order file");
+        live_server.emplace(
+            parsed_options.count("live") ? parsed_options["live"].as<std::string>() : "",
+            live_port, d.size());
+        renderer.set_live();
+    }
     gui::Gui gui(window);
+    gui.num_scenes = scenes ? scenes->size() : 1;
+    if (player) {
+        gui.sequence_frames = player->num_frames();
+        gui.sequence_fps = parsed_options.count("fps")
+            ? parsed_options["fps"].as<float>() : player->fps();
+    }
+    // Playback position of the sequence in frames, counting on across loops,
+    // and that of the frame shown
+    double sequence_time = 0.0;
+    uint64_t shown_position = 0;
 
     glfwSwapInterval(enable_vsync ? 1 : 0);
     gui.enable_vsync = enable_vsync;
 
+    using Clock = std::chrono::steady_clock;
+    const auto ms_between = [](Clock::time_point a, Clock::time_point b) {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    };
+    const auto start = Clock::now();
+    auto prev_frame_start = start;
+    std::vector<session::FrameTiming> timings;
+
     int width, height;
     while (!glfwWindowShouldClose(window) && !gui.close_requested) {
+        const auto frame_start = Clock::now();
+        const double frame_ms = ms_between(prev_frame_start, frame_start);
+        if (!timings.empty())
+            timings.back().frame_ms = frame_ms;
+        prev_frame_start = frame_start;
+        if (!replay.empty() && timings.size() == replay.size())
+            break;
+
         if (gui.enable_vsync != enable_vsync) {
             enable_vsync = gui.enable_vsync;
             glfwSwapInterval(enable_vsync ? 1 : 0);
         }
         glfwGetFramebufferSize(window, &width, &height);
-        glViewport(0, 0, width, height);
+        session::Frame frame;
+        if (replay.empty()) {
+            frame = frame_from_gui(gui, width, height,
+                                   std::chrono::duration<double>(frame_start - start).count());
+        } else {
+            // The replayed frame's size, independent of the window
+            frame = replay[timings.size()];
+            if (!replay_async) {
+                // Without what depends on timing: the predicted view, the
+                // resolution from measured GPU times and the occlusion of
+                // readbacks arriving at different frames
+                frame.config.predict_camera_motion = false;
+                frame.config.resolution.enabled = false;
+                frame.config.occlusion_culling = false;
+            }
+            gui.renderer_config = frame.config;
+        }
+        if (recorder)
+            recorder->record(frame);
+
+        glViewport(0, 0, frame.width * frame.views.size(), frame.height);
         renderer.use_program();
-        const float fxy = 0.5f * width / std::tan(0.5f * gui.fov_deg * M_PI / 180.f);
         renderer.set_camera_intrinsics(
-            {.fx = fxy, .fy = fxy,
-             .width = static_cast<float>(width),
-             .height = static_cast<float>(height)});
-        renderer.set_config(gui.renderer_config);
-        renderer.set_view(gui.mat_view);
+            camera::from_fov(frame.fov_deg,
+                             static_cast<float>(frame.width),
+                             static_cast<float>(frame.height)));
+        renderer.set_config(frame.config);
+        renderer.set_views(frame.views);
+
+        if (!replay.empty()) {
+            session::FrameTiming timing;
+            if (!replay_async) {
+                const auto wait_start = Clock::now();
+                renderer.wait_for_sort();
+                timing.sort_wait_ms = ms_between(wait_start, Clock::now());
+            }
+            timings.push_back(timing);
+        }
         render(renderer, gui);
+        if (!replay.empty()) {
+            const rendering::FrameStats& stats = gui.frame_stats;
+            timings.back().gpu_ms = stats.gpu_ms;
+            timings.back().sort_ms = stats.sort_ms;
+            timings.back().sort_latency_ms = stats.sort_latency_ms;
+        }
+        if (live_server) {
+            for (live::Update& update : live_server->poll()) {
+                if (update.splats.empty())
+                    renderer.delete_range({update.first, update.first + update.num_deleted});
+                else
+                    renderer.update_splats(update.first, std::move(update.splats));
+            }
+        }
+        if (gui.delete_requested)
+            renderer.delete_splats(gui.renderer_config.box_edit.box,
+                                   gui.renderer_config.box_edit.inside);
+        if (gui.save_requested && player) {
+            LOG_ERROR("frames of a sequence cannot be saved");
+        } else if (gui.save_requested) {
+            LOG_INFO("saving %s...", gui.save_path.data());
+            renderer.save_ply(scenes->filename(scene_index), gui.save_path.data());
+        }
+        if (player) {
+            for (const uint32_t ssbo : renderer.recycled_buffers())
+                player->recycle(ssbo);
+            const uint64_t num_frames = player->num_frames();
+            const uint64_t loop_start = shown_position - shown_position % num_frames;
+            if (gui.sequence_seek)
+                sequence_time = loop_start + gui.sequence_frame;
+            else if (gui.sequence_playing)
+                sequence_time += frame_ms / 1e3 * gui.sequence_fps;
+            uint64_t position = static_cast<uint64_t>(sequence_time);
+            if (!gui.sequence_loop && position >= loop_start + num_frames) {
+                position = loop_start + num_frames - 1;
+                sequence_time = position;
+                gui.sequence_playing = false;
+            }
+            // Frames that are not decoded in time are skipped
+            if (position != shown_position) {
+                if (std::optional<sequence::Frame> frame = player->try_take(position)) {
+                    renderer.set_scene(std::move(frame->dataset), frame->ssbo_splats, true);
+                    shown_position = frame->position;
+                }
+            }
+            gui.sequence_frame = shown_position % num_frames;
+            gui.sequence_ahead = player->num_ahead();
+            gui.sequence_ring_size = player->ring_size();
+        }
+        if (gui.scene_step != 0 && scenes) {
+            const size_t n = scenes->size();
+            const size_t from = requested_scene.value_or(scene_index);
+            requested_scene = (from + n + gui.scene_step % static_cast<int>(n)) % n;
+            // Stepped back to the scene shown, which was taken already
+            if (*requested_scene == scene_index) {
+                requested_scene.reset();
+                scenes->set_current(scene_index);
+            }
+        }
+        // The current scene stays until the requested one is loaded
+        if (requested_scene) {
+            if (std::optional<playlist::Scene> next = scenes->try_take(*requested_scene)) {
+                renderer.set_scene(std::move(next->dataset), next->ssbo_splats);
+                scene_index = *requested_scene;
+                requested_scene.reset();
+            }
+        }
+        gui.scene_index = scene_index;
+        gui.scene_name = scenes ? scenes->filename(scene_index) : *sequence_file;
+        gui.scene_loading = requested_scene.has_value();
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
+    if (!replay.empty())
+        session::report(timings,
+                        parsed_options.count("report") ? parsed_options["report"].as<std::string>() : "");
+
+    // Stops loading before the contexts go away
+    scenes.reset();
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
 
+    glfwDestroyWindow(loader_window);
     glfwDestroyWindow(window);
     glfwTerminate();
 